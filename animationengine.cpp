@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "animationengine.h"
+#include "framescheduler.h"
+#include "graphicsspriteitem.h"
+#include "trace.h"
+#include <algorithm>
+
+AnimationEngine::Machine::Machine(const StateDef* states, int stateCount,
+                                  const TransitionDef* transitions, int transitionCount,
+                                  int eventCount, const GraphicsSpriteItem& sprite)
+    : m_targets(stateCount * eventCount, -1),
+      m_eventCount(eventCount)
+{
+    m_states.reserve(stateCount);
+    for (int i = 0; i < stateCount; i++)
+    {
+        const StateDef& def = states[i];
+        int sequence = sprite.sequence(def.sequence);
+        if (sequence < 0)
+            qFatal("no sprite sequence %s", def.sequence);
+
+        /*
+         * Frames of a sequence can each have their own duration.
+         */
+        State state;
+        state.sequence = sequence;
+        state.frames = qMax(1, sprite.frameCount(sequence));
+        state.duration = qMax(1LL, (qint64)sprite.duration(sequence) * 1000000LL);
+        state.ends = m_ends.size();
+        for (auto end: sprite.frameEnds(sequence))
+            m_ends.push_back((qint64)end * 1000000LL);
+        m_ends.resize(state.ends + state.frames, state.duration);
+        state.loops = def.loops;
+        state.next = def.next;
+        m_states.push_back(state);
+    }
+
+    for (int i = 0; i < transitionCount; i++)
+    {
+        const TransitionDef& def = transitions[i];
+        if (def.from < 0 || def.from >= stateCount || def.to < 0 || def.to >= stateCount ||
+            def.event < 0 || def.event >= eventCount)
+            qFatal("invalid animation transition %d", i);
+
+        m_targets[def.from * eventCount + def.event] = def.to;
+    }
+}
+
+AnimationEngine::AnimationEngine(FrameScheduler& scheduler, QObject* parent)
+    : QObject(parent)
+{
+    connect(&scheduler, &FrameScheduler::frame, this, [this](qint64, qint64 delta) {
+        advance(delta);
+    });
+}
+
+int AnimationEngine::addActor(const Machine* machine, GraphicsSpriteItem* sprite, int state)
+{
+    m_machines.push_back(machine);
+    m_sprites.push_back(sprite);
+    m_states.push_back(state);
+    m_frames.push_back(0);
+    m_loops.push_back(0);
+    m_elapsed.push_back(0);
+
+    int actor = m_machines.size() - 1;
+    enter(actor, state);
+
+    return actor;
+}
+
+bool AnimationEngine::post(int actor, int event)
+{
+    int target = m_machines[actor]->target(m_states[actor], event);
+    if (target < 0)
+        return false;
+
+    enter(actor, target);
+    return true;
+}
+
+void AnimationEngine::enter(int actor, int state)
+{
+    m_states[actor] = state;
+    m_frames[actor] = 0;
+    m_loops[actor] = 0;
+    m_elapsed[actor] = 0;
+
+    if (GraphicsSpriteItem* sprite = m_sprites[actor])
+    {
+        sprite->setSequence(m_machines[actor]->m_states[state].sequence);
+        sprite->setFrame(0);
+    }
+
+    emit entered(actor, state);
+}
+
+void AnimationEngine::advance(qint64 delta)
+{
+    TRACE_SCOPE(Trace::Animation, "animation_engine");
+
+    const int count = m_machines.size();
+    for (int i = 0; i < count; i++)
+    {
+        const Machine* machine = m_machines[i];
+        const Machine::State& s = machine->m_states[m_states[i]];
+
+        qint64 elapsed = m_elapsed[i] + delta;
+        if (elapsed >= s.duration)
+        {
+            int loops = m_loops[i] + elapsed / s.duration;
+            if (s.loops && loops >= s.loops)
+            {
+                enter(i, s.next);
+                continue;
+            }
+
+            m_loops[i] = loops;
+            elapsed %= s.duration;
+        }
+        m_elapsed[i] = elapsed;
+
+        const qint64* ends = machine->m_ends.data() + s.ends;
+        int frame = qMin<int>(std::upper_bound(ends, ends + s.frames, elapsed) - ends,
+                              s.frames - 1);
+        if (frame != m_frames[i])
+        {
+            m_frames[i] = frame;
+            if (m_sprites[i])
+                m_sprites[i]->setFrame(frame);
+        }
+    }
+}
+
+AnimationEngine::~AnimationEngine()
+{
+}
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ANIMATIONENGINE_H
+#define ANIMATIONENGINE_H
+
+#include <QObject>
+#include <cstdint>
+#include <vector>
+
+class FrameScheduler;
+class GraphicsSpriteItem;
+
+/**
+ * @brief The AnimationEngine class
+ *
+ * Runs the sprite animations of any number of actors off the FrameScheduler, in one pass per
+ * frame.
+ *
+ * What an actor can do is a Machine: states that each play a sprite sequence, the state to go
+ * to once a sequence is done, and the states events lead to.  A Machine is written as static
+ * tables indexed by enums, and compiled once into flat arrays against the sprite it animates.
+ * Everything per actor is kept in parallel arrays in the engine.
+ *
+ * There is a single connection to the frame clock however many actors there are, and
+ * advancing an actor or handling an event is a table lookup, whatever the number of states.
+ */
+class AnimationEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * @brief A state, as written in a static table.
+     */
+    struct StateDef
+    {
+        /** Sprite sequence played in the state. */
+        const char* sequence;
+        /** Times to play the sequence, 0 forever. */
+        int loops;
+        /** State to go to once the sequence is done. */
+        int next;
+    };
+
+    /**
+     * @brief A transition on an event, as written in a static table.
+     */
+    struct TransitionDef
+    {
+        int event;
+        int from;
+        int to;
+    };
+
+    class Machine
+    {
+    public:
+
+        Machine(const StateDef* states, int stateCount, const TransitionDef* transitions,
+                int transitionCount, int eventCount, const GraphicsSpriteItem& sprite);
+
+        template<int S, int T>
+        Machine(const StateDef (&states)[S], const TransitionDef (&transitions)[T],
+                int eventCount, const GraphicsSpriteItem& sprite)
+            : Machine(states, S, transitions, T, eventCount, sprite)
+        {}
+
+        inline int stateCount() const
+        {
+            return m_states.size();
+        }
+
+        inline int eventCount() const
+        {
+            return m_eventCount;
+        }
+
+        /**
+         * @brief State an event leads to, or -1 if it does nothing in that state.
+         */
+        inline int target(int state, int event) const
+        {
+            return m_targets[state * m_eventCount + event];
+        }
+
+    protected:
+
+        friend class AnimationEngine;
+
+        struct State
+        {
+            int sequence;
+            int frames;
+            /** Nanoseconds to play the sequence once. */
+            qint64 duration;
+            /** Index in m_ends of the end time of the first frame. */
+            int ends;
+            int loops;
+            int next;
+        };
+
+        std::vector<State> m_states;
+        /**
+         * Nanoseconds from the start of a sequence to the end of each of its frames, of all
+         * states one after the other.
+         */
+        std::vector<qint64> m_ends;
+        /** State by state and event, -1 for none. */
+        std::vector<int16_t> m_targets;
+        int m_eventCount;
+    };
+
+    AnimationEngine(FrameScheduler& scheduler, QObject* parent = 0);
+
+    /**
+     * @brief Add an actor.
+     * @param sprite Sprite to animate, or 0 for an actor with nothing to draw.
+     * @return Index of the actor.
+     */
+    int addActor(const Machine* machine, GraphicsSpriteItem* sprite, int state = 0);
+
+    inline int count() const
+    {
+        return m_machines.size();
+    }
+
+    /**
+     * @brief Send an event to an actor.
+     * @return false if the event does nothing in the state the actor is in.
+     */
+    bool post(int actor, int event);
+
+    /**
+     * @brief Put an actor in a state, starting its sequence over.
+     */
+    void enter(int actor, int state);
+
+    inline int state(int actor) const
+    {
+        return m_states[actor];
+    }
+
+    inline int frame(int actor) const
+    {
+        return m_frames[actor];
+    }
+
+    virtual ~AnimationEngine();
+
+signals:
+
+    void entered(int actor, int state);
+
+protected:
+
+    void advance(qint64 delta);
+
+    std::vector<const Machine*> m_machines;
+    std::vector<GraphicsSpriteItem*> m_sprites;
+    std::vector<int> m_states;
+    std::vector<int> m_frames;
+    std::vector<int> m_loops;
+    std::vector<qint64> m_elapsed;
+};
+
+#endif // ANIMATIONENGINE_H
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "assetpack.h"
+#include "pixelformat.h"
+#include <QDebug>
+#include <QFile>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+
+AssetPack::AssetPack()
+    : m_data(0),
+      m_size(0)
+{
+}
+
+bool AssetPack::lz4()
+{
+#ifdef HAVE_LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool AssetPack::open(const QString& filename)
+{
+    close();
+
+    int fd = ::open(QFile::encodeName(filename).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t)sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = static_cast<const uchar*>(data);
+    m_size = st.st_size;
+
+    Header header;
+    memcpy(&header, m_data, sizeof(header));
+    if (header.magic != MAGIC || header.version != VERSION ||
+        sizeof(Header) + (uint64_t)header.count * sizeof(Entry) > m_size)
+    {
+        qDebug() << "invalid asset pack " << filename;
+        close();
+        return false;
+    }
+
+    m_entries.resize(header.count);
+    memcpy(m_entries.data(), m_data + sizeof(Header), header.count * sizeof(Entry));
+
+    for (auto& e: m_entries)
+    {
+        e.name[sizeof(e.name) - 1] = 0;
+        /*
+         * Written so a huge offset can not wrap around and pass.
+         */
+        if (e.offset > m_size || e.size > m_size - e.offset ||
+            (uint64_t)e.pitch * e.height != e.rawSize ||
+            (e.compression == None && e.size != e.rawSize))
+        {
+            qDebug() << "invalid asset pack entry " << e.name;
+            close();
+            return false;
+        }
+    }
+
+    /*
+     * Start reading ahead now, the images are about to be copied into planes.
+     */
+    madvise(const_cast<uchar*>(m_data), m_size, MADV_WILLNEED);
+
+    return true;
+}
+
+void AssetPack::close()
+{
+    if (m_data)
+        munmap(const_cast<uchar*>(m_data), m_size);
+
+    m_data = 0;
+    m_size = 0;
+    m_entries.clear();
+}
+
+int AssetPack::find(const std::string& name) const
+{
+    for (size_t i = 0; i < m_entries.size(); i++)
+        if (name == m_entries[i].name)
+            return i;
+
+    return -1;
+}
+
+QImage AssetPack::image(const std::string& name) const
+{
+    int index = find(name);
+    if (index < 0)
+        return QImage();
+
+    const Entry& e = m_entries[index];
+    QImage::Format format = formatImageFormat(e.format);
+    if (format == QImage::Format_Invalid)
+        return QImage();
+
+    if (e.compression == None)
+    {
+        /*
+         * The const constructor makes QImage copy on write, so the mapping is never
+         * written to.
+         */
+        return QImage(m_data + e.offset, e.width, e.height, e.pitch, format);
+    }
+
+    QImage image(e.width, e.height, format);
+    if (image.bytesPerLine() != (int)e.pitch)
+        return QImage();
+
+    if (!read(index, image.bits(), image.bytesPerLine()))
+        return QImage();
+
+    return image;
+}
+
+bool AssetPack::read(int index, void* dst, int pitch) const
+{
+    if (index < 0 || index >= (int)m_entries.size())
+        return false;
+
+    const Entry& e = m_entries[index];
+    const char* src = reinterpret_cast<const char*>(m_data + e.offset);
+    uchar* out = static_cast<uchar*>(dst);
+    int bytes = qMin((int)e.pitch, pitch);
+
+    switch (e.compression)
+    {
+    case None:
+        if (pitch == (int)e.pitch)
+        {
+            memcpy(out, src, e.rawSize);
+        }
+        else
+        {
+            for (uint32_t y = 0; y < e.height; y++)
+                memcpy(out + y * pitch, src + y * e.pitch, bytes);
+        }
+        return true;
+#ifdef HAVE_LZ4
+    case Lz4:
+        if (pitch == (int)e.pitch)
+        {
+            return LZ4_decompress_safe(src, reinterpret_cast<char*>(out), e.size, e.rawSize) ==
+                (int)e.rawSize;
+        }
+        else
+        {
+            std::vector<char> raw(e.rawSize);
+            if (LZ4_decompress_safe(src, raw.data(), e.size, e.rawSize) != (int)e.rawSize)
+                return false;
+            for (uint32_t y = 0; y < e.height; y++)
+                memcpy(out + y * pitch, raw.data() + y * e.pitch, bytes);
+            return true;
+        }
+#endif
+    }
+
+    qDebug() << "unsupported asset pack compression " << e.compression;
+    return false;
+}
+
+bool AssetPack::write(const QString& filename, const std::vector<Asset>& assets,
+                      Compression compression)
+{
+#ifndef HAVE_LZ4
+    if (compression == Lz4)
+    {
+        qDebug() << "built without LZ4 support";
+        return false;
+    }
+#endif
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    Header header = {MAGIC, VERSION, (uint32_t)assets.size(), 0};
+    std::vector<Entry> entries(assets.size());
+    std::vector<QByteArray> data(assets.size());
+
+    uint64_t offset = sizeof(Header) + assets.size() * sizeof(Entry);
+    for (size_t i = 0; i < assets.size(); i++)
+    {
+        const Asset& asset = assets[i];
+        QImage::Format format = formatImageFormat(asset.format);
+        if (format == QImage::Format_Invalid || asset.name.size() >= sizeof(Entry::name))
+            return false;
+
+        QImage image = asset.image.convertToFormat(format);
+        int pitch = image.width() * formatBytesPerPixel(asset.format);
+
+        /*
+         * Tightly packed rows, without whatever padding QImage uses.
+         */
+        QByteArray raw(pitch * image.height(), 0);
+        for (int y = 0; y < image.height(); y++)
+            memcpy(raw.data() + y * pitch, image.constScanLine(y), pitch);
+
+        Entry& e = entries[i];
+        memset(&e, 0, sizeof(e));
+        strncpy(e.name, asset.name.c_str(), sizeof(e.name) - 1);
+        e.format = asset.format;
+        e.width = image.width();
+        e.height = image.height();
+        e.pitch = pitch;
+        e.rawSize = raw.size();
+        e.compression = None;
+        data[i] = raw;
+
+#ifdef HAVE_LZ4
+        if (compression == Lz4)
+        {
+            QByteArray packed(LZ4_compressBound(raw.size()), 0);
+            int size = LZ4_compress_HC(raw.constData(), packed.data(), raw.size(), packed.size(),
+                                       LZ4HC_CLEVEL_MAX);
+            if (size > 0 && size < raw.size())
+            {
+                packed.resize(size);
+                data[i] = packed;
+                e.compression = Lz4;
+            }
+        }
+#endif
+
+        offset = (offset + ALIGNMENT - 1) & ~(uint64_t)(ALIGNMENT - 1);
+        e.offset = offset;
+        e.size = data[i].size();
+        offset += e.size;
+    }
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (!file.seek(entries[i].offset) || file.write(data[i]) != data[i].size())
+            return false;
+    }
+
+    return true;
+}
+
+AssetPack::~AssetPack()
+{
+    close();
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <QImage>
+#include <QString>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief The AssetPack class
+ *
+ * A container of images that are already decoded and converted to the pixel format of the
+ * planes they are shown on, built offline by the wildwest-assetpack tool.
+ *
+ * The pack is memory mapped.  Uncompressed images are used in place, so loading one costs
+ * nothing until its pages are copied into a plane.  Images can also be LZ4 compressed, when
+ * built with CONFIG += LZ4, which trades some CPU for less flash to read.
+ *
+ * Layout, all integers little endian:
+ * - Header
+ * - Entry table, one Entry per image
+ * - Image data, each starting on a page boundary
+ */
+class AssetPack
+{
+public:
+
+    enum
+    {
+        MAGIC = 0x50415757, // "WWAP"
+        VERSION = 1,
+        ALIGNMENT = 4096,
+    };
+
+    enum Compression
+    {
+        None = 0,
+        Lz4 = 1,
+    };
+
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t count;
+        uint32_t reserved;
+    };
+
+    struct Entry
+    {
+        char name[64];
+        /** DRM fourcc of the pixels. */
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+        uint32_t pitch;
+        uint64_t offset;
+        /** Bytes stored in the pack. */
+        uint32_t size;
+        /** Bytes of the pixels, pitch * height. */
+        uint32_t rawSize;
+        uint32_t compression;
+        uint32_t reserved;
+    };
+
+    AssetPack();
+
+    /**
+     * @brief Map a pack file.
+     */
+    bool open(const QString& filename);
+
+    void close();
+
+    inline bool isOpen() const
+    {
+        return m_data != 0;
+    }
+
+    /**
+     * @brief Bytes of the mapping.
+     */
+    inline size_t size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Index of an image by the name it was packed with, or -1.
+     */
+    int find(const std::string& name) const;
+
+    inline int count() const
+    {
+        return m_entries.size();
+    }
+
+    inline const Entry& entry(int index) const
+    {
+        return m_entries[index];
+    }
+
+    /**
+     * @brief Get an image.
+     *
+     * Uncompressed images wrap the mapped pack and are only valid as long as the pack is
+     * open.  Compressed images are decompressed into a new image.
+     *
+     * @return A null image if there is no image by that name.
+     */
+    QImage image(const std::string& name) const;
+
+    /**
+     * @brief Copy or decompress an image straight into a mapped buffer, such as a plane.
+     */
+    bool read(int index, void* dst, int pitch) const;
+
+    /**
+     * @brief An image to be written to a pack.
+     */
+    struct Asset
+    {
+        std::string name;
+        QImage image;
+        uint32_t format;
+    };
+
+    /**
+     * @brief Write a pack.
+     *
+     * Images are converted to their format, and compressed if that makes them smaller.
+     */
+    static bool write(const QString& filename, const std::vector<Asset>& assets,
+                      Compression compression = None);
+
+    /**
+     * @brief True if this build can read and write LZ4 compressed images.
+     */
+    static bool lz4();
+
+    virtual ~AssetPack();
+
+protected:
+
+    const uchar* m_data;
+    size_t m_size;
+    std::vector<Entry> m_entries;
+};
+
+#endif // ASSETPACK_H
@@ -0,0 +1,35 @@
+#-------------------------------------------------
+#
+# Host tool that builds the asset pack loaded by the demo at startup.
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = wildwest-assetpack
+TEMPLATE = app
+CONFIG += console
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/..
+DEPENDPATH += $$PWD/..
+
+SOURCES += \
+    main.cpp \
+    ../assetpack.cpp
+
+HEADERS += \
+    ../assetpack.h \
+    ../pixelformat.h
+
+#CONFIG += LZ4
+
+CONFIG += link_pkgconfig
+
+LZ4 {
+    DEFINES += HAVE_LZ4
+    PKGCONFIG += liblz4
+}
+
+PKGCONFIG += libdrm
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "assetpack.h"
+#include "pixelformat.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <cstdio>
+
+static uint32_t format_from_name(const QString& name)
+{
+    QString n = name.toLower();
+    if (n == "argb8888")
+        return DRM_FORMAT_ARGB8888;
+    if (n == "xrgb8888")
+        return DRM_FORMAT_XRGB8888;
+    if (n == "rgb565")
+        return DRM_FORMAT_RGB565;
+    if (n == "argb4444")
+        return DRM_FORMAT_ARGB4444;
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Packs images, decoded and converted to a plane pixel "
+                                     "format, into an asset pack for wildwest.");
+    parser.addHelpOption();
+    QCommandLineOption outputOption(QStringList() << "o" << "output", "Pack file to write.",
+                                    "file", "wildwest.pack");
+    QCommandLineOption formatOption("format", "Pixel format of the images: argb8888, xrgb8888, "
+                                    "rgb565 or argb4444.  Per image, append :format to the "
+                                    "image.", "format", "argb8888");
+    QCommandLineOption rootOption("root", "Images are named by their path relative to this "
+                                  "directory.", "dir", ".");
+    QCommandLineOption lz4Option("lz4", "Compress images with LZ4.");
+    parser.addOption(outputOption);
+    parser.addOption(formatOption);
+    parser.addOption(rootOption);
+    parser.addOption(lz4Option);
+    parser.addPositionalArgument("images", "Images to pack, as file[:format].");
+    parser.process(app);
+
+    uint32_t defaultFormat = format_from_name(parser.value(formatOption));
+    if (!defaultFormat)
+    {
+        fprintf(stderr, "unknown format %s\n", qPrintable(parser.value(formatOption)));
+        return 1;
+    }
+
+    QDir root(parser.value(rootOption));
+    std::vector<AssetPack::Asset> assets;
+
+    for (auto& arg: parser.positionalArguments())
+    {
+        QString path = arg.section(':', 0, 0);
+        uint32_t format = arg.contains(':') ? format_from_name(arg.section(':', 1)) : defaultFormat;
+        if (!format)
+        {
+            fprintf(stderr, "unknown format for %s\n", qPrintable(arg));
+            return 1;
+        }
+
+        QImage image(path);
+        if (image.isNull())
+        {
+            fprintf(stderr, "failed to read %s\n", qPrintable(path));
+            return 1;
+        }
+
+        QString name = root.relativeFilePath(QFileInfo(path).absoluteFilePath());
+        assets.push_back({name.toStdString(), image, format});
+    }
+
+    if (!AssetPack::write(parser.value(outputOption), assets,
+                          parser.isSet(lz4Option) ? AssetPack::Lz4 : AssetPack::None))
+    {
+        fprintf(stderr, "failed to write %s\n", qPrintable(parser.value(outputOption)));
+        return 1;
+    }
+
+    return 0;
+}
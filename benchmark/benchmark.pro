@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Benchmarks for the plane pipeline.
+#
+# Runs against the software plane backend unless WILDWEST_PLANES=kms is set, and prints
+# results as JSON.
+#
+#-------------------------------------------------
+
+QT       += core gui gui-private widgets
+
+TARGET = wildwest-benchmark
+TEMPLATE = app
+CONFIG += console
+
+DEFINES += QT_DEPRECATED_WARNINGS QT_NO_DEBUG_OUTPUT
+
+SOURCES += main.cpp
+
+#CONFIG += LOCALPLANES
+#CONFIG += AVX2
+#CONFIG += LZ4
+#CONFIG += NOTRACE
+#CONFIG += SOFTWARE_ONLY
+
+include(../wildwest.pri)
+
+RESOURCES += \
+    benchmark.qrc
+
+target.path = /opt/wildwest
+INSTALLS += target
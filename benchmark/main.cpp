@@ -0,0 +1,1048 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "animationengine.h"
+#include "assetpack.h"
+#include "entitysystem.h"
+#include "planemanager.h"
+#include "softwareplanebackend.h"
+#include "systemsampler.h"
+#include "framescheduler.h"
+#include "graphicshuditem.h"
+#include "frametimeline.h"
+#include "graphicslayeritem.h"
+#include "graphicsspriteitem.h"
+#include "graphicsstreamlayeritem.h"
+#include "memoryledger.h"
+#include "pixelkernels.h"
+#include "planescene.h"
+#include "trace.h"
+#include "virtualplanebackend.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QThreadPool>
+#include <QTemporaryDir>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <sys/resource.h>
+
+/**
+ * @brief The Benchmark class
+ *
+ * Runs a function in batches and reduces the per call time of each batch to statistics that
+ * are stable enough to compare between runs.
+ */
+class Benchmark
+{
+public:
+
+    Benchmark(int runs)
+        : m_runs(runs)
+    {}
+
+    template<typename Func>
+    void measure(const QString& name, int iterations, Func func)
+    {
+        std::vector<double> samples;
+        QElapsedTimer timer;
+
+        /*
+         * Warm up caches and let any lazy allocation happen outside of the samples.
+         */
+        for (int i = 0; i < iterations; i++)
+            func(i);
+
+        for (int run = 0; run < m_runs; run++)
+        {
+            timer.start();
+            for (int i = 0; i < iterations; i++)
+                func(i);
+            samples.push_back((double)timer.nsecsElapsed() / iterations);
+        }
+
+        QJsonObject result = statistics(samples);
+        result["iterations"] = iterations;
+        result["runs"] = m_runs;
+        m_results[name] = result;
+    }
+
+    void record(const QString& name, const QJsonValue& value)
+    {
+        m_results[name] = value;
+    }
+
+    inline const QJsonObject& results() const
+    {
+        return m_results;
+    }
+
+    static QJsonObject statistics(std::vector<double> samples)
+    {
+        QJsonObject result;
+        if (samples.empty())
+            return result;
+
+        std::sort(samples.begin(), samples.end());
+
+        double sum = 0;
+        for (auto s: samples)
+            sum += s;
+        double mean = sum / samples.size();
+
+        double variance = 0;
+        for (auto s: samples)
+            variance += (s - mean) * (s - mean);
+        variance /= samples.size();
+
+        result["unit"] = QStringLiteral("ns");
+        result["min"] = samples.front();
+        result["max"] = samples.back();
+        result["median"] = samples[samples.size() / 2];
+        result["p95"] = samples[std::min(samples.size() - 1, (samples.size() * 95) / 100)];
+        result["mean"] = mean;
+        result["stddev"] = std::sqrt(variance);
+
+        return result;
+    }
+
+protected:
+
+    int m_runs;
+    QJsonObject m_results;
+};
+
+static qint64 peak_rss_kb()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage))
+        return -1;
+    return usage.ru_maxrss;
+}
+
+static QString machine_model()
+{
+    QFile file("/proc/device-tree/model");
+    if (file.open(QIODevice::ReadOnly))
+        return QString::fromLatin1(file.readAll()).trimmed();
+
+    return QSysInfo::currentCpuArchitecture();
+}
+
+/**
+ * @brief Largest difference of any channel between two images of the same size.
+ */
+static int max_difference(const QImage& a, const QImage& b)
+{
+    if (a.size() != b.size())
+        return 256;
+
+    QImage x = a.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    QImage y = b.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    int result = 0;
+    for (int row = 0; row < x.height(); row++)
+    {
+        const uchar* p = x.constScanLine(row);
+        const uchar* q = y.constScanLine(row);
+        for (int i = 0; i < x.width() * 4; i++)
+            result = std::max(result, std::abs(p[i] - q[i]));
+    }
+
+    return result;
+}
+
+static QImage noise_image(int width, int height, bool opaque)
+{
+    QImage image(width, height, QImage::Format_ARGB32);
+
+    quint32 seed = 0x12345678;
+    for (int y = 0; y < height; y++)
+    {
+        quint32* line = reinterpret_cast<quint32*>(image.scanLine(y));
+        for (int x = 0; x < width; x++)
+        {
+            seed = seed * 1664525 + 1013904223;
+            line[x] = opaque ? seed | 0xff000000 : seed;
+        }
+    }
+
+    return image;
+}
+
+static QImage kernel_blit(const QImage& image, QImage::Format format, const QSize& size,
+                          bool horizontal, bool vertical, bool dither = false)
+{
+    QImage result(size, format);
+    PixelKernels::blit(image, result, size, horizontal, vertical, dither);
+    return result;
+}
+
+/**
+ * @brief Largest error of the average of a dithered flat color over the 4x4 pattern.
+ *
+ * Ordered dithering has to average out to the color it was given, as the display shows it
+ * with the bits of each channel replicated into eight, so levels that fall between two steps
+ * do not band and no level comes out brighter or darker than it was.
+ */
+static int dither_bias(QImage::Format format)
+{
+    bool rgb565 = format == QImage::Format_RGB16;
+
+    QImage dithered(4, 4, format);
+    int result = 0;
+    for (int level = 0; level <= 255; level++)
+    {
+        QImage flat(4, 4, QImage::Format_ARGB32_Premultiplied);
+        flat.fill(qRgb(level, level, level));
+        PixelKernels::blit(flat, dithered, flat.size(), false, false, true);
+
+        int red = 0;
+        int green = 0;
+        for (int y = 0; y < 4; y++)
+        {
+            const uint16_t* line = reinterpret_cast<const uint16_t*>(dithered.constScanLine(y));
+            for (int x = 0; x < 4; x++)
+            {
+                if (rgb565)
+                {
+                    int r = line[x] >> 11;
+                    int g = (line[x] >> 5) & 0x3f;
+                    red += (r << 3) | (r >> 2);
+                    green += (g << 2) | (g >> 4);
+                }
+                else
+                {
+                    red += ((line[x] >> 8) & 0xf) * 17;
+                    green += ((line[x] >> 4) & 0xf) * 17;
+                }
+            }
+        }
+
+        result = std::max(result, std::abs(red - level * 16) / 16);
+        result = std::max(result, std::abs(green - level * 16) / 16);
+    }
+
+    return result;
+}
+
+/**
+ * @brief Check the pixel kernels against Qt, and the SIMD kernels against the scalar ones.
+ * @return Number of failed checks.
+ */
+static int verify_kernels()
+{
+    int failures = 0;
+    auto check = [&failures](const char* name, int difference, int tolerance) {
+        bool ok = difference <= tolerance;
+        if (!ok)
+            failures++;
+        fprintf(stderr, "%-24s %s (max difference %d)\n", name, ok ? "ok" : "FAILED", difference);
+    };
+
+    fprintf(stderr, "pixel kernels: %s\n", PixelKernels::simd());
+
+    /*
+     * Odd sizes so every kernel also runs its scalar tail.
+     */
+    QImage noise = noise_image(257, 33, false);
+    QImage opaque = noise_image(257, 33, true);
+    QImage premultiplied = PixelKernels::premultiplied(noise);
+    QImage gradient(256, 64, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < gradient.height(); y++)
+        for (int x = 0; x < gradient.width(); x++)
+            gradient.setPixel(x, y, qRgba(x, y * 4, 255 - x, 255));
+
+    for (int simd = 1; simd >= 0; simd--)
+    {
+        PixelKernels::setSimdEnabled(simd);
+        fprintf(stderr, "%s:\n", simd ? "simd" : "scalar");
+
+        check("premultiply", max_difference(PixelKernels::premultiplied(noise),
+                                            noise.convertToFormat(QImage::Format_ARGB32_Premultiplied)), 0);
+
+        for (int i = 1; i < 4; i++)
+        {
+            bool h = i & 1;
+            bool v = i & 2;
+            check(h ? (v ? "mirror_both" : "mirror_horizontal") : "mirror_vertical",
+                  max_difference(kernel_blit(premultiplied, QImage::Format_ARGB32_Premultiplied,
+                                             premultiplied.size(), h, v),
+                                 premultiplied.mirrored(h, v)), 0);
+        }
+
+        QImage opaquepm = opaque.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        QImage rgb565 = kernel_blit(opaquepm, QImage::Format_RGB16, opaquepm.size(), false, false);
+        check("argb8888_to_rgb565", max_difference(rgb565, opaquepm.convertToFormat(QImage::Format_RGB16)), 0);
+
+        check("dither_rgb565", dither_bias(QImage::Format_RGB16), 0);
+        check("dither_argb4444", dither_bias(QImage::Format_ARGB4444_Premultiplied), 0);
+
+        QImage argb(rgb565.size(), QImage::Format_RGB32);
+        for (int y = 0; y < rgb565.height(); y++)
+            PixelKernels::fromRgb565(reinterpret_cast<uint32_t*>(argb.scanLine(y)),
+                                     reinterpret_cast<const uint16_t*>(rgb565.constScanLine(y)),
+                                     rgb565.width());
+        check("rgb565_to_argb8888", max_difference(argb, rgb565.convertToFormat(QImage::Format_RGB32)), 0);
+
+        /*
+         * Qt downscales with an area average, which bilinear matches on smooth content.
+         */
+        QSize half = gradient.size() / 2;
+        check("bilinear_downscale",
+              max_difference(kernel_blit(gradient, QImage::Format_ARGB32_Premultiplied, half, false, false),
+                             gradient.scaled(half, Qt::IgnoreAspectRatio, Qt::SmoothTransformation)), 2);
+    }
+
+    /*
+     * The SIMD kernels must match the scalar ones bit for bit, including scaling of noise.
+     */
+    QSize sizes[] = { QSize(100, 20), QSize(300, 40), premultiplied.size() };
+    QImage::Format formats[] = { QImage::Format_ARGB32_Premultiplied, QImage::Format_RGB16,
+                                 QImage::Format_ARGB4444_Premultiplied };
+    int difference = 0;
+    for (auto& size: sizes)
+        for (auto format: formats)
+            for (int i = 0; i < 8; i++)
+            {
+                /*
+                 * ARGB4444 is only drawn dithered.
+                 */
+                if (format == QImage::Format_ARGB4444_Premultiplied && !(i & 4))
+                    continue;
+
+                PixelKernels::setSimdEnabled(true);
+                QImage a = kernel_blit(premultiplied, format, size, i & 1, i & 2, i & 4);
+                PixelKernels::setSimdEnabled(false);
+                QImage b = kernel_blit(premultiplied, format, size, i & 1, i & 2, i & 4);
+                difference = std::max(difference, max_difference(a, b));
+            }
+    check("simd_matches_scalar", difference, 0);
+
+    /*
+     * Two colors either way, only the one already on 4 bit levels may go to ARGB4444.
+     */
+    std::vector<uint32_t> formats4444 = { DRM_FORMAT_ARGB4444, DRM_FORMAT_ARGB8888 };
+    QImage levels(16, 16, QImage::Format_ARGB32_Premultiplied);
+    levels.fill(qRgba(0x88, 0x44, 0xcc, 0xff));
+    levels.setPixel(0, 0, qRgba(0, 0, 0, 0));
+    QImage shades = levels;
+    shades.fill(qRgba(0x80, 0x40, 0xc8, 0xff));
+    shades.setPixel(0, 0, qRgba(0, 0, 0, 0));
+    check("choose_format",
+          (GraphicsPlaneItem::chooseFormat(levels, formats4444, 0) != DRM_FORMAT_ARGB4444) +
+          (GraphicsPlaneItem::chooseFormat(shades, formats4444, 0) != DRM_FORMAT_ARGB8888), 0);
+
+    PixelKernels::setSimdEnabled(true);
+
+    return failures;
+}
+
+int main(int argc, char *argv[])
+{
+    bool software = qgetenv("WILDWEST_PLANES") != "kms";
+    if (software && qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmarks for the wildwest plane pipeline.");
+    parser.addHelpOption();
+    QCommandLineOption runsOption("runs", "Number of sample runs per benchmark.", "runs", "31");
+    QCommandLineOption configOption("config", "Planes config file.", "file",
+                                    software ? ":/wildwest.screen" : "wildwest.screen");
+    QCommandLineOption outputOption("output", "Write results to a file instead of stdout.", "file");
+    QCommandLineOption verifyOption("verify", "Check the pixel kernels against Qt and exit.");
+    parser.addOption(runsOption);
+    parser.addOption(configOption);
+    parser.addOption(outputOption);
+    parser.addOption(verifyOption);
+    parser.process(app);
+
+    if (parser.isSet(verifyOption))
+        return verify_kernels() ? 1 : 0;
+
+    PlaneManager planes;
+    if (software)
+    {
+        SoftwarePlaneBackend* backend = new SoftwarePlaneBackend();
+        /*
+         * Compositing is not something the hardware does on the CPU, keep it out of the
+         * numbers.
+         */
+        backend->setCompositeOnCommit(false);
+        planes.setBackend(std::unique_ptr<PlaneBackend>(backend));
+    }
+
+    if (!planes.load(parser.value(configOption).toStdString()))
+    {
+        qCritical("failed to load planes");
+        return -1;
+    }
+
+    Benchmark benchmark(std::max(1, parser.value(runsOption).toInt()));
+
+    /*
+     * Checks that fail along the way still write out the results, but make the exit status
+     * non zero.
+     */
+    int failures = 0;
+
+    /*
+     * Same scene as the demo.
+     */
+    const int width = 800;
+    const int height = 480;
+
+    PlaneScene planeScene(planes);
+
+    GraphicsLayerItem overlay0(planes, planes.get("overlay0"), QImage(":/media/overlay0.png"),
+                               width, 330, 60);
+    overlay0.moveTo(0, 70);
+    planeScene.addItem(&overlay0, 0, PlaneScene::Advance);
+
+    GraphicsLayerItem overlay1(planes, planes.get("overlay1"), QImage(":/media/overlay1.png"),
+                               width, 110, 120);
+    overlay1.moveTo(0, 370);
+    planeScene.addItem(&overlay1, 1, PlaneScene::Advance);
+
+    GraphicsSpriteItem man(planes, planes.get("overlay2"), QImage(":/media/man.png"), 88, 151);
+    man.loadManifest(":/media/man.sprite");
+    const int walkingSequence = man.sequence("walking");
+    man.moveTo((width / 2) - (88/2), (height * 9 / 10) - man.height());
+    planeScene.addItem(&man, 2);
+
+    /*
+     * Full redraws and partial uploads are measured below, so the images are kept around
+     * instead of being dropped once drawn.
+     */
+    overlay0.setRetainContent(true);
+    overlay1.setRetainContent(true);
+    man.setRetainContent(true);
+
+    overlay0.paint(0, 0, 0);
+    overlay1.paint(0, 0, 0);
+    man.paint(0, 0, 0);
+
+    FrameScheduler& scheduler = planes.scheduler();
+
+    FrameTimeLine walking(scheduler, man.duration(walkingSequence));
+    walking.setLoopCount(0);
+    walking.setFrameRange(0, man.frameCount(walkingSequence)-1);
+    walking.setFrameEnds(man.frameEnds(walkingSequence));
+    QObject::connect(&walking, &FrameTimeLine::frameChanged, &man, &GraphicsSpriteItem::setFrame);
+
+    planes.beginFrame();
+    planes.commitFrame();
+
+    benchmark.record("startup_peak_rss_kb", peak_rss_kb());
+
+    MemoryLedger::Usage memory = MemoryLedger::instance().total();
+    benchmark.record("ledger_cpu_kb", memory.cpu / 1024);
+    benchmark.record("ledger_plane_kb", memory.plane / 1024);
+
+    /*
+     * Bytes per pixel each plane ended up in, which is what the display reads every frame.
+     */
+    for (auto name: {"overlay0", "overlay1", "overlay2"})
+        benchmark.record(QString("bytes_per_pixel_") + name,
+                         formatBytesPerPixel(planes.format(planes.get(name))));
+
+    benchmark.record("scanout_kb_s", planes.totalBandwidth().scanout / 1024);
+
+    /*
+     * Micro benchmarks.
+     */
+    struct plane_data* plane = planes.get("overlay2");
+    benchmark.measure("plane_commit", 1000, [&planes, plane](int i) {
+        planes.beginFrame();
+        planes.setPos(plane, i & 1, 0);
+        planes.commitFrame();
+    });
+
+    man.setSequence(walkingSequence);
+    benchmark.measure("sprite_set_frame", 10000, [&man](int i) {
+        man.setFrame(i % 8);
+    });
+
+    /*
+     * Turning around, a reflection or pan write with a commit.
+     */
+    benchmark.measure("sprite_flip", 1000, [&planes, &man](int) {
+        planes.beginFrame();
+        man.toggleFlipHorizontal();
+        planes.commitFrame();
+    });
+
+    benchmark.measure("layer_advance", 10000, [&overlay0](int) {
+        overlay0.advance(1);
+    });
+
+    /*
+     * Moving a plane item through QGraphicsItem, next to moving it in a PlaneScene.
+     */
+    benchmark.measure("item_set_pos", 10000, [&planes, &man](int i) {
+        planes.beginFrame();
+        man.setPos(i & 1, 0);
+        planes.commitFrame();
+    });
+
+    benchmark.measure("item_move_to", 10000, [&planes, &man](int i) {
+        planes.beginFrame();
+        man.moveTo(i & 1, 0);
+        planes.commitFrame();
+    });
+
+    man.moveTo((width / 2) - (88/2), (height * 9 / 10) - man.height());
+
+    benchmark.measure("scene_item_at", 10000, [&planeScene, &man](int i) {
+        planeScene.itemAt(man.planePos() + QPoint(i % 88, 0));
+    });
+
+    /*
+     * A trace point with tracing stopped, which is what every build pays, and recording.
+     */
+    benchmark.measure("trace_point_off", 100000, [](int) {
+        TRACE_INSTANT(Trace::Frame, "benchmark");
+    });
+
+    Trace::start();
+    benchmark.measure("trace_point", 100000, [](int) {
+        TRACE_INSTANT(Trace::Frame, "benchmark");
+    });
+    Trace::stop();
+
+    /*
+     * One sample of /proc, the work the sampler thread does every second.
+     */
+    SystemSampler sampler;
+    benchmark.measure("system_sample", 100, [&sampler](int) {
+        sampler.sample();
+    });
+
+    planes.beginFrame();
+    planes.commitFrame();
+
+    benchmark.measure("draw_overlay0", 10, [&overlay0](int) {
+        overlay0.paint(0, 0, 0);
+    });
+
+    benchmark.measure("draw_overlay1", 10, [&overlay1](int) {
+        overlay1.paint(0, 0, 0);
+    });
+
+    benchmark.measure("draw_man", 10, [&man](int) {
+        man.paint(0, 0, 0);
+    });
+
+    /*
+     * A score sized patch of overlay0, uploaded through damage instead of a full draw.
+     */
+    benchmark.measure("update_region", 1000, [&planes, &overlay0](int i) {
+        planes.beginFrame();
+        overlay0.updateRegion(QRect((i * 8) % 1000, 16, 96, 32));
+        planes.commitFrame();
+    });
+
+    /*
+     * Pixel kernels next to the Qt code they replace, on the largest asset.
+     */
+    QImage source(":/media/overlay0.png");
+    source = source.convertToFormat(QImage::Format_ARGB32);
+    QImage prepared = PixelKernels::premultiplied(source);
+    QImage target(prepared.size(), QImage::Format_ARGB32_Premultiplied);
+    QImage target565(prepared.size(), QImage::Format_RGB16);
+    QSize half = prepared.size() / 2;
+
+    benchmark.record("pixel_kernels", QString(PixelKernels::simd()));
+
+    benchmark.measure("kernel_premultiply", 10, [&source](int) {
+        PixelKernels::premultiplied(source);
+    });
+
+    benchmark.measure("qt_premultiply", 10, [&source](int) {
+        source.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    });
+
+    benchmark.measure("kernel_mirror", 10, [&prepared, &target](int) {
+        PixelKernels::blit(prepared, target, prepared.size(), true, false);
+    });
+
+    benchmark.measure("qt_mirror", 10, [&prepared](int) {
+        prepared.mirrored(true, false);
+    });
+
+    benchmark.measure("kernel_downscale", 10, [&prepared, &target, half](int) {
+        PixelKernels::blit(prepared, target, half);
+    });
+
+    benchmark.measure("qt_downscale", 10, [&prepared, half](int) {
+        prepared.scaled(half, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    });
+
+    benchmark.measure("kernel_rgb565", 10, [&prepared, &target565](int) {
+        PixelKernels::blit(prepared, target565, prepared.size());
+    });
+
+    benchmark.measure("qt_rgb565", 10, [&prepared](int) {
+        prepared.convertToFormat(QImage::Format_RGB16);
+    });
+
+    benchmark.measure("kernel_rgb565_dither", 10, [&prepared, &target565](int) {
+        PixelKernels::blit(prepared, target565, prepared.size(), false, false, true);
+    });
+
+    QImage target4444(prepared.size(), QImage::Format_ARGB4444_Premultiplied);
+    benchmark.measure("kernel_argb4444_dither", 10, [&prepared, &target4444](int) {
+        PixelKernels::blit(prepared, target4444, prepared.size(), false, false, true);
+    });
+
+    /*
+     * The scan every new image gets to choose the format of its plane.
+     */
+    benchmark.measure("choose_format", 10, [&prepared, &planes](int) {
+        GraphicsPlaneItem::chooseFormat(prepared, planes.formats(planes.get("overlay0")),
+                                        DRM_FORMAT_ARGB8888);
+    });
+
+    /*
+     * Getting every image of the demo ready to draw, decoded from PNG or out of an asset pack.
+     */
+    const char* const images[] =
+    {
+        "media/overlay0.png", "media/overlay1.png", "media/man.png",
+        "media/primary.png", "media/logo.png",
+    };
+
+    benchmark.measure("assets_png", 3, [&images](int) {
+        for (auto name: images)
+            PixelKernels::premultiplied(QImage(QString(":/") + name));
+    });
+
+    QTemporaryDir tmp;
+    std::vector<AssetPack::Asset> assets;
+    for (auto name: images)
+        assets.push_back({name, QImage(QString(":/") + name), DRM_FORMAT_ARGB8888});
+
+    auto measurePack = [&](const QString& name, AssetPack::Compression compression) {
+        QString filename = tmp.path() + "/" + name + ".pack";
+        if (!AssetPack::write(filename, assets, compression))
+            return;
+
+        benchmark.measure(name, 3, [&images, filename](int) {
+            AssetPack pack;
+            pack.open(filename);
+            for (auto image: images)
+                PixelKernels::premultiplied(pack.image(image));
+        });
+    };
+
+    measurePack("assets_pack", AssetPack::None);
+    if (AssetPack::lz4())
+        measurePack("assets_pack_lz4", AssetPack::Lz4);
+
+    /*
+     * More sprites than planes.  Two of them walk and the rest stand still, so the two
+     * walking ones should end up on hardware planes and the rest composited.
+     */
+    if (software)
+    {
+        const int count = 8;
+        QJsonArray hardwarePlanes;
+        QJsonArray virtualPlanes;
+        for (int i = 0; i < 3; i++)
+            hardwarePlanes.append(QJsonObject{{"name", QString("overlay%1").arg(i)},
+                                              {"format", "DRM_FORMAT_ARGB8888"}});
+        for (int i = 0; i < count; i++)
+            virtualPlanes.append(QJsonObject{{"name", QString("sprite%1").arg(i)},
+                                             {"width", 88}, {"height", 151}, {"zpos", i}});
+
+        QString config = tmp.path() + "/virtual.screen";
+        QFile file(config);
+        if (file.open(QIODevice::WriteOnly))
+            file.write(QJsonDocument(QJsonObject{{"planes", hardwarePlanes},
+                                                 {"virtual", virtualPlanes}}).toJson());
+        file.close();
+
+        SoftwarePlaneBackend* hardware = new SoftwarePlaneBackend();
+        hardware->setCompositeOnCommit(false);
+        VirtualPlaneBackend* backend =
+            new VirtualPlaneBackend(std::unique_ptr<PlaneBackend>(hardware));
+
+        PlaneManager multiplexed;
+        multiplexed.setBackend(std::unique_ptr<PlaneBackend>(backend));
+        if (multiplexed.load(config.toStdString()))
+        {
+            QImage sheet(":/media/man.png");
+            std::vector<std::unique_ptr<GraphicsSpriteItem>> sprites;
+            for (int i = 0; i < count; i++)
+            {
+                std::string name = QString("sprite%1").arg(i).toStdString();
+                GraphicsSpriteItem* sprite =
+                    new GraphicsSpriteItem(multiplexed, multiplexed.get(name), sheet, 88, 151);
+                sprite->loadManifest(":/media/man.sprite");
+                sprite->setPos((i % 4) * 200, (i / 4) * 240);
+                sprite->paint(0, 0, 0);
+                sprites.emplace_back(sprite);
+            }
+
+            const int walkers[] = {1, 6};
+            int frame = 0;
+            FrameScheduler& virtualScheduler = multiplexed.scheduler();
+            QObject::connect(&virtualScheduler, &FrameScheduler::frame,
+                             [&sprites, &walkers, &frame](qint64, qint64) {
+                frame++;
+                for (auto i: walkers)
+                    sprites[i]->setFrame(frame % sprites[i]->frameCount());
+            });
+            virtualScheduler.start(FrameScheduler::Manual);
+
+            benchmark.measure("virtual_frame", 100, [&virtualScheduler](int) {
+                virtualScheduler.tick(1000000000LL / 60);
+            });
+
+            int promoted = 0;
+            for (auto i: walkers)
+                if (backend->assigned(multiplexed.get(QString("sprite%1").arg(i).toStdString())))
+                    promoted++;
+
+            benchmark.record("virtual_walkers_promoted", (qint64)promoted);
+            benchmark.record("virtual_commits", (qint64)multiplexed.commitCount());
+
+            /*
+             * A promoted walker moved under a composited sprite above it can not stay
+             * promoted past the commit of the move, it would be drawn on top.
+             */
+            struct plane_data* walker = multiplexed.get("sprite1");
+            struct plane_data* above = multiplexed.get("sprite2");
+            sprites[1]->setPos(sprites[2]->pos());
+            virtualScheduler.tick(1000000000LL / 60);
+            if (backend->assigned(walker) && !backend->assigned(above))
+            {
+                fprintf(stderr, "virtual overlap FAILED (sprite1 promoted under sprite2)\n");
+                failures++;
+            }
+
+            virtualScheduler.stop();
+        }
+    }
+
+    /*
+     * A streamed layer a thousand tiles long, generated as it scrolls.  The plane stays the
+     * same size whatever the length.
+     */
+    if (software)
+    {
+        SoftwarePlaneBackend* backend = new SoftwarePlaneBackend();
+        backend->setCompositeOnCommit(false);
+
+        PlaneManager streamed;
+        streamed.setBackend(std::unique_ptr<PlaneBackend>(backend));
+        if (streamed.load(parser.value(configOption).toStdString()))
+        {
+            const int tileWidth = 64;
+            auto source = [tileWidth](int index) {
+                QImage tile(tileWidth, 330, QImage::Format_ARGB32_Premultiplied);
+                tile.fill(QColor::fromHsv((index * 7) % 360, 128, 255));
+                return tile;
+            };
+
+            GraphicsStreamLayerItem layer(streamed, streamed.get("overlay0"), source, 1000,
+                                          tileWidth, width, 330, 600);
+            layer.moveTo(0, 70);
+            layer.paint(0, 0, 0);
+
+            /*
+             * A budget below what the layer scans out, which must warn once and only once.
+             */
+            int warnings = 0;
+            streamed.setBandwidthBudget(1000000);
+            QObject::connect(&streamed, &PlaneManager::overBudget, [&warnings](qint64) {
+                warnings++;
+            });
+
+            FrameScheduler& streamScheduler = streamed.scheduler();
+            PlaneScene streamScene(streamed);
+            streamScene.addItem(&layer, 0, PlaneScene::Advance);
+            streamScheduler.start(FrameScheduler::Manual);
+
+            benchmark.measure("stream_layer_frame", 600, [&streamScheduler](int) {
+                streamScheduler.tick(1000000000LL / 60);
+            });
+
+            benchmark.record("stream_layer_tiles_loaded", (qint64)layer.tilesLoaded());
+
+            PlaneManager::Bandwidth bandwidth = streamed.bandwidth(streamed.get("overlay0"));
+            benchmark.record("stream_layer_scanout_kb_s", bandwidth.scanout / 1024);
+            benchmark.record("stream_layer_upload_kb_s", bandwidth.upload / 1024);
+            benchmark.record("bandwidth_budget_warnings", (qint64)warnings);
+            if (warnings != 1)
+            {
+                fprintf(stderr, "bandwidth budget FAILED (%d warnings instead of 1)\n", warnings);
+                failures++;
+            }
+            benchmark.record("stream_layer_plane_kb",
+                             (qint64)streamed.pitch(streamed.get("overlay0")) *
+                             streamed.height(streamed.get("overlay0")) / 1024);
+            benchmark.record("layer_plane_kb",
+                             (qint64)planes.pitch(planes.get("overlay0")) *
+                             planes.height(planes.get("overlay0")) / 1024);
+
+            streamScheduler.stop();
+        }
+    }
+
+    /*
+     * A double buffered layer rendered on the thread pool and flipped every frame.  A back
+     * buffer has to start out as what is shown, and one must be free again every frame.
+     */
+    if (software)
+    {
+        SoftwarePlaneBackend* backend = new SoftwarePlaneBackend();
+        backend->setCompositeOnCommit(false);
+
+        PlaneManager buffered;
+        buffered.setBackend(std::unique_ptr<PlaneBackend>(backend));
+        if (buffered.load(parser.value(configOption).toStdString()))
+        {
+            struct plane_data* bufferedPlane = buffered.get("overlay1");
+            GraphicsLayerItem layer(buffered, bufferedPlane, QImage(":/media/overlay1.png"),
+                                    width, 110, 0);
+            layer.moveTo(0, 370);
+            layer.paint(0, 0, 0);
+
+            bool kept = false;
+            if (layer.setBufferCount(2))
+            {
+                int back = buffered.acquireBuffer(bufferedPlane);
+                if (back >= 0)
+                {
+                    size_t size = (size_t)buffered.pitch(bufferedPlane) *
+                                  buffered.height(bufferedPlane);
+                    kept = !memcmp(buffered.mapBuffer(bufferedPlane, back),
+                                   buffered.map(bufferedPlane), size);
+                    buffered.releaseBuffer(bufferedPlane, back);
+                }
+            }
+
+            FrameScheduler& bufferedScheduler = buffered.scheduler();
+            bufferedScheduler.start(FrameScheduler::Manual);
+
+            const int frames = 60;
+            int flips = 0;
+            for (int i = 0; i < frames; i++)
+            {
+                if (layer.renderAsync([i](QImage& image) {
+                        image.fill(QColor::fromHsv((i * 7) % 360, 128, 255));
+                    }))
+                    flips++;
+
+                /*
+                 * Let the render finish and its flip get queued, then commit it.
+                 */
+                QThreadPool::globalInstance()->waitForDone();
+                QCoreApplication::processEvents();
+                bufferedScheduler.tick(1000000000LL / 60);
+            }
+
+            bufferedScheduler.stop();
+
+            benchmark.record("buffered_flips", (qint64)flips);
+            if (!kept || flips != frames)
+            {
+                fprintf(stderr, "buffered plane FAILED (back buffer %s, %d of %d frames flipped)\n",
+                        kept ? "kept" : "not kept", flips, frames);
+                failures++;
+            }
+        }
+    }
+
+    /*
+     * A layer has to scroll the same distance in a second at any frame rate.  Drift is in
+     * 16.16 fixed point units, more than 1 means time got lost to rounding.
+     */
+    qint64 drift = 0;
+    const int rates[] = {30, 50, 60};
+    for (auto hz: rates)
+    {
+        scheduler.setRefreshRate(hz);
+        scheduler.start(FrameScheduler::Manual);
+        scheduler.tick(0);
+
+        qint64 wrap = (qint64)(overlay1.content()->width() / 2) << GraphicsLayerItem::FIXED_SHIFT;
+        qint64 start = overlay1.position();
+        qint64 elapsed = 0;
+        for (int i = 0; i < hz; i++)
+        {
+            scheduler.tick(1000000000LL / hz);
+            elapsed += 1000000000LL / hz;
+        }
+
+        qint64 distance = (overlay1.position() - start + wrap) % wrap;
+        qint64 expected = (((qint64)overlay1.speed() * elapsed << GraphicsLayerItem::FIXED_SHIFT) /
+                           1000000000LL) % wrap;
+        drift = std::max(drift, std::abs(distance - expected));
+    }
+
+    benchmark.record("parallax_drift", drift);
+    if (drift > 1)
+    {
+        fprintf(stderr, "parallax drift FAILED (%lld fixed point units)\n", (long long)drift);
+        failures++;
+    }
+    scheduler.setRefreshRate(60);
+
+    /*
+     * Macro benchmark, a whole frame of the scene on a 60Hz mock clock.
+     */
+    scheduler.start(FrameScheduler::Manual);
+    walking.start();
+
+    benchmark.measure("scene_frame", 1000, [&scheduler](int) {
+        scheduler.tick(1000000000LL / 60);
+    });
+
+    /*
+     * The same frame with a crowd of actors that jump now and then.  Only one of them has a
+     * sprite, the rest is the cost of the engine itself.
+     */
+    {
+        enum { Walk, Jump, Events };
+        static const AnimationEngine::StateDef states[] = {
+            {"walking", 0, Walk},
+            {"jumping", 1, Walk},
+        };
+        static const AnimationEngine::TransitionDef transitions[] = {
+            {0, Walk, Jump},
+        };
+
+        walking.stop();
+        AnimationEngine animations(scheduler);
+        AnimationEngine::Machine machine(states, transitions, Events, man);
+        const int actors = 500;
+        for (int i = 0; i < actors; i++)
+            animations.addActor(&machine, i ? 0 : &man, Walk);
+
+        benchmark.measure("scene_frame_500_actors", 1000, [&scheduler, &animations](int i) {
+            animations.post(i % actors, 0);
+            scheduler.tick(1000000000LL / 60);
+        });
+    }
+
+    /*
+     * Stress the entity system with a screen full of bullets flying into enemies.  What gets
+     * shot or leaves the screen is topped up after every step, so the population stays at 4000.
+     */
+    {
+        enum { Bullet, Enemy };
+        const int total = 4000;
+        EntitySystem entities(scheduler, total, QRect(0, 0, 800, 480), 16);
+
+        quint32 seed = 1;
+        auto random = [&seed](int range) {
+            seed = seed * 1664525u + 1013904223u;
+            return (int)((seed >> 8) % range);
+        };
+
+        auto populate = [&]() {
+            while (entities.count() < total)
+            {
+                if (random(4))
+                    entities.spawn(Enemy, 400 + random(384), random(464),
+                                   -20 - random(40), random(21) - 10, 16, 16);
+                else
+                    entities.spawn(Bullet, random(400), random(476), 400, 0, 4, 4);
+            }
+        };
+
+        entities.setCollisionHandler(Bullet, Enemy, [&entities](int bullet, int enemy) {
+            entities.despawn(bullet);
+            entities.despawn(enemy);
+        });
+
+        populate();
+
+        qint64 collisions = 0;
+        qint64 steps = 0;
+        benchmark.measure("entities_step", 1000, [&](int) {
+            entities.step(1000000000LL / 60);
+            collisions += entities.collisions();
+            steps++;
+            populate();
+        });
+
+        benchmark.record("entity_collisions_per_step", collisions / steps);
+    }
+
+    /*
+     * Frames with the HUD on top, on a plane of its own like the demo gives it, from the
+     * config or a virtual plane.  Cells drawn per refresh shows how much of the text actually
+     * changes.
+     */
+    struct plane_data* hudPlane = planes.get("hud");
+    if (!hudPlane)
+        hudPlane = planes.create("hud", 256, 96, 10);
+    if (!hudPlane)
+    {
+        fprintf(stderr, "hud FAILED (no hud plane and no virtual planes in the config)\n");
+        failures++;
+    }
+    else
+    {
+        GraphicsHudItem hud(planes, hudPlane, sampler);
+
+        benchmark.measure("hud_frame", 600, [&scheduler](int) {
+            scheduler.tick(1000000000LL / 60);
+        });
+
+        benchmark.record("hud_cells_per_refresh",
+                         (qint64)(hud.cellsDrawn() / std::max<quint64>(1, hud.refreshCount())));
+    }
+
+    benchmark.record("commits", (qint64)planes.commitCount());
+    benchmark.record("peak_rss_kb", peak_rss_kb());
+
+    QJsonObject root;
+    root["backend"] = software ? QStringLiteral("software") : QStringLiteral("kms");
+    root["machine"] = machine_model();
+    root["kernel"] = QSysInfo::kernelVersion();
+    root["qt"] = QString(qVersion());
+    root["results"] = benchmark.results();
+
+    QByteArray json = QJsonDocument(root).toJson();
+
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly))
+        {
+            qCritical("failed to open output file");
+            return -1;
+        }
+        file.write(json);
+    }
+    else
+    {
+        QFile out;
+        out.open(stdout, QIODevice::WriteOnly);
+        out.write(json);
+    }
+
+    return failures ? 1 : 0;
+}
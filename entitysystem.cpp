@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "entitysystem.h"
+#include "framescheduler.h"
+#include "trace.h"
+#include <algorithm>
+
+EntitySystem::EntitySystem(FrameScheduler& scheduler, int capacity, const QRect& world, int cell,
+                           QObject* parent)
+    : QObject(parent),
+      m_world(world),
+      m_cell(qMax(1, cell)),
+      m_columns(qMax(1, (world.width() + m_cell - 1) / m_cell)),
+      m_rows(qMax(1, (world.height() + m_cell - 1) / m_cell)),
+      m_x(capacity),
+      m_y(capacity),
+      m_vx(capacity),
+      m_vy(capacity),
+      m_width(capacity),
+      m_height(capacity),
+      m_type(capacity),
+      m_alive(capacity),
+      m_index(capacity),
+      m_cellStart(m_columns * m_rows + 1),
+      m_sorted(capacity),
+      m_cellOf(capacity),
+      m_collisions(0)
+{
+    m_live.reserve(capacity);
+    m_free.reserve(capacity);
+    m_dead.reserve(capacity);
+
+    /*
+     * Lowest ids first, so a small scene stays at the start of the arrays.
+     */
+    for (int id = capacity - 1; id >= 0; id--)
+        m_free.push_back(id);
+
+    connect(&scheduler, &FrameScheduler::frame, this, [this](qint64, qint64 delta) {
+        step(delta);
+    });
+}
+
+int EntitySystem::spawn(int type, float x, float y, float vx, float vy, int width, int height)
+{
+    if (m_free.empty() || width < 1 || height < 1 || width > m_cell || height > m_cell)
+        return -1;
+
+    int id = m_free.back();
+    m_free.pop_back();
+
+    m_x[id] = x;
+    m_y[id] = y;
+    m_vx[id] = vx;
+    m_vy[id] = vy;
+    m_width[id] = width;
+    m_height[id] = height;
+    m_type[id] = type;
+    m_alive[id] = 1;
+    m_index[id] = m_live.size();
+    m_live.push_back(id);
+
+    return id;
+}
+
+void EntitySystem::despawn(int id)
+{
+    if (id < 0 || id >= capacity() || !m_alive[id])
+        return;
+
+    m_alive[id] = 0;
+    m_dead.push_back(id);
+}
+
+void EntitySystem::setCollisionHandler(int a, int b, std::function<void(int, int)> handler)
+{
+    for (auto& h: m_handlers)
+    {
+        if (h.a == a && h.b == b)
+        {
+            h.handler = handler;
+            return;
+        }
+    }
+
+    m_handlers.push_back({(uint8_t)a, (uint8_t)b, handler});
+}
+
+void EntitySystem::step(qint64 delta)
+{
+    TRACE_SCOPE(Trace::Animation, "entities");
+
+    float dt = delta / 1000000000.0f;
+    float left = m_world.left();
+    float top = m_world.top();
+    float right = m_world.left() + m_world.width();
+    float bottom = m_world.top() + m_world.height();
+
+    for (auto id: m_live)
+    {
+        float x = m_x[id] + m_vx[id] * dt;
+        float y = m_y[id] + m_vy[id] * dt;
+        m_x[id] = x;
+        m_y[id] = y;
+
+        if (x + m_width[id] < left || x >= right || y + m_height[id] < top || y >= bottom)
+            despawn(id);
+    }
+
+    rebuildGrid();
+
+    m_collisions = 0;
+    for (auto& h: m_handlers)
+        collide(h.a, h.b, h.handler);
+
+    reap();
+
+    emit stepped();
+}
+
+void EntitySystem::rebuildGrid()
+{
+    /*
+     * Counting sort by cell: count, turn the counts into starts, scatter.  Scattering moves
+     * each start to the start of the next cell, so they are shifted back after.
+     */
+    std::fill(m_cellStart.begin(), m_cellStart.end(), 0);
+
+    for (auto id: m_live)
+    {
+        int cell = cellOf(m_x[id] + m_width[id] / 2, m_y[id] + m_height[id] / 2);
+        m_cellOf[id] = cell;
+        m_cellStart[cell + 1]++;
+    }
+
+    const int cells = m_columns * m_rows;
+    for (int c = 1; c <= cells; c++)
+        m_cellStart[c] += m_cellStart[c - 1];
+
+    for (auto id: m_live)
+        m_sorted[m_cellStart[m_cellOf[id]]++] = id;
+
+    for (int c = cells; c > 0; c--)
+        m_cellStart[c] = m_cellStart[c - 1];
+    m_cellStart[0] = 0;
+}
+
+void EntitySystem::collide(uint8_t a, uint8_t b, const std::function<void(int, int)>& handler)
+{
+    /*
+     * Only the entities that were in the grid, anything spawned by the handler waits for the
+     * next frame.
+     */
+    const int count = m_live.size();
+    for (int i = 0; i < count; i++)
+    {
+        int id = m_live[i];
+        if (m_type[id] != a || !m_alive[id])
+            continue;
+
+        int cx = m_cellOf[id] % m_columns;
+        int cy = m_cellOf[id] / m_columns;
+        float x0 = m_x[id];
+        float y0 = m_y[id];
+        float x1 = x0 + m_width[id];
+        float y1 = y0 + m_height[id];
+
+        for (int y = qMax(0, cy - 1); y <= qMin(m_rows - 1, cy + 1) && m_alive[id]; y++)
+        {
+            for (int x = qMax(0, cx - 1); x <= qMin(m_columns - 1, cx + 1) && m_alive[id]; x++)
+            {
+                int cell = y * m_columns + x;
+                for (int k = m_cellStart[cell]; k < m_cellStart[cell + 1]; k++)
+                {
+                    /*
+                     * Within one type both entities of a pair get here, only the one with
+                     * the lower id reports it.
+                     */
+                    int other = m_sorted[k];
+                    if (m_type[other] != b || !m_alive[other] || (a == b && other <= id))
+                        continue;
+
+                    if (m_x[other] < x1 && m_x[other] + m_width[other] > x0 &&
+                        m_y[other] < y1 && m_y[other] + m_height[other] > y0)
+                    {
+                        m_collisions++;
+                        handler(id, other);
+                        if (!m_alive[id])
+                            break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void EntitySystem::reap()
+{
+    for (auto id: m_dead)
+    {
+        /*
+         * Swap with the last live entity to keep the list dense.
+         */
+        int index = m_index[id];
+        int last = m_live.back();
+        m_live[index] = last;
+        m_index[last] = index;
+        m_live.pop_back();
+
+        m_free.push_back(id);
+    }
+
+    m_dead.clear();
+}
+
+EntitySystem::~EntitySystem()
+{
+}
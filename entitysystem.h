@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef ENTITYSYSTEM_H
+#define ENTITYSYSTEM_H
+
+#include <QObject>
+#include <QRect>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class FrameScheduler;
+
+/**
+ * @brief The EntitySystem class
+ *
+ * Moving things that collide, such as bullets and enemies, by the thousand.
+ *
+ * Every array is allocated up front for the capacity given to the constructor, so spawning and
+ * despawning never touch the heap.  Entities are kept as a struct of arrays, and the live ones
+ * as a dense list, so moving them all is a straight pass over a few arrays.
+ *
+ * Collisions are found with a uniform grid over the world that is rebuilt every frame with a
+ * counting sort.  An entity is filed under the cell of its center, and entities are never
+ * bigger than a cell, so anything it touches is in one of the 3x3 cells around it.
+ *
+ * There are far more entities than planes, so they are all drawn into one shared plane by a
+ * GraphicsEntityItem once they have moved.
+ */
+class EntitySystem : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * @param capacity Most entities alive at once.
+     * @param world Area entities live in, they are despawned once they leave it.
+     * @param cell Size of a grid cell, at least the size of the biggest entity.
+     */
+    EntitySystem(FrameScheduler& scheduler, int capacity, const QRect& world, int cell = 32,
+                 QObject* parent = 0);
+
+    /**
+     * @brief Create an entity.
+     * @param type Anything up to 255, used to pick what collides with what.
+     * @param vx Pixels per second.
+     * @param vy Pixels per second.
+     * @param width At most the cell size given to the constructor.
+     * @param height At most the cell size given to the constructor.
+     * @return Id of the entity, or -1 if the pool is empty or the entity is bigger than a
+     * cell.
+     */
+    int spawn(int type, float x, float y, float vx, float vy, int width, int height);
+
+    /**
+     * @brief Remove an entity at the end of the frame.
+     *
+     * Safe to call from a collision handler.  The id can be handed out again afterwards.
+     */
+    void despawn(int id);
+
+    /**
+     * @brief Call handler(a, b) every frame for each entity of type a touching one of type b.
+     *
+     * With a and b the same type, each pair that touches is reported once.
+     */
+    void setCollisionHandler(int a, int b, std::function<void(int, int)> handler);
+
+    inline int count() const
+    {
+        return m_live.size();
+    }
+
+    inline int capacity() const
+    {
+        return m_x.size();
+    }
+
+    /**
+     * @brief Ids of the live entities, in no particular order.
+     */
+    inline const std::vector<int>& live() const
+    {
+        return m_live;
+    }
+
+    inline bool alive(int id) const
+    {
+        return m_alive[id];
+    }
+
+    inline float x(int id) const
+    {
+        return m_x[id];
+    }
+
+    inline float y(int id) const
+    {
+        return m_y[id];
+    }
+
+    inline int width(int id) const
+    {
+        return m_width[id];
+    }
+
+    inline int height(int id) const
+    {
+        return m_height[id];
+    }
+
+    inline int type(int id) const
+    {
+        return m_type[id];
+    }
+
+    inline void setVelocity(int id, float vx, float vy)
+    {
+        m_vx[id] = vx;
+        m_vy[id] = vy;
+    }
+
+    /**
+     * @brief Move everything, find collisions and despawn what died.
+     *
+     * Called on every frame by the scheduler.
+     *
+     * @param delta Nanoseconds since the previous frame.
+     */
+    void step(qint64 delta);
+
+    /**
+     * @brief Collisions handled in the last step.
+     */
+    inline int collisions() const
+    {
+        return m_collisions;
+    }
+
+    virtual ~EntitySystem();
+
+signals:
+
+    /**
+     * @brief Emitted at the end of step(), once everything has moved and the dead are gone.
+     */
+    void stepped();
+
+protected:
+
+    void rebuildGrid();
+    void collide(uint8_t a, uint8_t b, const std::function<void(int, int)>& handler);
+    void reap();
+
+    inline int cellOf(float x, float y) const
+    {
+        int cx = qBound(0, (int)(x - m_world.x()) / m_cell, m_columns - 1);
+        int cy = qBound(0, (int)(y - m_world.y()) / m_cell, m_rows - 1);
+        return cy * m_columns + cx;
+    }
+
+    QRect m_world;
+    int m_cell;
+    int m_columns;
+    int m_rows;
+
+    /*
+     * Per entity, indexed by id.  x and y are the top left corner.
+     */
+    std::vector<float> m_x;
+    std::vector<float> m_y;
+    std::vector<float> m_vx;
+    std::vector<float> m_vy;
+    std::vector<uint16_t> m_width;
+    std::vector<uint16_t> m_height;
+    std::vector<uint8_t> m_type;
+    std::vector<uint8_t> m_alive;
+    /** Index of each live entity in m_live. */
+    std::vector<int> m_index;
+
+    /** Ids of the live entities, dense. */
+    std::vector<int> m_live;
+    /** Ids that can be spawned. */
+    std::vector<int> m_free;
+    /** Ids despawned during the frame. */
+    std::vector<int> m_dead;
+
+    /*
+     * The grid, entities sorted by cell.  Cell c has m_sorted[m_cellStart[c]] up to
+     * m_sorted[m_cellStart[c + 1]].
+     */
+    std::vector<int> m_cellStart;
+    std::vector<int> m_sorted;
+    std::vector<int> m_cellOf;
+
+    struct Handler
+    {
+        uint8_t a;
+        uint8_t b;
+        std::function<void(int, int)> handler;
+    };
+
+    std::vector<Handler> m_handlers;
+    int m_collisions;
+};
+
+#endif // ENTITYSYSTEM_H
@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "evdevinput.h"
+#include "framescheduler.h"
+#include "planemanager.h"
+#include "trace.h"
+#include <QDebug>
+#include <QFile>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+EvdevInput::EvdevInput(PlaneManager& planes, const QRect& screen, QObject* parent)
+    : QObject(parent),
+      m_planes(planes),
+      m_screen(screen),
+      m_fd(-1),
+      m_minX(0),
+      m_maxX(0),
+      m_minY(0),
+      m_maxY(0),
+      m_multitouch(false),
+      m_slot(0),
+      m_touch(-1),
+      m_commit(-1),
+      m_handled{0, 0, 0},
+      m_committed{0, 0, 0},
+      m_scanout{0, 0, 0}
+{
+    m_wake[0] = m_wake[1] = -1;
+
+    connect(this, &EvdevInput::touched, this, &EvdevInput::deliver, Qt::QueuedConnection);
+    connect(&m_planes, &PlaneManager::aboutToCommit, this, &EvdevInput::commit);
+    connect(&m_planes.scheduler(), &FrameScheduler::frame, this, [this](qint64 time, qint64) {
+        frame(time);
+    });
+}
+
+bool EvdevInput::open(const QString& device)
+{
+    close();
+
+    m_fd = ::open(QFile::encodeName(device).constData(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        qDebug() << "failed to open input device " << device;
+        return false;
+    }
+
+    /*
+     * Same clock as the frames, instead of the wall clock.
+     */
+    int clock = CLOCK_MONOTONIC;
+    if (ioctl(m_fd, EVIOCSCLOCKID, &clock))
+        qDebug() << "input device timestamps are not monotonic";
+
+    /*
+     * Multitouch devices report the first contact in ABS_X and ABS_Y too.
+     */
+    struct input_absinfo x, y;
+    if (ioctl(m_fd, EVIOCGABS(ABS_X), &x) || ioctl(m_fd, EVIOCGABS(ABS_Y), &y) ||
+        x.maximum <= x.minimum || y.maximum <= y.minimum)
+    {
+        qDebug() << "not a touchscreen " << device;
+        close();
+        return false;
+    }
+
+    /*
+     * ABS_X and ABS_Y follow whichever contact came first, which can be any slot.  Only the
+     * contact in slot 0 is followed, the others are ignored.
+     */
+    struct input_absinfo mtx, mty, slot;
+    m_multitouch = !ioctl(m_fd, EVIOCGABS(ABS_MT_SLOT), &slot) &&
+        !ioctl(m_fd, EVIOCGABS(ABS_MT_POSITION_X), &mtx) &&
+        !ioctl(m_fd, EVIOCGABS(ABS_MT_POSITION_Y), &mty) &&
+        mtx.maximum > mtx.minimum && mty.maximum > mty.minimum;
+    if (m_multitouch)
+    {
+        x = mtx;
+        y = mty;
+        m_slot = slot.value;
+    }
+
+    m_minX = x.minimum;
+    m_maxX = x.maximum;
+    m_minY = y.minimum;
+    m_maxY = y.maximum;
+
+    if (pipe2(m_wake, O_CLOEXEC))
+    {
+        close();
+        return false;
+    }
+
+    m_thread = std::thread(&EvdevInput::run, this);
+
+    return true;
+}
+
+void EvdevInput::close()
+{
+    if (m_thread.joinable())
+    {
+        char c = 0;
+        if (write(m_wake[1], &c, 1) == 1)
+            m_thread.join();
+        else
+            m_thread.detach();
+    }
+
+    for (auto& fd: m_wake)
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+    }
+
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+void EvdevInput::run()
+{
+    Trace::setThreadName("input");
+
+    struct input_event events[64];
+    int x = 0;
+    int y = 0;
+    int slot = m_slot;
+    bool down = false;
+    qint64 downTime = -1;
+
+    struct pollfd fds[2] = {{m_fd, POLLIN, 0}, {m_wake[0], POLLIN, 0}};
+    for (;;)
+    {
+        if (poll(fds, 2, -1) < 0)
+            continue;
+
+        if (fds[1].revents || (fds[0].revents & (POLLERR | POLLHUP)))
+            break;
+
+        ssize_t n = read(m_fd, events, sizeof(events));
+        if (n <= 0)
+            continue;
+
+        for (size_t i = 0; i < n / sizeof(events[0]); i++)
+        {
+            const struct input_event& e = events[i];
+            qint64 time = (qint64)e.time.tv_sec * 1000000000LL + (qint64)e.time.tv_usec * 1000LL;
+
+            switch (e.type)
+            {
+            case EV_ABS:
+                if (!m_multitouch)
+                {
+                    if (e.code == ABS_X)
+                        x = e.value;
+                    else if (e.code == ABS_Y)
+                        y = e.value;
+                }
+                else if (e.code == ABS_MT_SLOT)
+                {
+                    slot = e.value;
+                }
+                else if (slot == 0)
+                {
+                    if (e.code == ABS_MT_POSITION_X)
+                        x = e.value;
+                    else if (e.code == ABS_MT_POSITION_Y)
+                        y = e.value;
+                    else if (e.code == ABS_MT_TRACKING_ID)
+                    {
+                        down = e.value >= 0;
+                        downTime = down ? time : -1;
+                    }
+                }
+                break;
+            case EV_KEY:
+                /*
+                 * BTN_TOUCH is down while any contact is, a multitouch device goes by the
+                 * tracking id of slot 0 instead.
+                 */
+                if (e.code == BTN_TOUCH && !m_multitouch)
+                {
+                    down = e.value;
+                    if (down)
+                        downTime = time;
+                }
+                break;
+            case EV_SYN:
+                /*
+                 * The position of a touch is only complete at the end of its packet.
+                 */
+                if (e.code == SYN_REPORT && down && downTime >= 0)
+                {
+                    TRACE_INSTANT(Trace::Input, "touch_read");
+
+                    emit touched(m_screen.x() + (qint64)(x - m_minX) * m_screen.width() /
+                                 (m_maxX - m_minX + 1),
+                                 m_screen.y() + (qint64)(y - m_minY) * m_screen.height() /
+                                 (m_maxY - m_minY + 1),
+                                 downTime);
+                    downTime = -1;
+                }
+                break;
+            }
+        }
+    }
+}
+
+void EvdevInput::deliver(int x, int y, qint64 time)
+{
+    TRACE_SCOPE(Trace::Input, "touch");
+
+    m_touch = time;
+    m_commit = -1;
+
+    qint64 now = Trace::now();
+    m_handled.add(now - time);
+    TRACE_COUNTER(Trace::Input, "touch_to_handled_us", (now - time) / 1000);
+
+    emit pressed(QPoint(x, y));
+}
+
+void EvdevInput::commit()
+{
+    if (m_touch < 0 || m_commit >= 0)
+        return;
+
+    m_commit = Trace::now();
+    m_committed.add(m_commit - m_touch);
+    TRACE_COUNTER(Trace::Input, "touch_to_commit_us", (m_commit - m_touch) / 1000);
+}
+
+void EvdevInput::frame(qint64 time)
+{
+    /*
+     * In vblank mode a frame runs on the vblank that scanned out the previous commit.
+     */
+    if (m_commit < 0 || time <= m_commit)
+        return;
+
+    m_scanout.add(time - m_touch);
+    TRACE_COUNTER(Trace::Input, "touch_to_vblank_us", (time - m_touch) / 1000);
+
+    m_touch = -1;
+    m_commit = -1;
+}
+
+QString EvdevInput::report() const
+{
+    QString out = QString("touch latency over %1 touches, ms avg / max:\n").arg(m_handled.count);
+
+    const struct
+    {
+        const char* name;
+        const Stage& stage;
+    } stages[] = {
+        {"kernel -> handled", m_handled},
+        {"kernel -> commit", m_committed},
+        {"kernel -> vblank", m_scanout},
+    };
+
+    for (auto& s: stages)
+    {
+        double avg = s.stage.count ? s.stage.total / 1000000.0 / s.stage.count : 0.0;
+        out += QString("  %1 %2 / %3\n").arg(s.name, -18)
+            .arg(avg, 7, 'f', 2).arg(s.stage.max / 1000000.0, 7, 'f', 2);
+    }
+
+    return out;
+}
+
+EvdevInput::~EvdevInput()
+{
+    close();
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef EVDEVINPUT_H
+#define EVDEVINPUT_H
+
+#include <QObject>
+#include <QPoint>
+#include <QRect>
+#include <QString>
+#include <thread>
+
+class PlaneManager;
+
+/**
+ * @brief The EvdevInput class
+ *
+ * Reads touches straight from an evdev device on a thread of its own, instead of through the
+ * Qt input plugin and the widget event path.
+ *
+ * Events are timestamped by the kernel on the monotonic clock, the clock frames and vblank
+ * events are on, so each touch can be followed from the kernel to the screen:
+ * - handled: pressed() is emitted on the GUI thread
+ * - commit: the next plane commit, which carries whatever pressed() changed
+ * - vblank: the frame after that commit, when the change is scanned out
+ *
+ * report() sums this up over all touches, and every stage is also a trace counter.  With the
+ * timer clock the vblank stage is only as good as the timer.
+ */
+class EvdevInput : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * @param screen Rectangle touches are scaled to.
+     */
+    EvdevInput(PlaneManager& planes, const QRect& screen, QObject* parent = 0);
+
+    /**
+     * @brief Open a device, such as /dev/input/event0, and start reading it.
+     */
+    bool open(const QString& device);
+
+    void close();
+
+    inline bool isOpen() const
+    {
+        return m_fd >= 0;
+    }
+
+    /**
+     * @brief Latency of every stage over all touches so far.
+     */
+    QString report() const;
+
+    virtual ~EvdevInput();
+
+signals:
+
+    /**
+     * @brief A touch went down, emitted on the GUI thread.
+     */
+    void pressed(const QPoint& pos);
+
+    /**
+     * @brief A touch went down, emitted on the input thread.
+     * @param time Kernel timestamp in nanoseconds.
+     */
+    void touched(int x, int y, qint64 time);
+
+protected slots:
+
+    void deliver(int x, int y, qint64 time);
+
+protected:
+
+    void run();
+    void commit();
+    void frame(qint64 time);
+
+    struct Stage
+    {
+        quint64 count;
+        qint64 total;
+        qint64 max;
+
+        void add(qint64 nsecs)
+        {
+            count++;
+            total += nsecs;
+            max = qMax(max, nsecs);
+        }
+    };
+
+    PlaneManager& m_planes;
+    QRect m_screen;
+    int m_fd;
+    /** Written to stop the input thread. */
+    int m_wake[2];
+    std::thread m_thread;
+
+    int m_minX;
+    int m_maxX;
+    int m_minY;
+    int m_maxY;
+    /** Follow slot 0 of multitouch protocol B instead of ABS_X and ABS_Y. */
+    bool m_multitouch;
+    /** Slot the device reports to when the input thread starts. */
+    int m_slot;
+
+    /*
+     * The touch being followed to the screen, times are -1 until reached.
+     */
+    qint64 m_touch;
+    qint64 m_commit;
+
+    Stage m_handled;
+    Stage m_committed;
+    Stage m_scanout;
+};
+
+#endif // EVDEVINPUT_H
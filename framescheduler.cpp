@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "framescheduler.h"
+#include "planemanager.h"
+#include "planescene.h"
+#include "trace.h"
+#include <QGraphicsItem>
+#include <QSocketNotifier>
+#include <QDebug>
+#ifndef WILDWEST_SOFTWARE_ONLY
+#include <xf86drm.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <time.h>
+
+/*
+ * Scheduler handling DRM events right now, drmHandleEvent() gives the handlers no context of
+ * their own.
+ */
+static FrameScheduler* s_handling = 0;
+
+static qint64 monotonic_nsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+FrameScheduler::FrameScheduler(PlaneManager& planes, QObject* parent)
+    : QObject(parent),
+      m_planes(planes),
+      m_backend(0),
+      m_scene(0),
+      m_mode(Vblank),
+      m_running(false),
+      m_refresh(60),
+      m_time(0),
+      m_delta(0),
+      m_frames(0),
+      m_skipped(0),
+      m_catchUp(CatchUpLimited),
+      m_catchUpLimit(100000000LL),
+      m_notifier(0)
+{
+    m_timer.setTimerType(Qt::PreciseTimer);
+    connect(&m_timer, &QTimer::timeout, this, &FrameScheduler::timeout);
+}
+
+void FrameScheduler::addItem(QGraphicsItem* item)
+{
+    if (std::find(m_items.begin(), m_items.end(), item) == m_items.end())
+        m_items.push_back(item);
+}
+
+void FrameScheduler::removeItem(QGraphicsItem* item)
+{
+    m_items.erase(std::remove(m_items.begin(), m_items.end(), item), m_items.end());
+}
+
+void FrameScheduler::setRefreshRate(int hz)
+{
+    if (hz <= 0)
+        return;
+
+    m_refresh = hz;
+    if (m_timer.isActive())
+        m_timer.start(1000 / m_refresh);
+}
+
+void FrameScheduler::setCatchUp(CatchUp policy, qint64 limit)
+{
+    m_catchUp = policy;
+    m_catchUpLimit = limit;
+}
+
+void FrameScheduler::start(Mode mode)
+{
+    stop();
+
+    m_mode = mode;
+    m_running = true;
+    m_frames = 0;
+    m_skipped = 0;
+    m_time = 0;
+    m_delta = 0;
+
+    /*
+     * Page flip events of the plane backend come in on the DRM file descriptor whatever
+     * paces the frames, and buffered planes can not flip again until they are read.
+     */
+    int fd = m_planes.fd();
+    if (fd >= 0 && !m_notifier)
+    {
+        m_notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(m_notifier, &QSocketNotifier::activated, this, &FrameScheduler::drmEvent);
+    }
+
+    if (m_mode == Vblank)
+    {
+        if (fd >= 0 && requestVblank())
+            return;
+
+        qDebug() << "vblank events not available, falling back to timer";
+        m_mode = Timer;
+    }
+
+    if (m_mode == Timer)
+        m_timer.start(1000 / m_refresh);
+}
+
+void FrameScheduler::stop()
+{
+    /*
+     * The notifier stays, flips of commits made while stopped still have to be read.
+     */
+    m_running = false;
+    m_timer.stop();
+}
+
+bool FrameScheduler::requestVblank()
+{
+#ifdef WILDWEST_SOFTWARE_ONLY
+    return false;
+#else
+    drmVBlank vbl;
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.request.type = static_cast<drmVBlankSeqType>(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT);
+    vbl.request.sequence = 1;
+    vbl.request.signal = reinterpret_cast<unsigned long>(this);
+
+    return drmWaitVBlank(m_planes.fd(), &vbl) == 0;
+#endif
+}
+
+void FrameScheduler::vblankHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                   unsigned int tv_usec, void* data)
+{
+    Q_UNUSED(fd);
+    Q_UNUSED(sequence);
+
+    /*
+     * Not ours, or a vblank requested before the scheduler was stopped or switched to
+     * another mode.
+     */
+    FrameScheduler* scheduler = s_handling;
+    if (!scheduler || data != scheduler || !scheduler->m_running || scheduler->m_mode != Vblank)
+        return;
+
+    /*
+     * Arm the next event before doing any work so a long frame costs a refresh, not the
+     * whole clock.
+     */
+    if (!scheduler->requestVblank())
+        qDebug() << "failed to request vblank event";
+
+    scheduler->runFrame((qint64)tv_sec * 1000000000LL + (qint64)tv_usec * 1000LL);
+}
+
+void FrameScheduler::flipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                                 unsigned int tv_usec, void* data)
+{
+    Q_UNUSED(fd);
+    Q_UNUSED(sequence);
+    Q_UNUSED(tv_sec);
+    Q_UNUSED(tv_usec);
+
+    /*
+     * Qt flips the primary plane on the same file descriptor, with its own user data.
+     */
+    FrameScheduler* scheduler = s_handling;
+    if (!scheduler || !scheduler->m_backend || data != scheduler->m_backend)
+        return;
+
+    scheduler->m_backend->flipped();
+}
+
+void FrameScheduler::drmEvent()
+{
+#ifndef WILDWEST_SOFTWARE_ONLY
+    drmEventContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.version = 2;
+    ctx.vblank_handler = &FrameScheduler::vblankHandler;
+    ctx.page_flip_handler = &FrameScheduler::flipHandler;
+
+    s_handling = this;
+    drmHandleEvent(m_planes.fd(), &ctx);
+    s_handling = 0;
+#endif
+}
+
+void FrameScheduler::timeout()
+{
+    runFrame(monotonic_nsecs());
+}
+
+void FrameScheduler::tick(qint64 nsecs)
+{
+    if (m_mode != Manual || !m_running)
+        return;
+
+    runFrame(m_time + nsecs);
+}
+
+void FrameScheduler::runFrame(qint64 time)
+{
+    TRACE_SCOPE(Trace::Frame, "frame");
+
+    qint64 elapsed = m_frames ? time - m_time : 0;
+    qint64 interval = 1000000000LL / m_refresh;
+    m_time = time;
+    m_frames++;
+
+    /*
+     * Anything more than half an interval late is a frame that never ran.
+     */
+    if (elapsed > interval + interval / 2)
+        m_skipped += (elapsed + interval / 2) / interval - 1;
+
+    switch (m_catchUp)
+    {
+    case CatchUpAll:
+        m_delta = elapsed;
+        break;
+    case CatchUpLimited:
+        m_delta = qMin(elapsed, m_catchUpLimit);
+        break;
+    case CatchUpNone:
+        m_delta = m_frames > 1 ? interval : 0;
+        break;
+    }
+
+    TRACE_COUNTER(Trace::Frame, "skipped_frames", m_skipped);
+
+    m_planes.beginFrame();
+
+    emit frame(time, m_delta);
+
+    /*
+     * Same two phase advance as QGraphicsScene::advance(), but only for the registered
+     * items.
+     */
+    for (int step = 0; step < 2; step++)
+        for (auto item: m_items)
+            item->advance(step);
+
+    if (m_scene)
+        m_scene->advance();
+
+    m_planes.commitFrame();
+
+    emit committed(time);
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    stop();
+}
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef FRAMESCHEDULER_H
+#define FRAMESCHEDULER_H
+
+#include <QObject>
+#include <QTimer>
+#include <vector>
+
+class PlaneBackend;
+class PlaneManager;
+class PlaneScene;
+class QGraphicsItem;
+class QSocketNotifier;
+
+/**
+ * @brief The FrameScheduler class
+ *
+ * A single clock for everything that animates.  Each frame opens a PlaneManager frame
+ * transaction, emits frame(), advances every registered item, and commits all planes together.
+ *
+ * The clock comes from one of three sources:
+ * - Vblank: waits on the DRM file descriptor for vblank events, so frames are paced by the
+ *   display refresh.
+ * - Timer: a precise QTimer at the refresh rate, used when vblank events are not available.
+ * - Manual: nothing runs on its own, and tick() moves the clock forward.  This is a mock clock
+ *   for running headless.
+ *
+ * Whatever the clock, once started the scheduler reads page flip events from the DRM file
+ * descriptor and hands them to the plane backend.
+ *
+ * That file descriptor is shared with Qt, whose DRM platform flips the primary plane on it
+ * with user data of its own.  Only events carrying this scheduler or the backend given to
+ * setBackend() are handled, anything else is dropped.  Events drained here never reach the
+ * handler of Qt, and the other way around, so neither side can rely on seeing all of them.
+ *
+ * Animations move by the time between frames, so they look the same at any refresh rate.  When
+ * frames are skipped, the CatchUp policy decides how much of the lost time they make up for.
+ */
+class FrameScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum Mode
+    {
+        Vblank,
+        Timer,
+        Manual
+    };
+
+    enum CatchUp
+    {
+        /** Make up for all lost time, animations stay on the wall clock. */
+        CatchUpAll,
+        /** Make up for lost time up to a limit, longer stalls pause animations. */
+        CatchUpLimited,
+        /** Never make up for lost time, every frame is one refresh interval long. */
+        CatchUpNone,
+    };
+
+    FrameScheduler(PlaneManager& planes, QObject* parent = 0);
+
+    /**
+     * @brief Register an item to have advance() called on every frame.
+     */
+    void addItem(QGraphicsItem* item);
+
+    void removeItem(QGraphicsItem* item);
+
+    /**
+     * @brief Advance a PlaneScene on every frame, after the registered items.
+     *
+     * Called by the PlaneScene itself.
+     */
+    inline void setScene(PlaneScene* scene)
+    {
+        m_scene = scene;
+    }
+
+    /**
+     * @brief The backend page flip events are handed to.
+     *
+     * Called by the PlaneManager with PlaneBackend::flipBackend() once it has loaded.
+     */
+    inline void setBackend(PlaneBackend* backend)
+    {
+        m_backend = backend;
+    }
+
+    /**
+     * @brief Start the clock.
+     *
+     * If vblank events are requested and not available, this falls back to the timer.
+     */
+    void start(Mode mode = Vblank);
+
+    void stop();
+
+    inline Mode mode() const
+    {
+        return m_mode;
+    }
+
+    /**
+     * @brief Set the refresh rate used by the timer clock.
+     */
+    void setRefreshRate(int hz);
+
+    inline int refreshRate() const
+    {
+        return m_refresh;
+    }
+
+    /**
+     * @brief Set how animations deal with skipped frames.
+     * @param limit Most time made up for in one frame with CatchUpLimited, in nanoseconds.
+     */
+    void setCatchUp(CatchUp policy, qint64 limit = 100000000LL);
+
+    inline CatchUp catchUp() const
+    {
+        return m_catchUp;
+    }
+
+    /**
+     * @brief Time animations advance by in the current frame, in nanoseconds.
+     *
+     * The time since the previous frame, after the catch up policy.
+     */
+    inline qint64 delta() const
+    {
+        return m_delta;
+    }
+
+    /**
+     * @brief Number of refresh intervals that passed without a frame since start().
+     */
+    inline quint64 skippedFrames() const
+    {
+        return m_skipped;
+    }
+
+    /**
+     * @brief Time of the current frame in nanoseconds on the monotonic clock.
+     */
+    inline qint64 time() const
+    {
+        return m_time;
+    }
+
+    /**
+     * @brief Number of frames run since start().
+     */
+    inline quint64 frameCount() const
+    {
+        return m_frames;
+    }
+
+    /**
+     * @brief Move a Manual clock forward and run one frame.
+     * @param nsecs
+     */
+    void tick(qint64 nsecs);
+
+    virtual ~FrameScheduler();
+
+signals:
+
+    /**
+     * @brief Emitted at the start of every frame, inside of the frame transaction.
+     * @param time Frame time in nanoseconds.
+     * @param delta Nanoseconds to advance animations by, see delta().
+     */
+    void frame(qint64 time, qint64 delta);
+
+    /**
+     * @brief Emitted after all planes of a frame have been committed.
+     */
+    void committed(qint64 time);
+
+protected slots:
+
+    void drmEvent();
+    void timeout();
+
+protected:
+
+    bool requestVblank();
+    void runFrame(qint64 time);
+
+    static void vblankHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                              unsigned int tv_usec, void* data);
+    static void flipHandler(int fd, unsigned int sequence, unsigned int tv_sec,
+                            unsigned int tv_usec, void* data);
+
+    PlaneManager& m_planes;
+    /** Backend that passes itself as the user data of its page flip events. */
+    PlaneBackend* m_backend;
+    std::vector<QGraphicsItem*> m_items;
+    PlaneScene* m_scene;
+    Mode m_mode;
+    bool m_running;
+    int m_refresh;
+    qint64 m_time;
+    qint64 m_delta;
+    quint64 m_frames;
+    quint64 m_skipped;
+    CatchUp m_catchUp;
+    qint64 m_catchUpLimit;
+    QTimer m_timer;
+    QSocketNotifier* m_notifier;
+};
+
+#endif // FRAMESCHEDULER_H
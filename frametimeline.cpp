@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "frametimeline.h"
+#include "framescheduler.h"
+#include "trace.h"
+#include <algorithm>
+
+FrameTimeLine::FrameTimeLine(FrameScheduler& scheduler, int duration, QObject* parent)
+    : QObject(parent),
+      m_scheduler(scheduler),
+      m_duration((qint64)duration * 1000000LL),
+      m_loops(1),
+      m_start(0),
+      m_end(0),
+      m_frame(0),
+      m_loop(0),
+      m_elapsed(0),
+      m_running(false)
+{
+    if (m_duration <= 0)
+        m_duration = 1;
+}
+
+void FrameTimeLine::setFrameRange(int start, int end)
+{
+    m_start = start;
+    m_end = end;
+}
+
+void FrameTimeLine::setFrameEnds(const std::vector<int>& ends)
+{
+    m_ends.clear();
+    for (auto end: ends)
+        m_ends.push_back((qint64)end * 1000000LL);
+
+    if (!m_ends.empty())
+        m_duration = qMax(1LL, m_ends.back());
+}
+
+void FrameTimeLine::start()
+{
+    if (m_running)
+        stop();
+
+    m_running = true;
+    m_loop = 0;
+    m_elapsed = 0;
+    m_frame = m_start - 1;
+
+    connect(&m_scheduler, &FrameScheduler::frame, this, &FrameTimeLine::advance);
+
+    emit started();
+    setFrame(m_start);
+}
+
+void FrameTimeLine::stop()
+{
+    if (!m_running)
+        return;
+
+    m_running = false;
+    disconnect(&m_scheduler, &FrameScheduler::frame, this, &FrameTimeLine::advance);
+}
+
+void FrameTimeLine::setFrame(int frame)
+{
+    if (frame != m_frame)
+    {
+        m_frame = frame;
+        emit frameChanged(m_frame);
+    }
+}
+
+void FrameTimeLine::advance(qint64 time, qint64 delta)
+{
+    Q_UNUSED(time);
+
+    TRACE_SCOPE(Trace::Animation, "timeline");
+
+    m_elapsed += delta;
+
+    while (m_elapsed >= m_duration)
+    {
+        if (m_loops && ++m_loop >= m_loops)
+        {
+            setFrame(m_end);
+            stop();
+            emit finished();
+            return;
+        }
+
+        m_elapsed -= m_duration;
+    }
+
+    int frames = m_end - m_start + 1;
+    int frame;
+    if (m_ends.empty())
+        frame = (m_elapsed * frames) / m_duration;
+    else
+        frame = std::upper_bound(m_ends.begin(), m_ends.end(), m_elapsed) - m_ends.begin();
+
+    setFrame(m_start + qMin(frame, frames - 1));
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef FRAMETIMELINE_H
+#define FRAMETIMELINE_H
+
+#include <QObject>
+#include <vector>
+
+class FrameScheduler;
+
+/**
+ * @brief The FrameTimeLine class
+ *
+ * A replacement for QTimeLine that does not own a timer.  It is advanced by the FrameScheduler,
+ * so every animation shares the same clock as the planes and lands in the same commit.
+ *
+ * Frames are spread evenly over the duration with a linear curve, unless each is given its
+ * own time with setFrameEnds().
+ */
+class FrameTimeLine : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    FrameTimeLine(FrameScheduler& scheduler, int duration, QObject* parent = 0);
+
+    /**
+     * @brief Set how many times to run, 0 runs forever.
+     */
+    inline void setLoopCount(int count)
+    {
+        m_loops = count;
+    }
+
+    void setFrameRange(int start, int end);
+
+    /**
+     * @brief Show each frame of the range until its own end time.
+     * @param ends Milliseconds from the start to the end of each frame of the range, such as
+     * GraphicsSpriteItem::frameEnds().  The last one becomes the duration.
+     */
+    void setFrameEnds(const std::vector<int>& ends);
+
+    inline int currentFrame() const
+    {
+        return m_frame;
+    }
+
+    inline bool isRunning() const
+    {
+        return m_running;
+    }
+
+signals:
+
+    void started();
+    void frameChanged(int frame);
+    void finished();
+
+public slots:
+
+    void start();
+    void stop();
+
+protected slots:
+
+    void advance(qint64 time, qint64 delta);
+
+protected:
+
+    void setFrame(int frame);
+
+    FrameScheduler& m_scheduler;
+    qint64 m_duration;
+    /** Nanoseconds from the start to the end of each frame, empty for even spacing. */
+    std::vector<qint64> m_ends;
+    int m_loops;
+    int m_start;
+    int m_end;
+    int m_frame;
+    int m_loop;
+    qint64 m_elapsed;
+    bool m_running;
+};
+
+#endif // FRAMETIMELINE_H
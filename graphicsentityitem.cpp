@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "graphicsentityitem.h"
+#include "entitysystem.h"
+#include "trace.h"
+#include <QPainter>
+
+GraphicsEntityItem::GraphicsEntityItem(PlaneManager& planes, struct plane_data* plane,
+                                       EntitySystem& entities)
+    : GraphicsPlaneItem(planes, plane, QRectF()),
+      m_entities(entities)
+{
+    m_image = QImage(planes.width(plane), planes.height(plane),
+                     QImage::Format_ARGB32_Premultiplied);
+    m_image.fill(0);
+    m_bounding = m_image.rect();
+    m_drawn.reserve(entities.capacity());
+
+    /*
+     * The plane starts out empty, the format picked for that would not fit the entities.
+     */
+    setFormatSelection(false);
+
+    paint(0, 0, 0);
+
+    connect(&entities, &EntitySystem::stepped, this, [this]() {
+        redraw();
+    });
+}
+
+void GraphicsEntityItem::setImage(int type, const QImage& image)
+{
+    if (type >= (int)m_images.size())
+        m_images.resize(type + 1);
+
+    m_images[type] = prepare(image);
+}
+
+void GraphicsEntityItem::redraw()
+{
+    TRACE_SCOPE(Trace::Animation, "entities draw");
+
+    QRegion damage;
+    QPainter painter(&m_image);
+
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (auto& rect: m_drawn)
+    {
+        painter.fillRect(rect, Qt::transparent);
+        damage |= rect;
+    }
+    m_drawn.clear();
+
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    const QPoint origin = planePos();
+    for (auto id: m_entities.live())
+    {
+        int type = m_entities.type(id);
+        if (type >= (int)m_images.size() || m_images[type].isNull())
+            continue;
+
+        QRect rect(qRound(m_entities.x(id)) - origin.x(), qRound(m_entities.y(id)) - origin.y(),
+                   m_entities.width(id), m_entities.height(id));
+        QRect visible = rect & m_image.rect();
+        if (visible.isEmpty())
+            continue;
+
+        painter.drawImage(visible.topLeft(), m_images[type],
+                          visible.translated(-rect.topLeft()));
+        m_drawn.push_back(visible);
+        damage |= visible;
+    }
+    painter.end();
+
+    updateRegion(damage);
+}
+
+GraphicsEntityItem::~GraphicsEntityItem()
+{
+}
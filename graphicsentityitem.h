@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef GRAPHICSENTITYITEM_H
+#define GRAPHICSENTITYITEM_H
+
+#include "graphicsplaneitem.h"
+#include "memoryledger.h"
+#include <QImage>
+#include <QRect>
+#include <vector>
+
+class EntitySystem;
+
+/**
+ * @brief The GraphicsEntityItem class
+ *
+ * Draws all the live entities of an EntitySystem into one plane, each with the image of its
+ * type.  Positions, sizes and types are read from the arrays of the entity system after every
+ * step.  Only what was drawn the step before is cleared, and the plane is updated with
+ * damage, so the cost goes with the number of entities and not with the size of the plane.
+ *
+ * Entities are in screen coordinates, and the plane shows the part of the screen it covers.
+ */
+class GraphicsEntityItem : public GraphicsPlaneItem
+{
+public:
+
+    GraphicsEntityItem(PlaneManager& planes, struct plane_data* plane, EntitySystem& entities);
+
+    /**
+     * @brief Image to draw the entities of a type with, cut to the size of each entity.
+     *
+     * Types without an image are not drawn.
+     */
+    void setImage(int type, const QImage& image);
+
+    inline int width() const
+    {
+        return m_image.width();
+    }
+
+    inline int height() const
+    {
+        return m_image.height();
+    }
+
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        draw(m_plane, m_image);
+
+        Q_UNUSED(painter);
+        Q_UNUSED(option);
+        Q_UNUSED(widget);
+    }
+
+    virtual QImage* content() override
+    {
+        return &m_image;
+    }
+
+    virtual qint64 contentBytes() const override
+    {
+        qint64 bytes = MemoryLedger::bytes(m_image);
+        for (auto& image: m_images)
+            bytes += MemoryLedger::bytes(image);
+        return bytes;
+    }
+
+    virtual ~GraphicsEntityItem();
+
+protected:
+
+    void redraw();
+
+    EntitySystem& m_entities;
+    QImage m_image;
+    /** Images by entity type. */
+    std::vector<QImage> m_images;
+    /** Rectangles of m_image drawn by the last redraw. */
+    std::vector<QRect> m_drawn;
+};
+
+#endif // GRAPHICSENTITYITEM_H
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "graphicshuditem.h"
+#include "framescheduler.h"
+#include "systemsampler.h"
+#include <QFontMetrics>
+#include <QPainter>
+#include <cstdio>
+#include <cstring>
+
+/*
+ * Premultiplied, so glyphs and bars can be copied straight into the plane.
+ */
+static const QRgb BACKGROUND = 0xb0000000;
+static const QRgb FOREGROUND = 0xffffffff;
+
+GraphicsHudItem::GraphicsHudItem(PlaneManager& planes, struct plane_data* plane,
+                                 SystemSampler& sampler, int msecs)
+    : GraphicsPlaneItem(planes, plane, QRectF()),
+      m_sampler(sampler),
+      m_interval((qint64)msecs * 1000000LL),
+      m_cellsDrawn(0),
+      m_refreshes(0),
+      m_periodStart(-1),
+      m_lastFrame(-1),
+      m_frames(0),
+      m_frameMax(0),
+      m_commitSum(0),
+      m_commitMax(0),
+      m_commits(0),
+      m_lastCommitCount(planes.commitCount())
+{
+    QFont font("monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    font.setPixelSize(12);
+    QFontMetrics metrics(font);
+    m_cell = QSize(metrics.averageCharWidth(), metrics.height());
+
+    m_glyphs = QImage(m_cell.width() * 95, m_cell.height(), QImage::Format_ARGB32_Premultiplied);
+    m_glyphs.fill(BACKGROUND);
+    QPainter painter(&m_glyphs);
+    painter.setFont(font);
+    painter.setPen(QColor(FOREGROUND));
+    for (int c = 0; c < 95; c++)
+        painter.drawText(c * m_cell.width(), metrics.ascent(), QString(QChar(32 + c)));
+    painter.end();
+
+    m_image = QImage(COLUMNS * m_cell.width(), ROWS * m_cell.height() + HISTOGRAM_HEIGHT,
+                     QImage::Format_ARGB32_Premultiplied);
+    m_image.fill(BACKGROUND);
+    m_bounding = m_image.rect();
+
+    memset(m_text, ' ', sizeof(m_text));
+    memset(m_shown, ' ', sizeof(m_shown));
+    memset(m_histogram, 0, sizeof(m_histogram));
+    memset(m_bars, 0, sizeof(m_bars));
+
+    /*
+     * The first image is a blank background, the text and histogram drawn into it later
+     * would not fit whatever format it picks.
+     */
+    setFormatSelection(false);
+
+    paint(0, 0, 0);
+
+    connect(&m_planes.scheduler(), &FrameScheduler::frame, this, [this](qint64 time, qint64) {
+        frame(time);
+    });
+    connect(&m_planes.scheduler(), &FrameScheduler::committed, this, [this](qint64) {
+        committed();
+    });
+}
+
+void GraphicsHudItem::frame(qint64 time)
+{
+    if (m_lastFrame >= 0)
+    {
+        qint64 elapsed = time - m_lastFrame;
+        m_frameMax = qMax(m_frameMax, elapsed);
+        m_histogram[qMin<qint64>(elapsed / (BUCKET_MS * 1000000LL), BUCKETS - 1)]++;
+        m_frames++;
+    }
+    else
+    {
+        m_periodStart = time;
+    }
+    m_lastFrame = time;
+
+    /*
+     * Refreshed from inside the frame, so the damage goes out with the commit of the frame
+     * instead of one of its own.
+     */
+    if (time - m_periodStart >= m_interval)
+        refresh(time);
+}
+
+void GraphicsHudItem::committed()
+{
+    if (m_planes.commitCount() == m_lastCommitCount)
+        return;
+
+    m_lastCommitCount = m_planes.commitCount();
+    m_commitSum += m_planes.commitTime();
+    m_commitMax = qMax(m_commitMax, m_planes.commitTime());
+    m_commits++;
+}
+
+void GraphicsHudItem::refresh(qint64 time)
+{
+    char line[64];
+    qint64 period = time - m_periodStart;
+
+    snprintf(line, sizeof(line), "fps %5.1f  skipped %llu",
+             m_frames * 1000000000.0 / period,
+             (unsigned long long)m_planes.scheduler().skippedFrames());
+    setText(0, line);
+
+    snprintf(line, sizeof(line), "frame %5.1f max %5.1f ms",
+             m_frames ? period / 1000000.0 / m_frames : 0.0, m_frameMax / 1000000.0);
+    setText(1, line);
+
+    snprintf(line, sizeof(line), "commit %4.2f max %4.2f ms",
+             m_commits ? m_commitSum / 1000000.0 / m_commits : 0.0, m_commitMax / 1000000.0);
+    setText(2, line);
+
+    SystemSampler::Sample sample;
+    if (m_sampler.latest(sample))
+    {
+        int n = snprintf(line, sizeof(line), "cpu %3.0f%%", sample.total);
+        for (int i = 0; i < sample.cpus && n < COLUMNS; i++)
+            n += snprintf(line + n, sizeof(line) - n, " %3.0f", sample.cpu[i]);
+        setText(3, line);
+
+        snprintf(line, sizeof(line), "rss %5.1fM avail %6.1fM",
+                 sample.rssKb / 1024.0, sample.memAvailableKb / 1024.0);
+        setText(4, line);
+    }
+
+    PlaneManager::Bandwidth bandwidth = m_planes.totalBandwidth();
+    snprintf(line, sizeof(line), "bus %6.1f up %5.1f MB/s",
+             bandwidth.scanout / 1000000.0, bandwidth.upload / 1000000.0);
+    setText(5, line);
+
+    QRegion damage = drawCells() | drawHistogram();
+    updateRegion(damage);
+    m_refreshes++;
+
+    m_periodStart = time;
+    m_frames = 0;
+    m_frameMax = 0;
+    m_commitSum = 0;
+    m_commitMax = 0;
+    m_commits = 0;
+    memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+void GraphicsHudItem::setText(int row, const char* text)
+{
+    size_t length = qMin(strlen(text), (size_t)COLUMNS);
+    memcpy(m_text[row], text, length);
+    memset(m_text[row] + length, ' ', COLUMNS - length);
+}
+
+QRegion GraphicsHudItem::drawCells()
+{
+    QRegion damage;
+    int bytes = m_cell.width() * 4;
+
+    for (int row = 0; row < ROWS; row++)
+    {
+        int first = -1;
+        int last = -1;
+
+        for (int column = 0; column < COLUMNS; column++)
+        {
+            char c = m_text[row][column];
+            if (c == m_shown[row][column])
+                continue;
+
+            int glyph = (c < 32 || c > 126) ? 0 : c - 32;
+            for (int y = 0; y < m_cell.height(); y++)
+                memcpy(m_image.scanLine(row * m_cell.height() + y) + column * bytes,
+                       m_glyphs.constScanLine(y) + glyph * bytes, bytes);
+
+            m_shown[row][column] = c;
+            m_cellsDrawn++;
+
+            if (first < 0)
+                first = column;
+            last = column;
+        }
+
+        /*
+         * One rectangle per row keeps the damage under MAX_DAMAGE_RECTS.
+         */
+        if (first >= 0)
+            damage |= QRect(first * m_cell.width(), row * m_cell.height(),
+                            (last - first + 1) * m_cell.width(), m_cell.height());
+    }
+
+    return damage;
+}
+
+QRegion GraphicsHudItem::drawHistogram()
+{
+    int most = 1;
+    for (auto count: m_histogram)
+        most = qMax(most, count);
+
+    QRegion damage;
+    int top = ROWS * m_cell.height();
+    int width = m_image.width() / BUCKETS;
+
+    QPainter painter(&m_image);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        int bar = m_histogram[i] ? qMax(1, m_histogram[i] * HISTOGRAM_HEIGHT / most) : 0;
+        if (bar == m_bars[i])
+            continue;
+
+        /*
+         * Green up to 60Hz, yellow up to 30Hz, red beyond.
+         */
+        int ms = i * BUCKET_MS;
+        QColor color = ms < 17 ? Qt::green : (ms < 33 ? Qt::yellow : Qt::red);
+
+        QRect column(i * width, top, width, HISTOGRAM_HEIGHT);
+        painter.fillRect(column, QColor::fromRgba(BACKGROUND));
+        painter.fillRect(QRect(column.x() + 1, top + HISTOGRAM_HEIGHT - bar, width - 2, bar),
+                         color);
+
+        m_bars[i] = bar;
+        damage |= column;
+    }
+    painter.end();
+
+    return damage.isEmpty() ? damage : QRegion(damage.boundingRect());
+}
+
+GraphicsHudItem::~GraphicsHudItem()
+{
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef GRAPHICSHUDITEM_H
+#define GRAPHICSHUDITEM_H
+
+#include "graphicsplaneitem.h"
+#include "memoryledger.h"
+#include <QImage>
+
+class SystemSampler;
+
+/**
+ * @brief The GraphicsHudItem class
+ *
+ * A performance overlay on a plane of its own, showing the frame rate, a histogram of frame
+ * times, commit time, per core CPU load, memory and the memory bus bandwidth of the planes.
+ *
+ * Text is drawn from a glyph atlas rendered once, into a grid of cells.  Only the cells that
+ * changed since the last refresh are copied, and uploaded to the plane as damage, so the HUD
+ * costs next to nothing between refreshes and never touches the primary plane.  Frames are
+ * counted as they run and the numbers are refreshed a couple of times a second.
+ */
+class GraphicsHudItem : public GraphicsPlaneItem
+{
+public:
+
+    static const int COLUMNS = 26;
+    static const int ROWS = 6;
+
+    /**
+     * @brief Frame time histogram buckets, BUCKET_MS wide, the last one open ended.
+     */
+    static const int BUCKETS = 13;
+    static const int BUCKET_MS = 4;
+    static const int HISTOGRAM_HEIGHT = 24;
+
+    /**
+     * @param msecs Time between refreshes of the numbers.
+     */
+    GraphicsHudItem(PlaneManager& planes, struct plane_data* plane, SystemSampler& sampler,
+                    int msecs = 500);
+
+    inline int width() const
+    {
+        return m_image.width();
+    }
+
+    inline int height() const
+    {
+        return m_image.height();
+    }
+
+    /**
+     * @brief Number of glyph cells drawn since the HUD was created.
+     */
+    inline quint64 cellsDrawn() const
+    {
+        return m_cellsDrawn;
+    }
+
+    inline quint64 refreshCount() const
+    {
+        return m_refreshes;
+    }
+
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
+    {
+        draw(m_plane, m_image);
+
+        Q_UNUSED(painter);
+        Q_UNUSED(option);
+        Q_UNUSED(widget);
+    }
+
+    virtual QImage* content() override
+    {
+        return &m_image;
+    }
+
+    virtual qint64 contentBytes() const override
+    {
+        return MemoryLedger::bytes(m_image) + MemoryLedger::bytes(m_glyphs);
+    }
+
+    virtual ~GraphicsHudItem();
+
+protected:
+
+    void frame(qint64 time);
+    void committed();
+    void refresh(qint64 time);
+
+    void setText(int row, const char* text);
+    QRegion drawCells();
+    QRegion drawHistogram();
+
+    SystemSampler& m_sampler;
+    qint64 m_interval;
+
+    /** Glyphs of ASCII 32 to 126 side by side, on the HUD background. */
+    QImage m_glyphs;
+    QSize m_cell;
+    QImage m_image;
+
+    char m_text[ROWS][COLUMNS];
+    /** What the cells in m_image show. */
+    char m_shown[ROWS][COLUMNS];
+    quint64 m_cellsDrawn;
+    quint64 m_refreshes;
+
+    int m_histogram[BUCKETS];
+    /** Height of each bar in m_image. */
+    int m_bars[BUCKETS];
+
+    /*
+     * Counted since the last refresh.
+     */
+    qint64 m_periodStart;
+    qint64 m_lastFrame;
+    int m_frames;
+    qint64 m_frameMax;
+    qint64 m_commitSum;
+    qint64 m_commitMax;
+    int m_commits;
+    unsigned int m_lastCommitCount;
+};
+
+#endif // GRAPHICSHUDITEM_H
@@ -6,3 +6,76 @@
  */
 
 #include "graphicslayeritem.h"
+#include "framescheduler.h"
+
+GraphicsLayerItem::GraphicsLayerItem(PlaneManager& planes, struct plane_data* plane,
+                                     const QImage& image, int width, int height, int speed)
+    : GraphicsPlaneItem(planes, plane, image.rect()),
+      m_image(prepare(image)),
+      m_period(m_image.width() / 2),
+      m_speed(speed),
+      m_plane(plane),
+      m_width(width),
+      m_height(height),
+      m_position(0),
+      m_remainder(0)
+{
+    if (!plane)
+        qFatal("invalid plane pointer");
+
+    m_planes.setPanSize(m_plane, width, height);
+    updatePan();
+
+    /*
+     * However many frames advanced the position, it is only rounded once per commit.
+     */
+    connect(&m_planes, &PlaneManager::aboutToCommit, this, &GraphicsLayerItem::updatePan);
+}
+
+void GraphicsLayerItem::setImage(const QImage& image)
+{
+    prepareGeometryChange();
+    m_image = prepare(image);
+    m_period = m_image.width() / 2;
+    m_bounding = m_image.rect();
+
+    updatePan();
+
+    draw(m_plane, m_image);
+}
+
+void GraphicsLayerItem::advance(int step)
+{
+    if (!step)
+        return;
+
+    qint64 wrap = this->wrap();
+    if (!wrap)
+        return;
+
+    /*
+     * speed * delta is in pixel nanoseconds.  The remainder is carried over so no time is
+     * lost to rounding, however short the frames are.
+     */
+    qint64 delta = m_planes.scheduler().delta();
+    qint64 distance = ((qint64)m_speed * delta << FIXED_SHIFT) + m_remainder;
+    m_position += distance / 1000000000LL;
+    m_remainder = distance % 1000000000LL;
+
+    m_position %= wrap;
+    if (m_position < 0)
+        m_position += wrap;
+}
+
+void GraphicsLayerItem::updatePan()
+{
+    /*
+     * Both halves of the image are the same, so rounding up to the end of the first half
+     * shows the same pixels as the start.
+     */
+    int x = (m_position + (1 << (FIXED_SHIFT - 1))) >> FIXED_SHIFT;
+    if (m_period && x >= m_period)
+        x -= m_period;
+
+    m_planes.setPanPos(m_plane, x, 0);
+}
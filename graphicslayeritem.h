@@ -9,9 +9,11 @@
 
 #include <QDebug>
 #include <QGraphicsPixmapItem>
+#include <QImage>
 #include <QEvent>
 #include "planemanager.h"
 #include "graphicsplaneitem.h"
+#include "memoryledger.h"
 
 /**
  * @brief The GraphicsLayerItem class
@@ -19,78 +21,111 @@
  * A GraphicsPlaneItem that is meant for handling a panning layer of a graphics scene.
  *
  * This expects the image to be 2X the width of the scene, and it will scroll the layer.
+ *
+ * The layer moves by the time that passed since the previous frame, not by a fixed step per
+ * frame, so it scrolls at the same speed whatever the frame rate.  The position is kept in
+ * 16.16 fixed point and only rounded to a whole pixel when the pan position is written, right
+ * before the commit.
+ *
+ * The image is dropped once it is in the plane, unless setRetainContent() says otherwise.
  */
 class GraphicsLayerItem : public GraphicsPlaneItem
 {
 public:
 
-    GraphicsLayerItem(struct plane_data* plane, const QPixmap& image, int width, int height, int speed)
-        : GraphicsPlaneItem(plane, image.rect()),
-          m_image(image),
-          m_speed(speed),
-          m_plane(plane),
-          m_width(width),
-          m_height(height),
-          m_x(0)
-    {
-        if (!plane)
-            qFatal("invalid plane pointer");
-
-        if (speed < 0)
-            m_x = m_image.width()/2;
-
-        plane_set_pan_size(m_plane, width, height);
-        plane_set_pan_pos(m_plane, m_x, 0);
-        plane_apply(m_plane);
-    }
+    /**
+     * @param speed Pixels per second, negative to scroll the other way.
+     */
+    GraphicsLayerItem(PlaneManager& planes, struct plane_data* plane, const QImage& image,
+                      int width, int height, int speed);
 
     inline int width() const
     {
         return m_width;
     }
 
+    /**
+     * @brief Replace the image, for a layer created before its image was loaded.
+     */
+    void setImage(const QImage& image);
+
     virtual void reverse()
     {
         m_speed *= -1;
     }
 
-    virtual void advance(int step) override
+    inline int speed() const
     {
-        if (!step)
-            return;
-
-        m_x += m_speed;
-
-        if (m_x >= m_image.width()/2)
-            m_x = 0;
-        else if (m_x < 0)
-            m_x = m_image.width()/2;
+        return m_speed;
+    }
 
-        plane_set_pan_pos(m_plane, m_x, 0);
-        plane_apply(m_plane);
+    /**
+     * @brief Scroll position in 16.16 fixed point pixels.
+     */
+    inline qint64 position() const
+    {
+        return m_position;
     }
 
+    virtual void advance(int step) override;
+
     virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
     {
         qDebug() << "GraphicsLayerItem::paint";
 
-        draw(m_plane, m_image.toImage());
+        draw(m_plane, m_image);
 
         Q_UNUSED(painter);
         Q_UNUSED(option);
         Q_UNUSED(widget);
     }
 
+    virtual QImage* content() override
+    {
+        return &m_image;
+    }
+
+    virtual qint64 contentBytes() const override
+    {
+        return MemoryLedger::bytes(m_image);
+    }
+
     virtual ~GraphicsLayerItem()
     {}
 
+    static const int FIXED_SHIFT = 16;
+
 protected:
-    QPixmap m_image;
+
+    /**
+     * @brief Width the layer wraps around at, in fixed point.
+     */
+    virtual qint64 wrap() const
+    {
+        return (qint64)m_period << FIXED_SHIFT;
+    }
+
+    /**
+     * @brief Write the pan position for the next commit.
+     */
+    virtual void updatePan();
+
+    virtual void releaseContent() override
+    {
+        m_image = QImage();
+    }
+
+    QImage m_image;
+    /** Half the width of the image, where it repeats. */
+    int m_period;
     int m_speed;
     struct plane_data* m_plane;
     int m_width;
     int m_height;
-    int m_x;
+    /** Scroll position, in fixed point. */
+    qint64 m_position;
+    /** Fraction of a fixed point unit left over from the last advance, in nanoseconds. */
+    qint64 m_remainder;
 };
 
 #endif // GRAPHICSLAYERITEM_H
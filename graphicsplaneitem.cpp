@@ -5,26 +5,39 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "graphicsplaneitem.h"
-#include <planes/plane.h>
+#include "framescheduler.h"
+#include "memoryledger.h"
+#include "pixelkernels.h"
+#include "trace.h"
 #include <QPainter>
 #include <QDebug>
 #include <QEvent>
 #include <QGraphicsSceneMouseEvent>
 #include <QStyleOptionGraphicsItem>
+#include <QtConcurrent>
+#include <algorithm>
+#include <cstring>
 
-GraphicsPlaneItem::GraphicsPlaneItem(struct plane_data* plane, const QRectF& bounding)
+GraphicsPlaneItem::GraphicsPlaneItem(PlaneManager& planes, struct plane_data* plane, const QRectF& bounding)
     : m_bounding(bounding),
-      m_plane(plane)
+      m_planes(planes),
+      m_plane(plane),
+      m_renderBuffer(-1),
+      m_fadeStart(-1),
+      m_fadeDuration(0),
+      m_retainContent(false),
+      m_formatSelection(true),
+      m_formatKey(0),
+      m_format(0)
 {
     if (!plane)
         qFatal("invalid plane pointer");
 
     /*
-     * This is not a solid solution, but this prevents painting in most cases.  We don't need
-     * to paint a plane unless the plane contents itself changes.  This means, we don't need
-     * to paint when the item is moved, scaled, etc.
+     * The content is in the plane, and is only drawn there when it changes.  A Qt item cache
+     * would be one more copy of it that nothing ever looks at.
      */
-    setCacheMode(QGraphicsItem::DeviceCoordinateCache);
+    setCacheMode(QGraphicsItem::NoCache);
 
     /*
      * QGraphicsItem::ItemSendsGeometryChanges is how we get ItemPositionChange,
@@ -38,18 +51,287 @@ GraphicsPlaneItem::GraphicsPlaneItem(struct plane_data* plane, const QRectF& bou
              QGraphicsItem::ItemClipsToShape);
 
     moveEvent(pos());
+
+    connect(&m_render, &QFutureWatcher<void>::finished, this, [this]() {
+        for (int i = 0; i < 3; i++)
+            if (i != m_renderBuffer)
+                m_stale[i] = QRegion(0, 0, m_planes.width(m_plane), m_planes.height(m_plane));
+        m_planes.addUpload(m_plane, (qint64)m_planes.pitch(m_plane) * m_planes.height(m_plane));
+        m_planes.flip(m_plane, m_renderBuffer);
+        m_renderBuffer = -1;
+    });
+
+    connect(&m_planes, &PlaneManager::aboutToCommit, this, &GraphicsPlaneItem::flushDamage);
+
+    QString name = QString::fromStdString(m_planes.name(m_plane));
+    m_account = MemoryLedger::instance().add(name, [this]() {
+        MemoryLedger::Usage usage;
+        usage.cpu = contentBytes();
+        usage.cache = 0;
+        usage.plane = (qint64)m_planes.pitch(m_plane) * m_planes.height(m_plane) *
+            qMax(1, m_planes.bufferCount(m_plane));
+        return usage;
+    });
 }
 
-QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant &value)
+GraphicsPlaneItem::~GraphicsPlaneItem()
 {
-    qDebug() << "GraphicsPlaneItem::itemChange " << change;
+    MemoryLedger::instance().remove(m_account);
+    disconnect(m_fade);
+    m_render.waitForFinished();
+}
+
+void GraphicsPlaneItem::setRetainContent(bool retain)
+{
+    m_retainContent = retain;
+}
+
+void GraphicsPlaneItem::setFormatSelection(bool enabled)
+{
+    m_formatSelection = enabled;
+    m_formatKey = 0;
+}
+
+uint32_t GraphicsPlaneItem::chooseFormat(const QImage& image, const std::vector<uint32_t>& formats,
+                                         uint32_t fallback)
+{
+    PixelKernels::Usage usage = PixelKernels::usage(image);
+
+    /*
+     * From the cheapest format down.  An opaque image is better off in RGB565 even when it
+     * has few colors, it keeps more bits of each.  Few colors alone is not enough for
+     * ARGB4444, a handful of smooth shades would still band, so they also have to be close
+     * to 4 bit levels already.
+     */
+    std::vector<uint32_t> candidates;
+    if (usage.opaque)
+        candidates.push_back(DRM_FORMAT_RGB565);
+    if (usage.colors <= PixelKernels::MAX_COLORS &&
+        usage.nibbleError <= PixelKernels::MAX_NIBBLE_ERROR)
+        candidates.push_back(DRM_FORMAT_ARGB4444);
+    candidates.push_back(DRM_FORMAT_ARGB8888);
 
-    if (change == GraphicsItemChange::ItemPositionChange)
+    for (auto c: candidates)
+        if (std::find(formats.begin(), formats.end(), c) != formats.end())
+            return c;
+
+    return fallback;
+}
+
+uint32_t GraphicsPlaneItem::planeFormat(const QImage& image)
+{
+    if (!m_formatSelection)
+        return m_planes.format(m_plane);
+
+    if (image.cacheKey() != m_formatKey)
     {
-        moveEvent(value.toPoint());
-        return value;
+        TRACE_SCOPE(Trace::Graphics, "choose_format");
+
+        uint32_t format = chooseFormat(image, m_planes.formats(m_plane),
+                                       m_planes.format(m_plane));
+        m_formatKey = image.cacheKey();
+
+        /*
+         * Sprites draw a new image every frame, only say when the plane changes format.
+         */
+        if (format != m_format)
+            qDebug() << "plane" << m_planes.name(m_plane).c_str() << "format" <<
+                QByteArray(reinterpret_cast<const char*>(&format), 4);
+        m_format = format;
+    }
+
+    return m_format;
+}
+
+bool GraphicsPlaneItem::setBufferCount(int count)
+{
+    m_render.waitForFinished();
+
+    return m_planes.setBufferCount(m_plane, count);
+}
+
+void GraphicsPlaneItem::fadeIn(int msecs)
+{
+    disconnect(m_fade);
+
+    if (msecs <= 0 || !m_planes.hasAlpha(m_plane))
+    {
+        m_planes.setAlpha(m_plane, 255);
+        return;
     }
-    else if (change == GraphicsItemChange::ItemPositionHasChanged)
+
+    m_planes.setAlpha(m_plane, 0);
+    m_fadeStart = -1;
+    m_fadeDuration = (qint64)msecs * 1000000LL;
+
+    m_fade = connect(&m_planes.scheduler(), &FrameScheduler::frame, this,
+                     [this](qint64 time, qint64 delta) {
+        Q_UNUSED(delta);
+
+        if (m_fadeStart < 0)
+            m_fadeStart = time;
+
+        qint64 elapsed = time - m_fadeStart;
+        int alpha = elapsed >= m_fadeDuration ? 255 : elapsed * 255 / m_fadeDuration;
+        m_planes.setAlpha(m_plane, alpha);
+
+        if (alpha == 255)
+            disconnect(m_fade);
+    });
+}
+
+QImage GraphicsPlaneItem::wrapBuffer(struct plane_data* plane, int index)
+{
+    QImage::Format format = formatImageFormat(m_planes.format(plane));
+    if (format == QImage::Format_Invalid)
+        format = QImage::Format_ARGB32_Premultiplied;
+
+    void* bits = index < 0 ? m_planes.map(plane) : m_planes.mapBuffer(plane, index);
+
+    return QImage(static_cast<uchar*>(bits),
+                  m_planes.width(plane), m_planes.height(plane), m_planes.pitch(plane),
+                  format);
+}
+
+bool GraphicsPlaneItem::renderAsync(std::function<void(QImage&)> render)
+{
+    if (m_render.isRunning() || m_planes.bufferCount(m_plane) < 2)
+        return false;
+
+    int index = m_planes.acquireBuffer(m_plane);
+    if (index < 0)
+        return false;
+
+    m_renderBuffer = index;
+
+    QImage image = wrapBuffer(m_plane, index);
+    m_render.setFuture(QtConcurrent::run([render, image]() mutable {
+        render(image);
+    }));
+
+    return true;
+}
+
+void GraphicsPlaneItem::updateRegion(const QRegion& region)
+{
+    if (region.isEmpty())
+        return;
+
+    /*
+     * QRegion keeps its rectangles disjoint, so overlapping damage within a frame is only
+     * uploaded once.
+     */
+    m_damage |= region;
+    m_planes.damage(m_plane);
+}
+
+void GraphicsPlaneItem::flushDamage()
+{
+    if (m_damage.isEmpty() || m_render.isRunning())
+        return;
+
+    QImage* image = content();
+    if (!image || image->width() != m_planes.width(m_plane) ||
+        image->height() != m_planes.height(m_plane) || !transform().isIdentity())
+    {
+        /*
+         * The content does not map 1:1 onto the framebuffer, so redraw all of it.
+         */
+        m_damage = QRegion();
+        paint(0, 0, 0);
+        return;
+    }
+
+    QRegion damage = m_damage & image->rect();
+    if (damage.rectCount() > MAX_DAMAGE_RECTS)
+        damage = damage.boundingRect();
+
+    int index = -1;
+    int count = m_planes.bufferCount(m_plane);
+    if (count > 1)
+    {
+        /*
+         * Keep the damage for the next commit if every buffer is still busy.
+         */
+        index = m_planes.acquireBuffer(m_plane);
+        if (index < 0)
+            return;
+
+        /*
+         * The back buffer also misses whatever was uploaded to the other buffers since it
+         * was last drawn.
+         */
+        QRegion region = damage | m_stale[index];
+        m_stale[index] = QRegion();
+        for (int i = 0; i < count; i++)
+            if (i != index)
+                m_stale[i] |= damage;
+        damage = region;
+    }
+
+    m_damage = QRegion();
+
+    QImage fb = wrapBuffer(m_plane, index);
+    uploadRegion(fb, *image, damage);
+
+    qint64 pixels = 0;
+    for (const QRect& rect: damage)
+        pixels += rect.width() * rect.height();
+    m_planes.addUpload(m_plane, pixels * fb.depth() / 8);
+
+    if (index >= 0)
+        m_planes.flip(m_plane, index);
+}
+
+void GraphicsPlaneItem::uploadRegion(QImage& fb, const QImage& image, const QRegion& region)
+{
+    if (fb.format() == image.format())
+    {
+        int bpp = image.depth() / 8;
+        for (const QRect& rect: region)
+        {
+            int bytes = rect.width() * bpp;
+            for (int y = rect.top(); y <= rect.bottom(); y++)
+                memcpy(fb.scanLine(y) + rect.x() * bpp,
+                       image.constScanLine(y) + rect.x() * bpp, bytes);
+        }
+    }
+    else if ((fb.format() == QImage::Format_RGB16 ||
+              fb.format() == QImage::Format_ARGB4444_Premultiplied) &&
+             image.format() == QImage::Format_ARGB32_Premultiplied)
+    {
+        /*
+         * The dither pattern is anchored to the framebuffer, so damage lines up with what was
+         * drawn around it.
+         */
+        auto convert = fb.format() == QImage::Format_RGB16 ?
+            PixelKernels::toRgb565Dithered : PixelKernels::toArgb4444Dithered;
+        for (const QRect& rect: region)
+            for (int y = rect.top(); y <= rect.bottom(); y++)
+                convert(reinterpret_cast<uint16_t*>(fb.scanLine(y)) + rect.x(),
+                        reinterpret_cast<const uint32_t*>(image.constScanLine(y)) + rect.x(),
+                        rect.width(), rect.x(), y);
+    }
+    else
+    {
+        QPainter painter(&fb);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (const QRect& rect: region)
+            painter.drawImage(rect.topLeft(), image, rect);
+        painter.end();
+    }
+}
+
+QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    qDebug() << "GraphicsPlaneItem::itemChange " << change;
+    TRACE_INSTANT(Trace::Graphics, "item_change");
+
+    /*
+     * Only act on ItemPositionHasChanged.  ItemPositionChange carries the same position and
+     * would just be a redundant write.
+     */
+    if (change == GraphicsItemChange::ItemPositionHasChanged)
     {
         moveEvent(value.toPoint());
         return value;
@@ -61,8 +343,7 @@ QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant
     else if (change == GraphicsItemChange::ItemScaleHasChanged)
     {
         qDebug() << "scale " << value.toFloat();
-        plane_set_scale(m_plane, value.toFloat());
-        plane_apply(m_plane);
+        m_planes.setScale(m_plane, value.toFloat());
     }
 
     return QGraphicsItem::itemChange(change, value);
@@ -71,43 +352,132 @@ QVariant GraphicsPlaneItem::itemChange(GraphicsItemChange change, const QVariant
 void GraphicsPlaneItem::moveEvent(const QPointF& point)
 {
     qDebug() << "GraphicsPlaneItem::moveEvent " << point;
+    TRACE_INSTANT(Trace::Graphics, "item_move");
 
-    plane_set_pos(m_plane, point.x(), point.y());
-    plane_apply(m_plane);
+    m_planePos = point.toPoint();
+    m_planes.setPos(m_plane, m_planePos.x(), m_planePos.y());
 }
 
-void GraphicsPlaneItem::draw(struct plane_data* plane, QImage image, bool horizontal, bool vertical, bool scale)
+void GraphicsPlaneItem::moveTo(int x, int y)
 {
-    if ((int)plane_width(plane) != image.width() || (int)plane_height(plane) != image.height())
-        plane_fb_reallocate(plane, image.width(), image.height(), plane_format(plane));
+    m_planePos = QPoint(x, y);
+    m_planes.setPos(m_plane, x, y);
+}
 
-    plane_fb_map(plane);
+QImage GraphicsPlaneItem::prepare(const QImage& image)
+{
+    return PixelKernels::premultiplied(image);
+}
 
-    QImage fb(static_cast<uchar*>(plane->bufs[0]),
-              plane_width(plane), plane_height(plane),
-              QImage::Format_ARGB32_Premultiplied);
+void GraphicsPlaneItem::draw(struct plane_data* plane, const QImage& image, bool horizontal, bool vertical, bool scale)
+{
+    /*
+     * Images that are still being loaded have nothing to draw yet.
+     */
+    if (image.isNull())
+        return;
 
-    QPainter painter(&fb);
-    painter.setTransform(transform());
-    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    uint32_t fourcc = plane == m_plane ? planeFormat(image) : m_planes.format(plane);
+    if (m_planes.width(plane) != image.width() || m_planes.height(plane) != image.height() ||
+        m_planes.format(plane) != fourcc)
+    {
+        if (!m_planes.reallocate(plane, image.width(), image.height(), fourcc))
+        {
+            qDebug() << "GraphicsPlaneItem::draw can not reallocate in" <<
+                QByteArray(reinterpret_cast<const char*>(&fourcc), 4);
+            if (plane == m_plane)
+                m_format = m_planes.format(plane);
+            m_planes.reallocate(plane, image.width(), image.height());
+        }
+    }
 
-    QImage transformedImage(image);
+    /*
+     * A buffered plane is drawn into a back buffer that is flipped to with the next commit.
+     */
+    int index = -1;
+    if (m_planes.bufferCount(plane) > 1)
+    {
+        index = m_planes.acquireBuffer(plane);
+        if (index < 0)
+        {
+            qDebug() << "GraphicsPlaneItem::draw no free buffer";
+            return;
+        }
+    }
 
-    if (scale)
+    /*
+     * A full draw supersedes any damage, and leaves every other buffer behind.
+     */
+    if (plane == m_plane)
     {
-        QSize imageSize = image.size();
-        imageSize.scale(QSize(plane_width(plane), plane_height(plane)), Qt::KeepAspectRatio);
+        m_damage = QRegion();
+        for (int i = 0; i < 3; i++)
+            m_stale[i] = i == index ? QRegion() : QRegion(0, 0, m_planes.width(plane),
+                                                          m_planes.height(plane));
+    }
+
+    QImage fb = wrapBuffer(plane, index);
+    QSize size = fb.size();
+    QImage::Format format = fb.format();
 
-        transformedImage = image.scaled(imageSize,
-                                      Qt::KeepAspectRatio,
-                                      Qt::SmoothTransformation);
+    QSize imageSize = image.size();
+    if (scale)
+        imageSize.scale(size, Qt::KeepAspectRatio);
+
+    /*
+     * Nothing to transform and the image is already in the format of the plane, so this is
+     * a straight copy into the framebuffer.
+     */
+    if (imageSize == image.size() && !horizontal && !vertical &&
+        transform().isIdentity() && image.format() == format)
+    {
+        int bytes = qMin(image.bytesPerLine(), fb.bytesPerLine());
+        int lines = qMin(image.height(), size.height());
+        for (int y = 0; y < lines; y++)
+            memcpy(fb.scanLine(y), image.constScanLine(y), bytes);
+    }
+    else
+    {
+        drawTransformed(fb, image, imageSize, horizontal, vertical);
     }
 
+    m_planes.addUpload(plane,
+                       (qint64)fb.bytesPerLine() * qMin(imageSize.height(), size.height()));
+
+    if (index >= 0)
+        m_planes.flip(plane, index);
+
+    /*
+     * A buffered plane still has buffers without the content in them.
+     */
+    if (plane == m_plane && !m_retainContent && m_planes.bufferCount(plane) <= 1)
+        releaseContent();
+}
+
+void GraphicsPlaneItem::drawTransformed(QImage& fb, const QImage& image, const QSize& imageSize,
+                                        bool horizontal, bool vertical)
+{
+    /*
+     * Scaling, mirroring and format conversion all happen in one pass straight into the
+     * framebuffer, instead of through temporary images.  QPainter handles whatever the pixel
+     * kernels do not.
+     */
+    if (transform().isIdentity() &&
+        PixelKernels::blit(image, fb, imageSize, horizontal, vertical, true))
+        return;
+
+    QPainter painter(&fb);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, imageSize != image.size());
+
+    QTransform t = transform();
     if (horizontal || vertical)
     {
-        transformedImage = transformedImage.mirrored(horizontal, vertical);
+        t.translate(horizontal ? imageSize.width() : 0, vertical ? imageSize.height() : 0);
+        t.scale(horizontal ? -1 : 1, vertical ? -1 : 1);
     }
+    painter.setTransform(t);
 
-    painter.drawImage(QPoint(0,0), transformedImage);
+    painter.drawImage(QRect(QPoint(0, 0), imageSize), image);
     painter.end();
 }
@@ -11,18 +11,23 @@
 #include <QDebug>
 #include "planemanager.h"
 #include <QGraphicsView>
+#include <QFutureWatcher>
+#include <QRegion>
+#include <functional>
 
 /**
  * @brief The GraphicsPlaneItem class
  *
  * A QGraphicsObject that translates functions away from native Qt operations into hardware
  * planes functions using libplanes.
+ *
+ * All plane writes go through the PlaneManager so they end up in the current frame transaction.
  */
 class GraphicsPlaneItem : public QGraphicsObject
 {
 public:
 
-    GraphicsPlaneItem(struct plane_data* plane, const QRectF& bounding);
+    GraphicsPlaneItem(PlaneManager& planes, struct plane_data* plane, const QRectF& bounding);
 
     virtual QRectF boundingRect() const override
     {
@@ -47,29 +52,221 @@ public:
         Q_UNUSED(rect);
     }
 
-    virtual ~GraphicsPlaneItem()
-    {}
+    /**
+     * @brief Render plane content into back buffers and flip to them on vblank.
+     *
+     * With more than one buffer, draw() never touches the framebuffer being scanned out.
+     *
+     * @param count 2 or 3 buffers, 1 goes back to drawing straight into the plane.
+     * @return false if the plane can not flip.
+     */
+    bool setBufferCount(int count);
+
+    /**
+     * @brief Render the next buffer on a worker thread while the current one is displayed.
+     *
+     * render is called from the global thread pool with an image wrapping a free back buffer,
+     * and the buffer is flipped to from the GUI thread once it returns.  render must not touch
+     * anything but the image.
+     *
+     * @return false if the item is not buffered, or no back buffer is free.
+     */
+    bool renderAsync(std::function<void(QImage&)> render);
+
+    /**
+     * @brief Upload only part of the content of the plane.
+     *
+     * Change the image returned by content() and pass the rectangles that changed.  Damage is
+     * merged until the next commit, when only the damaged pixels are copied to the
+     * framebuffer.
+     *
+     * @param region Damage in content() coordinates.
+     */
+    void updateRegion(const QRegion& region);
+
+    /**
+     * @brief The image shown on the plane, if it maps 1:1 onto the framebuffer.
+     *
+     * Used by updateRegion().  Items that transform their content return 0, and any damage
+     * then causes a full redraw.
+     */
+    virtual QImage* content()
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Keep the content in memory once it is in the plane.
+     *
+     * Off by default, so items drop their image once it has been drawn to the plane, and only
+     * draw again when they are given a new one.  Items that take partial updates with
+     * updateRegion(), or are redrawn from their image, have to keep it.
+     */
+    void setRetainContent(bool retain);
+
+    inline bool retainContent() const
+    {
+        return m_retainContent;
+    }
+
+    /**
+     * @brief Reallocate the plane in the cheapest format that holds the content.
+     *
+     * On by default.  Each new image is scanned once when it is drawn, and the plane is
+     * reallocated in RGB565 if it is opaque, ARGB4444 if it uses few colors that are already
+     * close to 4 bit levels, or otherwise in ARGB8888, whichever of those the plane can scan
+     * out first.  Half the bytes per pixel is half the memory bandwidth the display
+     * controller needs for the plane.
+     *
+     * Off, the plane stays in the format it was created in.  Items that take partial updates
+     * with updateRegion() should turn it off, their later content may not fit the format
+     * picked for the first image.
+     */
+    void setFormatSelection(bool enabled);
+
+    inline bool formatSelection() const
+    {
+        return m_formatSelection;
+    }
+
+    /**
+     * @brief Cheapest of formats that holds an image, as picked by setFormatSelection().
+     * @return fallback if no format fits.
+     */
+    static uint32_t chooseFormat(const QImage& image, const std::vector<uint32_t>& formats,
+                                 uint32_t fallback);
+
+    /**
+     * @brief Bytes of CPU memory the item holds for its content, for the MemoryLedger.
+     */
+    virtual qint64 contentBytes() const
+    {
+        return 0;
+    }
+
+    /**
+     * @brief Fade the whole plane in from transparent, one step every frame.
+     *
+     * Planes without alpha just show up.
+     */
+    void fadeIn(int msecs);
+
+    /**
+     * @brief Move the plane without going through QGraphicsItem.
+     *
+     * For items in a PlaneScene.  The position goes straight to the PlaneManager, without the
+     * QVariant round trip and scene bookkeeping of setPos().
+     */
+    void moveTo(int x, int y);
+
+    /**
+     * @brief Position of the plane on the screen.
+     */
+    inline QPoint planePos() const
+    {
+        return m_planePos;
+    }
+
+    /**
+     * @brief Rectangle the plane covers on the screen.
+     */
+    inline QRect planeRect() const
+    {
+        return QRect(m_planePos, m_bounding.size().toSize());
+    }
+
+    /**
+     * @brief A press delivered by a PlaneScene.
+     * @param pos Position in item coordinates.
+     * @return true if the press was handled and should go no further.
+     */
+    virtual bool pressEvent(const QPoint& pos)
+    {
+        Q_UNUSED(pos);
+        return false;
+    }
+
+    virtual ~GraphicsPlaneItem();
 
 protected:
 
     virtual void moveEvent(const QPointF& point);
 
+    /**
+     * @brief Drop the content once it has been drawn to the plane.
+     *
+     * Called after a full draw unless the content is retained.
+     */
+    virtual void releaseContent()
+    {}
+
     /**
      * @brief draw
      *
      * A special drawing function that draws an image directly to a plane.
      *
+     * When the image needs no transform and is already in the format of the plane, as
+     * returned by prepare(), it is copied straight into the framebuffer.  Conversion to 16 bit
+     * formats is dithered.
+     *
      * @param plane
      * @param image
      * @param horizontal
      * @param vertical
      */
-    void draw(struct plane_data* plane, QImage image, bool horizontal = false, bool vertical = false, bool scale = true);
+    void draw(struct plane_data* plane, const QImage& image, bool horizontal = false, bool vertical = false, bool scale = true);
+
+    void drawTransformed(QImage& fb, const QImage& image, const QSize& imageSize,
+                         bool horizontal, bool vertical);
+
+    /**
+     * @brief Convert an image once to the format planes are drawn in.
+     */
+    static QImage prepare(const QImage& image);
 
     virtual QVariant itemChange(GraphicsItemChange change, const QVariant &value) override;
 
+    QImage wrapBuffer(struct plane_data* plane, int index);
+
+    void flushDamage();
+    static void uploadRegion(QImage& fb, const QImage& image, const QRegion& region);
+
+    /**
+     * @brief Format for the plane to draw an image in, chosen once per image.
+     */
+    uint32_t planeFormat(const QImage& image);
+
+    /**
+     * @brief Above this many rectangles, damage is uploaded as its bounding rectangle.
+     */
+    static const int MAX_DAMAGE_RECTS = 8;
+
     QRectF m_bounding;
+    QPoint m_planePos;
+    PlaneManager& m_planes;
     struct plane_data* m_plane;
+    QFutureWatcher<void> m_render;
+    int m_renderBuffer;
+
+    /** Damage waiting for the next commit. */
+    QRegion m_damage;
+    /** Per buffer, damage it has not seen yet when the plane flips. */
+    QRegion m_stale[3];
+
+    QMetaObject::Connection m_fade;
+    /** Frame time the fade started at, -1 until the first frame. */
+    qint64 m_fadeStart;
+    qint64 m_fadeDuration;
+
+    bool m_retainContent;
+
+    bool m_formatSelection;
+    /** QImage::cacheKey() of the image the format was last chosen for. */
+    qint64 m_formatKey;
+    uint32_t m_format;
+
+    /** Account of the item in the MemoryLedger. */
+    int m_account;
 };
 
 #endif // GRAPHICSPLANEITEM_H
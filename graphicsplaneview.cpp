@@ -5,6 +5,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "graphicsplaneview.h"
+#include "planescene.h"
+#include "trace.h"
 #include <QApplication>
 #include <QPaintEvent>
 #include <QDebug>
@@ -12,7 +14,8 @@
 #include <QGraphicsSceneMouseEvent>
 
 GraphicsPlaneView::GraphicsPlaneView(QGraphicsScene *scene)
-    : QGraphicsView(scene)
+    : QGraphicsView(scene),
+      m_planeScene(0)
 {
     setAttribute(Qt::WA_NoSystemBackground);
 }
@@ -20,12 +23,14 @@ GraphicsPlaneView::GraphicsPlaneView(QGraphicsScene *scene)
 void GraphicsPlaneView::paintEvent(QPaintEvent * event)
 {
     qDebug() << "GraphicsPlaneView::paintEvent " << event->region().boundingRect();
+    TRACE_INSTANT(Trace::Graphics, "view_paint");
     QGraphicsView::paintEvent(event);
 }
 
 bool GraphicsPlaneView::eventFilter(QObject* object, QEvent* event)
 {
     qDebug() << "GraphicsPlaneView::eventFilter " << event;
+    TRACE_INSTANT(Trace::Graphics, "view_event_filter");
 
     if (event->type() == QEvent::UpdateRequest) { return true; }
     if (event->type() == QEvent::Paint) { return true; }
@@ -38,6 +43,7 @@ bool GraphicsPlaneView::eventFilter(QObject* object, QEvent* event)
 bool GraphicsPlaneView::event(QEvent *event)
 {
     qDebug() << "GraphicsPlaneView::event " << event->type();
+    TRACE_INSTANT(Trace::Graphics, "view_event");
 
     if (event->type() == QEvent::Paint) { return true; }
 
@@ -46,9 +52,16 @@ bool GraphicsPlaneView::event(QEvent *event)
 
 void GraphicsPlaneView::mousePressEvent(QMouseEvent *event)
 {
+    TRACE_INSTANT(Trace::Input, "press");
+
     QGraphicsView::mousePressEvent(event);
-    if (!event->isAccepted())
-        emit clicked();
+    if (event->isAccepted())
+        return;
+
+    if (m_planeScene && m_planeScene->press(event->pos()))
+        return;
+
+    emit clicked();
 }
 
 void GraphicsPlaneView::keyPressEvent(QKeyEvent* k)
@@ -9,6 +9,8 @@
 
 #include <QGraphicsView>
 
+class PlaneScene;
+
 /**
  * @brief The GraphicsPlaneView class
  *
@@ -24,6 +26,14 @@ signals:
 public:
     GraphicsPlaneView(QGraphicsScene *scene);
 
+    /**
+     * @brief Deliver presses the QGraphicsScene did not take to plane items.
+     */
+    inline void setPlaneScene(PlaneScene* scene)
+    {
+        m_planeScene = scene;
+    }
+
     virtual bool eventFilter(QObject* object, QEvent* event) override;
 
     virtual ~GraphicsPlaneView();
@@ -34,6 +44,8 @@ protected:
     virtual void keyPressEvent(QKeyEvent* k) override;
     virtual void paintEvent (QPaintEvent * event) override;
     virtual bool event(QEvent *event) override;
+
+    PlaneScene* m_planeScene;
 };
 
 #endif // GRAPHICSPLANEVIEW_H
@@ -5,3 +5,222 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "graphicsspriteitem.h"
+#include "pixelkernels.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <algorithm>
+#include <cstring>
+
+int GraphicsSpriteItem::addSequence(const std::string& name, int x, int y, int width, int height,
+                                    int count, int duration)
+{
+    std::vector<Frame> frames;
+    for (int i = 0; i < count; i++)
+        frames.push_back({x + (i * width), y, width, height, 0, duration});
+
+    return addSequence(name, frames);
+}
+
+int GraphicsSpriteItem::addSequence(const std::string& name, const std::vector<Frame>& frames)
+{
+    if (frames.empty())
+        return -1;
+
+    Sequence s = {name, (int)m_frames.size(), (int)frames.size(), 0, 0, 0};
+
+    for (auto f: frames)
+    {
+        f.mirroredX = (m_sheetWidth * 2) - f.x - f.width;
+        m_frames.push_back(f);
+
+        s.width = std::max(s.width, f.width);
+        s.height = std::max(s.height, f.height);
+        s.duration += f.duration;
+    }
+
+    m_sequences.push_back(s);
+
+    int handle = m_sequences.size() - 1;
+    if (m_sequence < 0)
+    {
+        m_sequence = handle;
+        setFrame(0);
+    }
+
+    return handle;
+}
+
+std::vector<int> GraphicsSpriteItem::frameEnds(int handle) const
+{
+    std::vector<int> ends;
+    if (!valid(handle))
+        return ends;
+
+    const Sequence& s = m_sequences[handle];
+    int end = 0;
+    for (int i = 0; i < s.count; i++)
+    {
+        end += m_frames[s.first + i].duration;
+        ends.push_back(end);
+    }
+
+    return ends;
+}
+
+int GraphicsSpriteItem::sequence(const std::string& name) const
+{
+    for (size_t i = 0; i < m_sequences.size(); i++)
+        if (m_sequences[i].name == name)
+            return i;
+
+    return -1;
+}
+
+bool GraphicsSpriteItem::loadManifest(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "failed to open sprite manifest " << filename;
+        return false;
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (doc.isNull())
+    {
+        qDebug() << "failed to parse sprite manifest " << filename << error.errorString();
+        return false;
+    }
+
+    /*
+     * The sheet may not be loaded yet.
+     */
+    QJsonObject root = doc.object();
+    if (m_sheetWidth &&
+        (root["width"].toInt() != m_sheetWidth || root["height"].toInt() != m_sheetHeight))
+    {
+        qDebug() << "sprite manifest " << filename << " does not match the sheet";
+        return false;
+    }
+
+    for (const auto& i: root["sequences"].toArray())
+    {
+        QJsonObject sequence = i.toObject();
+
+        std::vector<Frame> frames;
+        for (const auto& j: sequence["frames"].toArray())
+        {
+            QJsonObject frame = j.toObject();
+            frames.push_back({frame["x"].toInt(), frame["y"].toInt(),
+                              frame["width"].toInt(), frame["height"].toInt(),
+                              0, frame["duration"].toInt()});
+        }
+
+        if (addSequence(sequence["name"].toString().toStdString(), frames) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+void GraphicsSpriteItem::setImage(const QImage& image)
+{
+    m_image = prepare(image);
+    m_sheetWidth = m_image.width();
+    m_sheetHeight = m_image.height();
+
+    if (m_mirrored)
+        m_image = mirroredSheet(m_image);
+
+    for (auto& f: m_frames)
+        f.mirroredX = (m_sheetWidth * 2) - f.x - f.width;
+
+    paint(0, 0, 0);
+    setFrame(m_frame);
+}
+
+QImage GraphicsSpriteItem::mirroredSheet(const QImage& image)
+{
+    QImage sheet(image.width() * 2, image.height(), QImage::Format_ARGB32_Premultiplied);
+    QImage source = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    for (int y = 0; y < source.height(); y++)
+    {
+        const uint32_t* from = reinterpret_cast<const uint32_t*>(source.constScanLine(y));
+        uint32_t* to = reinterpret_cast<uint32_t*>(sheet.scanLine(y));
+
+        memcpy(to, from, source.width() * sizeof(uint32_t));
+        PixelKernels::mirror(to + source.width(), from, source.width());
+    }
+
+    return sheet;
+}
+
+int GraphicsSpriteItem::reflection() const
+{
+    int supported = m_planes.reflections(m_plane);
+    int result = 0;
+
+    if (m_flipHorizontal && !m_mirrored)
+        result |= PlaneState::ReflectX;
+    if (m_flipVertical && (supported & PlaneState::ReflectY))
+        result |= PlaneState::ReflectY;
+
+    return result;
+}
+
+void GraphicsSpriteItem::setFlipHorizontal(bool flip)
+{
+    if (m_flipHorizontal == flip)
+        return;
+
+    m_flipHorizontal = flip;
+
+    if (m_mirrored)
+        setFrame(m_frame);
+    else
+        m_planes.setReflection(m_plane, reflection());
+}
+
+void GraphicsSpriteItem::setFlipVertical(bool flip)
+{
+    if (m_flipVertical == flip)
+        return;
+
+    m_flipVertical = flip;
+
+    if (m_planes.reflections(m_plane) & PlaneState::ReflectY)
+    {
+        m_planes.setReflection(m_plane, reflection());
+    }
+    else
+    {
+        /*
+         * Nothing to fall back on but redrawing the sheet upside down, or turning over what
+         * is in the plane once the sheet is gone.
+         */
+        if (m_image.isNull())
+            flipPlaneVertical();
+        else
+            paint(0, 0, 0);
+        setFrame(m_frame);
+    }
+}
+
+void GraphicsSpriteItem::flipPlaneVertical()
+{
+    QImage fb = wrapBuffer(m_plane, -1);
+    std::vector<uchar> line(fb.bytesPerLine());
+
+    for (int top = 0, bottom = fb.height() - 1; top < bottom; top++, bottom--)
+    {
+        memcpy(line.data(), fb.scanLine(top), line.size());
+        memcpy(fb.scanLine(top), fb.scanLine(bottom), line.size());
+        memcpy(fb.scanLine(bottom), line.data(), line.size());
+    }
+
+    m_planes.addUpload(m_plane, (qint64)fb.bytesPerLine() * fb.height());
+}
@@ -9,15 +9,16 @@
 
 #include "planemanager.h"
 #include "graphicsplaneitem.h"
+#include "memoryledger.h"
 
 #include <QObject>
 #include <QGraphicsItem>
-#include <QPixmap>
+#include <QImage>
 #include <QPainter>
 #include <QDebug>
 #include <QGraphicsSceneMouseEvent>
 #include <string>
-#include <map>
+#include <vector>
 
 /**
  * @brief The GraphicsSpriteItem class
@@ -25,6 +26,12 @@
  * An enhanced GraphicsPlaneItem that specifically handles sprite sheets
  * and animating any number of sequences in those sprite sheets using the
  * hardware plane pan functionality.
+ *
+ * Flipping the sprite never redraws the plane.  It uses the reflection of the display
+ * controller when there is one, and otherwise a mirrored copy of the sheet that is kept in the
+ * plane next to the original and selected by the pan offset.
+ *
+ * Once the sheet is in the plane it is dropped, unless setRetainContent() says otherwise.
  */
 class GraphicsSpriteItem : public GraphicsPlaneItem
 {
@@ -34,90 +41,222 @@ class GraphicsSpriteItem : public GraphicsPlaneItem
 
 public:
 
-    GraphicsSpriteItem(struct plane_data* plane, const QPixmap &image, int width, int height)
-        : GraphicsPlaneItem(plane, QRectF(0, 0, width, height)),
-          m_image(image),
+    GraphicsSpriteItem(PlaneManager& planes, struct plane_data* plane, const QImage &image,
+                       int width, int height)
+        : GraphicsPlaneItem(planes, plane, QRectF(0, 0, width, height)),
+          m_image(prepare(image)),
           m_frame(0),
           m_flipHorizontal(false),
-          m_flipVertical(false)
-    {}
+          m_flipVertical(false),
+          m_sheetWidth(m_image.width()),
+          m_sheetHeight(m_image.height()),
+          m_mirrored(false),
+          m_sequence(-1)
+    {
+        if (!(m_planes.reflections(m_plane) & PlaneState::ReflectX))
+        {
+            m_image = mirroredSheet(m_image);
+            m_mirrored = true;
+        }
+    }
 
-    struct sequence
+    /**
+     * @brief One frame of a sequence, as pan offsets into the plane.
+     */
+    struct Frame
     {
-        int m_x;
-        int m_y;
-        int m_width;
-        int m_height;
-        int m_count;
+        int x;
+        int y;
+        int width;
+        int height;
+        /** Pan x offset of the frame in the mirrored copy of the sheet. */
+        int mirroredX;
+        /** Milliseconds the frame is shown for. */
+        int duration;
     };
 
-    virtual void addSequence(const std::string& name, int x, int y, int width, int height, int count)
+    /**
+     * @brief A run of frames in the frame table.
+     */
+    struct Sequence
     {
-        m_sequences[name] = {x,y,width,height,count};
-        if (m_sequences.size() == 1)
-        {
-            m_sequence = name;
+        std::string name;
+        int first;
+        int count;
+        int width;
+        int height;
+        int duration;
+    };
 
-            plane_set_pan_pos(m_plane, x, y);
-            plane_set_pan_size(m_plane, width, height);
-            plane_apply(m_plane);
-        }
-    }
+    /**
+     * @brief Replace the sheet, for a sprite created before its sheet was loaded.
+     *
+     * Sequences are kept, so the new sheet must have the same layout.
+     */
+    void setImage(const QImage& image);
+
+    /**
+     * @brief Register a sequence of equally sized frames laid out left to right.
+     * @param duration Milliseconds each frame is shown for.
+     * @return Handle of the sequence.
+     */
+    int addSequence(const std::string& name, int x, int y, int width, int height, int count,
+                    int duration = 0);
+
+    /**
+     * @brief Register a sequence of arbitrary frames.
+     *
+     * Only the rectangle and duration of each frame are used.
+     *
+     * @return Handle of the sequence, or -1 if there are no frames.
+     */
+    int addSequence(const std::string& name, const std::vector<Frame>& frames);
 
-    virtual void setSequence(const std::string& name)
+    /**
+     * @brief Register all sequences from a sprite manifest.
+     *
+     * A manifest is a JSON file describing the sheet with its size and sequences, and every
+     * sequence with the rectangle and duration of each of its frames.
+     */
+    bool loadManifest(const QString& filename);
+
+    /**
+     * @brief Find the handle of a sequence.
+     *
+     * Meant to be called once, keep the handle around for anything that happens per frame.
+     *
+     * @return Handle of the sequence, or -1 if there is none by that name.
+     */
+    int sequence(const std::string& name) const;
+
+    virtual void setSequence(int handle)
     {
-        if (m_sequence != name)
+        if (handle >= 0 && handle < (int)m_sequences.size() && handle != m_sequence)
         {
-            m_sequence = name;
+            m_sequence = handle;
             m_frame = 0;
         }
     }
 
+    inline void setSequence(const std::string& name)
+    {
+        setSequence(sequence(name));
+    }
+
+    inline int currentSequence() const
+    {
+        return m_sequence;
+    }
+
     inline int currentFrame() const
     {
         return m_frame;
     }
 
-    inline int frameCount()
+    inline int frameCount() const
     {
-        return m_sequences[m_sequence].m_count;
+        return frameCount(m_sequence);
     }
 
-    inline int frameCount(const std::string& name)
+    inline int frameCount(int handle) const
     {
-        return m_sequences[name].m_count;
+        return valid(handle) ? m_sequences[handle].count : 0;
     }
 
-    inline int width()
+    inline int frameCount(const std::string& name) const
     {
-        return m_sequences[m_sequence].m_width;
+        return frameCount(sequence(name));
     }
 
-    inline int width(const std::string& name)
+    /**
+     * @brief Width of the widest frame of a sequence.
+     */
+    inline int width() const
     {
-        return m_sequences[name].m_width;
+        return width(m_sequence);
     }
 
-    inline int height()
+    inline int width(int handle) const
     {
-        return m_sequences[m_sequence].m_height;
+        return valid(handle) ? m_sequences[handle].width : 0;
     }
 
-    inline int height(const std::string& name)
+    inline int width(const std::string& name) const
     {
-        return m_sequences[name].m_height;
+        return width(sequence(name));
     }
 
+    /**
+     * @brief Height of the tallest frame of a sequence.
+     */
+    inline int height() const
+    {
+        return height(m_sequence);
+    }
+
+    inline int height(int handle) const
+    {
+        return valid(handle) ? m_sequences[handle].height : 0;
+    }
+
+    inline int height(const std::string& name) const
+    {
+        return height(sequence(name));
+    }
+
+    /**
+     * @brief Milliseconds of all frames of a sequence together.
+     */
+    inline int duration(int handle) const
+    {
+        return valid(handle) ? m_sequences[handle].duration : 0;
+    }
+
+    /**
+     * @brief Milliseconds from the start of a sequence to the end of each of its frames.
+     *
+     * Frames are not all shown for the same time, so playback looks the frame up by the time
+     * into the sequence in this table instead of spacing them evenly.
+     */
+    std::vector<int> frameEnds(int handle) const;
+
     inline void toggleFlipHorizontal()
     {
-        m_flipHorizontal = !m_flipHorizontal;
+        setFlipHorizontal(!m_flipHorizontal);
+    }
+
+    void setFlipHorizontal(bool flip);
+
+    void setFlipVertical(bool flip);
+
+    inline bool flipHorizontal() const
+    {
+        return m_flipHorizontal;
+    }
+
+    inline bool flipVertical() const
+    {
+        return m_flipVertical;
+    }
+
+    virtual QImage* content() override
+    {
+        if (softwareFlipVertical())
+            return 0;
+
+        return &m_image;
+    }
+
+    virtual qint64 contentBytes() const override
+    {
+        return MemoryLedger::bytes(m_image);
     }
 
     virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override
     {
         qDebug() << "Sprite::paint";
 
-        draw(m_plane, m_image.toImage(), m_flipHorizontal, m_flipVertical);
+        draw(m_plane, m_image, false, softwareFlipVertical());
 
         Q_UNUSED(painter);
         Q_UNUSED(option);
@@ -130,6 +269,16 @@ public:
         event->ignore();
     }
 
+    /**
+     * Same as mousePressEvent(), the press also goes on to whatever is below.
+     */
+    virtual bool pressEvent(const QPoint& pos) override
+    {
+        Q_UNUSED(pos);
+        emit clicked();
+        return false;
+    }
+
     virtual ~GraphicsSpriteItem()
     {}
 
@@ -141,26 +290,74 @@ public slots:
 
     virtual void setFrame(int frame)
     {
+        if (!valid(m_sequence) || frame < 0 || frame >= m_sequences[m_sequence].count)
+            return;
+
         m_frame = frame;
 
-        plane_set_pan_pos(m_plane,
-                          m_sequences[m_sequence].m_x + (m_frame * m_sequences[m_sequence].m_width),
-                          m_sequences[m_sequence].m_y);
-        plane_set_pan_size(m_plane,
-                           m_sequences[m_sequence].m_width,
-                           m_sequences[m_sequence].m_height);
-        plane_apply(m_plane);
+        const Frame& f = m_frames[m_sequences[m_sequence].first + frame];
+
+        /*
+         * The mirrored sheet is to the right of the original, so a frame is found at the
+         * mirrored position in there.
+         */
+        int x = m_flipHorizontal && m_mirrored ? f.mirroredX : f.x;
+        int y = softwareFlipVertical() ? m_sheetHeight - f.y - f.height : f.y;
+
+        /*
+         * Frames of a sequence are usually the same size, the manager drops the write when
+         * it is the same as what is already on the plane.
+         */
+        m_planes.setPanPos(m_plane, x, y);
+        m_planes.setPanSize(m_plane, f.width, f.height);
     }
 
 protected:
 
-    QPixmap m_image;
+    /**
+     * @brief Vertical flips are drawn in software when the hardware can not do them.
+     */
+    inline bool softwareFlipVertical() const
+    {
+        return m_flipVertical && !(m_planes.reflections(m_plane) & PlaneState::ReflectY);
+    }
+
+    int reflection() const;
+
+    virtual void releaseContent() override
+    {
+        m_image = QImage();
+    }
+
+    /**
+     * @brief Turn the sheet in the plane upside down, for when the sheet is no longer kept.
+     */
+    void flipPlaneVertical();
+
+    inline bool valid(int handle) const
+    {
+        return handle >= 0 && handle < (int)m_sequences.size();
+    }
+
+    /**
+     * @brief Return the sheet with a mirrored copy of it appended to the right.
+     */
+    static QImage mirroredSheet(const QImage& image);
+
+    QImage m_image;
     int m_speed;
     int m_frame;
     bool m_flipHorizontal;
     bool m_flipVertical;
-    std::map<std::string, sequence> m_sequences;
-    std::string m_sequence;
+    /** Width of the original sheet, without any mirrored copy. */
+    int m_sheetWidth;
+    int m_sheetHeight;
+    /** True if m_image holds the mirrored copy of the sheet. */
+    bool m_mirrored;
+    /** Frames of all sequences, each sequence is a contiguous run. */
+    std::vector<Frame> m_frames;
+    std::vector<Sequence> m_sequences;
+    int m_sequence;
 };
 
 #endif // GRAPHICSSPRITEITEM_H
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "graphicsstreamlayeritem.h"
+#include "pixelkernels.h"
+#include "trace.h"
+#include <QPainter>
+#include <QtConcurrent>
+#include <cstring>
+
+GraphicsStreamLayerItem::GraphicsStreamLayerItem(PlaneManager& planes, struct plane_data* plane,
+                                                 TileSource source, int length, int tileWidth,
+                                                 int width, int height, int speed)
+    : GraphicsLayerItem(planes, plane, QImage(), width, height, speed),
+      m_source(source),
+      m_length(qMax(0, length)),
+      m_tileWidth(qMax(1, tileWidth)),
+      m_slots((width + m_tileWidth - 1) / m_tileWidth + 2),
+      m_span(m_length ? m_slots * m_length : m_slots << 20),
+      m_resident(m_slots, -1),
+      m_prefetchTile(-1),
+      m_loaded(0)
+{
+    m_bounding = QRectF(0, 0, width, height);
+
+    /*
+     * The window spans up to ceil(width / tileWidth) + 1 tiles, and the tile ahead has to go
+     * into a slot none of them use.  The window can start anywhere in the ring, so the copy
+     * of its start is a whole window wide.
+     */
+    if (!m_planes.reallocate(m_plane, m_slots * m_tileWidth + width, height))
+        qFatal("failed to allocate stream layer plane");
+
+    QImage fb = wrapBuffer(m_plane, -1);
+    fb.fill(Qt::transparent);
+}
+
+GraphicsStreamLayerItem::TileSource GraphicsStreamLayerItem::tiles(const QImage& image,
+                                                                  int tileWidth, int period)
+{
+    QImage source = prepare(image);
+    if (period <= 0 || period > source.width())
+        period = source.width();
+
+    return [source, tileWidth, period](int index) {
+        if (!period)
+            return QImage();
+
+        int x = ((qint64)index * tileWidth) % period;
+        if (x + tileWidth <= period)
+            return source.copy(x, 0, tileWidth, source.height());
+
+        /*
+         * The tile runs over the end of the period and continues at its start.
+         */
+        QImage tile(tileWidth, source.height(), source.format());
+        QPainter painter(&tile);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        for (int filled = 0; filled < tileWidth; x = 0)
+        {
+            int w = qMin(tileWidth - filled, period - x);
+            painter.drawImage(filled, 0, source, x, 0, w, source.height());
+            filled += w;
+        }
+
+        return tile;
+    };
+}
+
+void GraphicsStreamLayerItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    std::fill(m_resident.begin(), m_resident.end(), -1);
+    updatePan();
+
+    Q_UNUSED(painter);
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+}
+
+void GraphicsStreamLayerItem::updatePan()
+{
+    const int ring = m_slots * m_tileWidth;
+
+    qint64 x = (m_position + (1 << (FIXED_SHIFT - 1))) >> FIXED_SHIFT;
+    if (x >= (qint64)m_span * m_tileWidth)
+        x -= (qint64)m_span * m_tileWidth;
+
+    /*
+     * Tiles normally come from the prefetch.  The ones in the window are only missing after
+     * a paint() or when the layer turns around.
+     */
+    int first = x / m_tileWidth;
+    int last = (x + m_width - 1) / m_tileWidth;
+    int ahead = m_speed < 0 ? first - 1 : last + 1;
+
+    for (int tile = first; tile <= last; tile++)
+        load(tile);
+    load(ahead);
+    prefetch(m_speed < 0 ? ahead - 1 : ahead + 1);
+
+    m_planes.setPanPos(m_plane, x % ring, 0);
+}
+
+void GraphicsStreamLayerItem::load(int tile)
+{
+    tile = wrapTile(tile);
+    int slot = tile % m_slots;
+    if (m_resident[slot] == tile)
+        return;
+
+    TRACE_SCOPE(Trace::Assets, "stream_tile");
+
+    QImage image;
+    if (m_prefetchTile == tile)
+    {
+        image = m_prefetch.result();
+        m_prefetchTile = -1;
+    }
+    else
+    {
+        image = prepare(m_source(m_length ? tile % m_length : tile));
+    }
+
+    QImage fb = wrapBuffer(m_plane, -1);
+    int x = slot * m_tileWidth;
+    write(fb, image, x);
+    if (x < m_width)
+        write(fb, image, x + m_slots * m_tileWidth);
+
+    m_resident[slot] = tile;
+    m_loaded++;
+}
+
+void GraphicsStreamLayerItem::prefetch(int tile)
+{
+    tile = wrapTile(tile);
+    if (m_resident[tile % m_slots] == tile || m_prefetchTile == tile)
+        return;
+
+    /*
+     * A prefetch that is no longer wanted is left to finish on its own.
+     */
+    TileSource source = m_source;
+    int index = m_length ? tile % m_length : tile;
+    m_prefetch = QtConcurrent::run([source, index]() {
+        return prepare(source(index));
+    });
+    m_prefetchTile = tile;
+}
+
+void GraphicsStreamLayerItem::write(QImage& fb, const QImage& image, int x)
+{
+    QRect target = QRect(x, 0, m_tileWidth, m_height) & fb.rect();
+    if (target.isEmpty())
+        return;
+
+    m_planes.addUpload(m_plane, (qint64)target.width() * target.height() * fb.depth() / 8);
+
+    bool covered = image.width() >= target.width() && image.height() >= target.height();
+
+    if (image.format() == fb.format() && covered)
+    {
+        int bpp = fb.depth() / 8;
+        for (int y = 0; y < target.height(); y++)
+            memcpy(fb.scanLine(y) + x * bpp, image.constScanLine(y), target.width() * bpp);
+    }
+    else if ((fb.format() == QImage::Format_RGB16 ||
+              fb.format() == QImage::Format_ARGB4444_Premultiplied) &&
+             image.format() == QImage::Format_ARGB32_Premultiplied && covered)
+    {
+        /*
+         * The dither pattern follows the ring, so the copy of its start matches the original.
+         */
+        auto convert = fb.format() == QImage::Format_RGB16 ?
+            PixelKernels::toRgb565Dithered : PixelKernels::toArgb4444Dithered;
+        for (int y = 0; y < target.height(); y++)
+            convert(reinterpret_cast<uint16_t*>(fb.scanLine(y)) + x,
+                    reinterpret_cast<const uint32_t*>(image.constScanLine(y)),
+                    target.width(), x % (m_slots * m_tileWidth), y);
+    }
+    else
+    {
+        /*
+         * Whatever the tile does not cover is left transparent.
+         */
+        QPainter painter(&fb);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.fillRect(target, Qt::transparent);
+        if (!image.isNull())
+            painter.drawImage(target.topLeft(), image,
+                              QRect(0, 0, target.width(), target.height()));
+        painter.end();
+    }
+}
+
+GraphicsStreamLayerItem::~GraphicsStreamLayerItem()
+{
+    m_prefetch.waitForFinished();
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef GRAPHICSSTREAMLAYERITEM_H
+#define GRAPHICSSTREAMLAYERITEM_H
+
+#include "graphicslayeritem.h"
+#include <QFuture>
+#include <QImage>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The GraphicsStreamLayerItem class
+ *
+ * A GraphicsLayerItem that streams its image in as tiles, so the layer can be any length,
+ * or generated as it scrolls, in a plane of fixed size.
+ *
+ * The plane holds a ring of tiles a little wider than the pan window, followed by a copy of
+ * the first pan window width of the ring, so the pan window never has to wrap around the end
+ * of the framebuffer.  Nothing else of the layer is kept in memory.  That makes the plane
+ * (ceil(width / tileWidth) + 2) * tileWidth + width wide, more than twice the pan window,
+ * so it only saves memory over a GraphicsLayerItem for layers longer than that.
+ *
+ * Tiles are written when the pan window is about to reach them, and only ever into parts of
+ * the plane that are not shown, so the plane needs no back buffers.  The next tile is decoded
+ * on the global thread pool while the current one scrolls into view.
+ */
+class GraphicsStreamLayerItem : public GraphicsLayerItem
+{
+public:
+
+    /**
+     * @brief Makes tile index of the layer, tileWidth by height pixels.
+     *
+     * Called from the global thread pool, so it must not touch anything the GUI thread uses.
+     */
+    typedef std::function<QImage(int index)> TileSource;
+
+    /**
+     * @param length Number of tiles before the layer starts over, 0 for endless.
+     * @param width Width of the pan window.
+     * @param speed Pixels per second, negative to scroll the other way.
+     */
+    GraphicsStreamLayerItem(PlaneManager& planes, struct plane_data* plane, TileSource source,
+                            int length, int tileWidth, int width, int height, int speed);
+
+    /**
+     * @brief A source that cuts tiles out of an image.
+     *
+     * The image stays in memory, this is for layers that are already loaded whole.
+     *
+     * @param period Width the image repeats at, the whole image if 0.
+     */
+    static TileSource tiles(const QImage& image, int tileWidth, int period = 0);
+
+    inline int tileWidth() const
+    {
+        return m_tileWidth;
+    }
+
+    /**
+     * @brief Tiles written to the plane so far.
+     */
+    inline int tilesLoaded() const
+    {
+        return m_loaded;
+    }
+
+    virtual void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+    virtual QImage* content() override
+    {
+        return 0;
+    }
+
+    virtual qint64 contentBytes() const override
+    {
+        return m_prefetchTile >= 0 && m_prefetch.isFinished() ?
+            MemoryLedger::bytes(m_prefetch.result()) : 0;
+    }
+
+    virtual ~GraphicsStreamLayerItem();
+
+protected:
+
+    virtual qint64 wrap() const override
+    {
+        return (qint64)m_span * m_tileWidth << FIXED_SHIFT;
+    }
+
+    virtual void updatePan() override;
+
+    void load(int tile);
+    void prefetch(int tile);
+    void write(QImage& fb, const QImage& image, int x);
+
+    inline int wrapTile(int tile) const
+    {
+        tile %= m_span;
+        return tile < 0 ? tile + m_span : tile;
+    }
+
+    TileSource m_source;
+    int m_length;
+    int m_tileWidth;
+    /** Tiles in the ring. */
+    int m_slots;
+    /** Tiles the position wraps around at, a multiple of both the ring and the length. */
+    int m_span;
+    /** Tile in each slot of the ring, -1 for none. */
+    std::vector<int> m_resident;
+    QFuture<QImage> m_prefetch;
+    int m_prefetchTile;
+    int m_loaded;
+};
+
+#endif // GRAPHICSSTREAMLAYERITEM_H
@@ -0,0 +1,583 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "kmsplanebackend.h"
+#include <planes/engine.h>
+#include <planes/kms.h>
+#include <QApplication>
+#include <QDebug>
+#include <qpa/qplatformnativeinterface.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <cstring>
+
+/**
+ * @brief This requires a custom version of Qt to work with a patch for getting the DRI
+ * file descriptor used internally by the linuxfb backend configured in DRM mode.
+ */
+static int get_dri_fd()
+{
+    static int dri_fd = -1;
+    if (dri_fd == -1)
+    {
+        void *p = reinterpret_cast<QApplication*>(QApplication::instance())->
+                platformNativeInterface()->nativeResourceForIntegration("dri_fd");
+        if (p)
+            dri_fd = (int)(qintptr)p;
+    }
+    return dri_fd;
+}
+
+/*
+ * Order matters, this is the order of KmsPlane::ids.
+ */
+static const char* const atomic_props[] =
+{
+    "CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H",
+    "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+    "FB_ID", "CRTC_ID",
+    "rotation", "alpha",
+};
+
+enum
+{
+    PROP_CRTC_X, PROP_CRTC_Y, PROP_CRTC_W, PROP_CRTC_H,
+    PROP_SRC_X, PROP_SRC_Y, PROP_SRC_W, PROP_SRC_H,
+    /** Properties past this point are only written for planes that flip. */
+    PROP_FB_ID, PROP_CRTC_ID,
+    /** Only written once they have been set. */
+    PROP_ROTATION, PROP_ALPHA,
+    PROP_COUNT
+};
+
+KmsPlaneBackend::KmsPlaneBackend()
+    : m_atomic(false)
+{
+}
+
+bool KmsPlaneBackend::load(const std::string& configfile, std::vector<plane_data*>& planes)
+{
+    int fd = get_dri_fd();
+    if (fd < 0)
+    {
+        qDebug() << "No dri fd available from platform";
+        return false;
+    }
+    else
+    {
+        qDebug() << "dri fd = " << fd;
+    }
+
+    m_device.reset(kms_device_open(fd));
+    if (!m_device)
+        return false;
+
+    m_planes.resize(m_device->num_planes, 0);
+
+    if (engine_load_config(configfile.c_str(), m_device.get(), m_planes.data(), m_planes.size(), 0))
+        return false;
+
+    m_atomic = drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1) == 0;
+    qDebug() << "atomic commits " << m_atomic;
+
+    m_kms.clear();
+    for (auto i: m_planes)
+    {
+        if (!i)
+            continue;
+
+        KmsPlane kms;
+        kms.plane = i;
+        memset(kms.ids, 0, sizeof(kms.ids));
+        kms.rotate0 = 0;
+        kms.reflectX = 0;
+        kms.reflectY = 0;
+        kms.alphaMax = 0;
+        if (m_atomic)
+            lookupProperties(kms);
+        lookupFormats(kms);
+        m_kms.push_back(kms);
+    }
+
+    planes = m_planes;
+
+    return true;
+}
+
+void KmsPlaneBackend::lookupProperties(KmsPlane& kms)
+{
+    drmModeObjectProperties* objprops = drmModeObjectGetProperties(m_device->fd,
+                                                                   kms.plane->plane->id,
+                                                                   DRM_MODE_OBJECT_PLANE);
+    if (!objprops)
+        return;
+
+    for (uint32_t i = 0; i < objprops->count_props; i++)
+    {
+        drmModePropertyRes* prop = drmModeGetProperty(m_device->fd, objprops->props[i]);
+        if (!prop)
+            continue;
+
+        for (int p = 0; p < PROP_COUNT; p++)
+            if (!strcmp(prop->name, atomic_props[p]))
+                kms.ids[p] = prop->prop_id;
+
+        /*
+         * alpha is a range, opaque at its maximum.
+         */
+        if (!strcmp(prop->name, "alpha") && (prop->flags & DRM_MODE_PROP_RANGE) &&
+            prop->count_values == 2)
+            kms.alphaMax = prop->values[1];
+
+        /*
+         * rotation is a bitmask property, and each of its enum values is the index of a bit.
+         */
+        if (!strcmp(prop->name, "rotation") && (prop->flags & DRM_MODE_PROP_BITMASK))
+        {
+            for (int e = 0; e < prop->count_enums; e++)
+            {
+                uint64_t bit = 1ULL << prop->enums[e].value;
+                if (!strcmp(prop->enums[e].name, "rotate-0"))
+                    kms.rotate0 = bit;
+                else if (!strcmp(prop->enums[e].name, "reflect-x"))
+                    kms.reflectX = bit;
+                else if (!strcmp(prop->enums[e].name, "reflect-y"))
+                    kms.reflectY = bit;
+            }
+        }
+
+        drmModeFreeProperty(prop);
+    }
+
+    drmModeFreeObjectProperties(objprops);
+}
+
+void KmsPlaneBackend::lookupFormats(KmsPlane& kms)
+{
+    drmModePlane* plane = drmModeGetPlane(m_device->fd, kms.plane->plane->id);
+    if (!plane)
+        return;
+
+    /*
+     * Only formats there is a QImage format to draw into are of any use.
+     */
+    for (uint32_t i = 0; i < plane->count_formats; i++)
+        if (formatImageFormat(plane->formats[i]) != QImage::Format_Invalid)
+            kms.formats.push_back(plane->formats[i]);
+
+    drmModeFreePlane(plane);
+}
+
+KmsPlaneBackend::KmsPlane* KmsPlaneBackend::find(struct plane_data* plane)
+{
+    for (auto& i: m_kms)
+        if (i.plane == plane)
+            return &i;
+
+    return 0;
+}
+
+const KmsPlaneBackend::KmsPlane* KmsPlaneBackend::find(struct plane_data* plane) const
+{
+    for (auto& i: m_kms)
+        if (i.plane == plane)
+            return &i;
+
+    return 0;
+}
+
+std::string KmsPlaneBackend::name(struct plane_data* plane) const
+{
+    return plane->name;
+}
+
+int KmsPlaneBackend::commit(std::vector<PlaneUpdate>& updates)
+{
+    std::vector<PlaneUpdate*> atomic;
+    int commits = 0;
+
+    for (auto& u: updates)
+    {
+        /*
+         * The display controller scans out of the framebuffer memory, so content written in
+         * place is already on its way to the screen and there is nothing to program.
+         */
+        if (u.dirty == PlaneUpdate::DirtyContent)
+        {
+            u.applied = true;
+            continue;
+        }
+
+        /*
+         * Keep libplanes in sync with the shadow state so plane_apply() always sees the
+         * complete picture.
+         */
+        if (u.dirty & PlaneUpdate::DirtyPos)
+            plane_set_pos(u.plane, u.state.x, u.state.y);
+        if (u.dirty & PlaneUpdate::DirtyScale)
+            plane_set_scale(u.plane, u.state.scale);
+        if (u.dirty & PlaneUpdate::DirtyPanPos)
+            plane_set_pan_pos(u.plane, u.state.pan_x, u.state.pan_y);
+        if (u.dirty & PlaneUpdate::DirtyPanSize)
+            plane_set_pan_size(u.plane, u.state.pan_width, u.state.pan_height);
+
+        /*
+         * Planes that flip are never handed to plane_apply(), it only knows about the
+         * framebuffer libplanes allocated.
+         */
+        const KmsPlane* kms = find(u.plane);
+        bool flips = kms && !kms->fbs.empty();
+
+        /*
+         * plane_apply() does not know about reflection or alpha either.  A plane with either
+         * of them set goes out whole in the atomic commit instead, so it is programmed once,
+         * and only counts as applied once that commit got through.
+         */
+        bool properties = u.state.reflection >= 0 || u.state.alpha >= 0;
+
+        if (m_atomic && (flips || properties || !(u.dirty & PlaneUpdate::DirtyFull)))
+        {
+            atomic.push_back(&u);
+        }
+        else if (!plane_apply(u.plane))
+        {
+            commits++;
+            u.applied = true;
+        }
+    }
+
+    if (!atomic.empty() && commitAtomic(atomic))
+    {
+        commits++;
+        for (auto u: atomic)
+            u->applied = true;
+    }
+
+    return commits;
+}
+
+bool KmsPlaneBackend::commitAtomic(std::vector<PlaneUpdate*>& updates)
+{
+    drmModeAtomicReq* req = drmModeAtomicAlloc();
+    if (!req)
+        return false;
+
+    uint32_t flags = DRM_MODE_ATOMIC_NONBLOCK;
+
+    for (auto u: updates)
+    {
+        const KmsPlane* kms = find(u->plane);
+        if (!kms)
+            continue;
+
+        const PlaneState& state = u->state;
+        double scale = state.scale > 0 ? state.scale : 1.0;
+        int x = state.x != INT_MIN ? state.x : 0;
+        int y = state.y != INT_MIN ? state.y : 0;
+        int src_x = state.pan_x != INT_MIN ? state.pan_x : 0;
+        int src_y = state.pan_y != INT_MIN ? state.pan_y : 0;
+        int src_w = state.pan_width > 0 ? state.pan_width : width(u->plane);
+        int src_h = state.pan_height > 0 ? state.pan_height : height(u->plane);
+
+        const uint64_t values[PROP_FB_ID] =
+        {
+            (uint64_t)x, (uint64_t)y,
+            (uint64_t)(src_w * scale), (uint64_t)(src_h * scale),
+            (uint64_t)src_x << 16, (uint64_t)src_y << 16,
+            (uint64_t)src_w << 16, (uint64_t)src_h << 16,
+        };
+
+        for (int p = 0; p < PROP_FB_ID; p++)
+            if (kms->ids[p])
+                drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[p], values[p]);
+
+        if (kms->ids[PROP_ROTATION] && kms->rotate0 && state.reflection >= 0)
+        {
+            uint64_t rotation = kms->rotate0;
+            if (state.reflection & PlaneState::ReflectX)
+                rotation |= kms->reflectX;
+            if (state.reflection & PlaneState::ReflectY)
+                rotation |= kms->reflectY;
+
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_ROTATION], rotation);
+        }
+
+        if (kms->ids[PROP_ALPHA] && kms->alphaMax && state.alpha >= 0)
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_ALPHA],
+                                     (uint64_t)state.alpha * kms->alphaMax / 255);
+
+        if (!kms->fbs.empty())
+        {
+            int buffer = state.buffer >= 0 && state.buffer < (int)kms->fbs.size() ?
+                        state.buffer : kms->ring.front;
+
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_FB_ID],
+                                     kms->fbs[buffer]->id);
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_CRTC_ID],
+                                     u->plane->plane->crtc->id);
+
+            if (u->dirty & PlaneUpdate::DirtyBuffer)
+                flags |= DRM_MODE_PAGE_FLIP_EVENT;
+        }
+        else if (u->dirty & PlaneUpdate::DirtyFull)
+        {
+            /*
+             * A full update that skipped plane_apply() has to put the framebuffer of libplanes
+             * on the plane itself.
+             */
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_FB_ID],
+                                     u->plane->fbs[0]->id);
+            drmModeAtomicAddProperty(req, u->plane->plane->id, kms->ids[PROP_CRTC_ID],
+                                     u->plane->plane->crtc->id);
+        }
+    }
+
+    /*
+     * Non-blocking so the GUI thread never waits on a vblank here.  If the previous commit
+     * is still in flight the planes stay dirty and go out with the next frame.
+     */
+    int ret = drmModeAtomicCommit(m_device->fd, req, flags, static_cast<PlaneBackend*>(this));
+    drmModeAtomicFree(req);
+
+    if (ret)
+    {
+        qDebug() << "atomic commit failed " << ret;
+        return false;
+    }
+
+    for (auto u: updates)
+    {
+        KmsPlane* kms = find(u->plane);
+        if (kms && (u->dirty & PlaneUpdate::DirtyBuffer))
+            kms->ring.queue(u->state.buffer);
+    }
+
+    return true;
+}
+
+int KmsPlaneBackend::reflections(struct plane_data* plane) const
+{
+    const KmsPlane* kms = find(plane);
+    if (!kms || !m_atomic || !kms->ids[PROP_ROTATION] || !kms->rotate0)
+        return 0;
+
+    int result = 0;
+    if (kms->reflectX)
+        result |= PlaneState::ReflectX;
+    if (kms->reflectY)
+        result |= PlaneState::ReflectY;
+
+    return result;
+}
+
+bool KmsPlaneBackend::hasAlpha(struct plane_data* plane) const
+{
+    const KmsPlane* kms = find(plane);
+    return kms && m_atomic && kms->ids[PROP_ALPHA] && kms->alphaMax;
+}
+
+void* KmsPlaneBackend::map(struct plane_data* plane)
+{
+    KmsPlane* kms = find(plane);
+    if (kms && !kms->fbs.empty())
+        return kms->ptrs[kms->ring.front];
+
+    plane_fb_map(plane);
+    return plane->bufs[0];
+}
+
+bool KmsPlaneBackend::reallocate(struct plane_data* plane, int width, int height, uint32_t format)
+{
+    if (plane_fb_reallocate(plane, width, height, format))
+        return false;
+
+    KmsPlane* kms = find(plane);
+    if (kms && !kms->fbs.empty())
+        return createBuffers(*kms, kms->fbs.size(), width, height, format, false);
+
+    return true;
+}
+
+bool KmsPlaneBackend::createBuffers(KmsPlane& kms, int count, int width, int height, uint32_t format,
+                                    bool keep)
+{
+    std::vector<struct kms_framebuffer*> fbs;
+    std::vector<void*> ptrs;
+    for (int i = 0; i < count; i++)
+    {
+        struct kms_framebuffer* fb = kms_framebuffer_create(m_device.get(), width, height, format);
+        void* ptr = 0;
+        if (!fb || kms_framebuffer_map(fb, &ptr))
+        {
+            if (fb)
+                kms_framebuffer_free(fb);
+            for (auto f: fbs)
+            {
+                kms_framebuffer_unmap(f);
+                kms_framebuffer_free(f);
+            }
+            return false;
+        }
+
+        fbs.push_back(fb);
+        ptrs.push_back(ptr);
+    }
+
+    /*
+     * Items drop their content once it is drawn, so whatever is shown now is copied into
+     * every new framebuffer instead of being lost with the first flip.
+     */
+    const uchar* shown = keep ? static_cast<const uchar*>(map(kms.plane)) : 0;
+    int shownPitch = pitch(kms.plane);
+    for (size_t i = 0; i < fbs.size(); i++)
+    {
+        uchar* bits = static_cast<uchar*>(ptrs[i]);
+        if (!shown)
+        {
+            memset(bits, 0, fbs[i]->pitch * height);
+            continue;
+        }
+
+        int bytes = qMin<int>(shownPitch, fbs[i]->pitch);
+        for (int y = 0; y < height; y++)
+            memcpy(bits + y * fbs[i]->pitch, shown + y * shownPitch, bytes);
+    }
+
+    freeBuffers(kms);
+    kms.fbs = fbs;
+    kms.ptrs = ptrs;
+    kms.ring.count = count;
+
+    return true;
+}
+
+void KmsPlaneBackend::freeBuffers(KmsPlane& kms)
+{
+    for (auto fb: kms.fbs)
+    {
+        kms_framebuffer_unmap(fb);
+        kms_framebuffer_free(fb);
+    }
+
+    kms.fbs.clear();
+    kms.ptrs.clear();
+    kms.ring = BufferRing();
+}
+
+bool KmsPlaneBackend::setBufferCount(struct plane_data* plane, int count)
+{
+    KmsPlane* kms = find(plane);
+    if (!kms || count < 1 || count > 3)
+        return false;
+
+    if (count == 1)
+    {
+        freeBuffers(*kms);
+        return true;
+    }
+
+    /*
+     * Flipping is done by changing FB_ID in an atomic commit, there is no legacy fallback.
+     */
+    if (!m_atomic || !kms->ids[PROP_FB_ID] || !kms->ids[PROP_CRTC_ID])
+        return false;
+
+    return createBuffers(*kms, count, plane_width(plane), plane_height(plane), plane_format(plane),
+                         true);
+}
+
+int KmsPlaneBackend::bufferCount(struct plane_data* plane) const
+{
+    const KmsPlane* kms = find(plane);
+    return kms && !kms->fbs.empty() ? kms->fbs.size() : 1;
+}
+
+int KmsPlaneBackend::acquireBuffer(struct plane_data* plane)
+{
+    KmsPlane* kms = find(plane);
+    if (!kms || kms->fbs.empty())
+        return -1;
+
+    return kms->ring.acquire();
+}
+
+void KmsPlaneBackend::releaseBuffer(struct plane_data* plane, int index)
+{
+    KmsPlane* kms = find(plane);
+    if (kms)
+        kms->ring.release(index);
+}
+
+void* KmsPlaneBackend::mapBuffer(struct plane_data* plane, int index)
+{
+    KmsPlane* kms = find(plane);
+    if (!kms || index < 0 || index >= (int)kms->ptrs.size())
+        return 0;
+
+    return kms->ptrs[index];
+}
+
+void KmsPlaneBackend::flipped()
+{
+    for (auto& i: m_kms)
+        i.ring.flipped();
+}
+
+int KmsPlaneBackend::width(struct plane_data* plane) const
+{
+    return plane_width(plane);
+}
+
+int KmsPlaneBackend::height(struct plane_data* plane) const
+{
+    return plane_height(plane);
+}
+
+uint32_t KmsPlaneBackend::format(struct plane_data* plane) const
+{
+    return plane_format(plane);
+}
+
+std::vector<uint32_t> KmsPlaneBackend::formats(struct plane_data* plane) const
+{
+    const KmsPlane* kms = find(plane);
+    if (!kms || kms->formats.empty())
+        return PlaneBackend::formats(plane);
+
+    return kms->formats;
+}
+
+int KmsPlaneBackend::pitch(struct plane_data* plane) const
+{
+    const KmsPlane* kms = find(plane);
+    if (kms && !kms->fbs.empty())
+        return kms->fbs[0]->pitch;
+
+    return plane_width(plane) * formatBytesPerPixel(plane_format(plane));
+}
+
+int KmsPlaneBackend::fd() const
+{
+    return m_device ? m_device->fd : -1;
+}
+
+void KmsPlaneBackend::step()
+{
+    engine_run_once(m_device.get(), m_planes.data(), m_planes.size(), 0);
+}
+
+KmsPlaneBackend::~KmsPlaneBackend()
+{
+    for (auto& i: m_kms)
+        freeBuffers(i);
+
+    for (auto i: m_planes)
+        if (i)
+            free(i);
+
+    if (m_device)
+        kms_device_close(m_device.get());
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef KMSPLANEBACKEND_H
+#define KMSPLANEBACKEND_H
+
+#include "planebackend.h"
+#include <memory>
+
+/**
+ * @brief The KmsPlaneBackend class
+ *
+ * Planes on real hardware using libplanes and KMS.
+ *
+ * Planes are configured by libplanes from the config file.  Once a plane has been applied the
+ * first time, geometry updates for all planes are pushed in a single atomic commit when the
+ * driver supports it.
+ *
+ * Planes that flip between several framebuffers need atomic support.  Their framebuffers are
+ * created by the backend, and a flip is just a new FB_ID in the next commit, which the
+ * hardware picks up on vblank.
+ */
+class KmsPlaneBackend : public PlaneBackend
+{
+public:
+
+    KmsPlaneBackend();
+
+    virtual bool load(const std::string& configfile, std::vector<plane_data*>& planes) override;
+    virtual std::string name(struct plane_data* plane) const override;
+    virtual int commit(std::vector<PlaneUpdate>& updates) override;
+    virtual void* map(struct plane_data* plane) override;
+    virtual bool reallocate(struct plane_data* plane, int width, int height, uint32_t format) override;
+    virtual int width(struct plane_data* plane) const override;
+    virtual int height(struct plane_data* plane) const override;
+    virtual uint32_t format(struct plane_data* plane) const override;
+    virtual std::vector<uint32_t> formats(struct plane_data* plane) const override;
+    virtual int pitch(struct plane_data* plane) const override;
+    virtual bool setBufferCount(struct plane_data* plane, int count) override;
+    virtual int bufferCount(struct plane_data* plane) const override;
+    virtual int acquireBuffer(struct plane_data* plane) override;
+    virtual void releaseBuffer(struct plane_data* plane, int index) override;
+    virtual void* mapBuffer(struct plane_data* plane, int index) override;
+    virtual void flipped() override;
+    virtual int reflections(struct plane_data* plane) const override;
+    virtual bool hasAlpha(struct plane_data* plane) const override;
+    virtual int fd() const override;
+    virtual void step() override;
+
+    virtual ~KmsPlaneBackend();
+
+protected:
+
+    /**
+     * @brief What the backend knows about a plane beyond libplanes.
+     */
+    struct KmsPlane
+    {
+        struct plane_data* plane;
+        /** KMS property ids used for atomic commits. */
+        uint32_t ids[12];
+        /** Bits of the rotation property, 0 if the plane does not have them. */
+        uint64_t rotate0;
+        uint64_t reflectX;
+        uint64_t reflectY;
+        /** Value of the alpha property for an opaque plane, 0 if there is none. */
+        uint64_t alphaMax;
+        /** Formats the plane scans out, as listed by the driver. */
+        std::vector<uint32_t> formats;
+        /** Framebuffers owned by the backend, only when the plane flips. */
+        std::vector<struct kms_framebuffer*> fbs;
+        std::vector<void*> ptrs;
+        BufferRing ring;
+    };
+
+    void lookupProperties(KmsPlane& kms);
+    void lookupFormats(KmsPlane& kms);
+    KmsPlane* find(struct plane_data* plane);
+    const KmsPlane* find(struct plane_data* plane) const;
+    /**
+     * @param keep Copy what the plane shows now into the new framebuffers, otherwise they
+     * are cleared.
+     */
+    bool createBuffers(KmsPlane& kms, int count, int width, int height, uint32_t format,
+                       bool keep);
+    void freeBuffers(KmsPlane& kms);
+    bool commitAtomic(std::vector<PlaneUpdate*>& updates);
+
+    /**
+     * @brief The KMS device used to manage planes.
+     */
+    std::shared_ptr<kms_device> m_device;
+
+    /**
+     * @brief List of configured planes based on config file.
+     */
+    std::vector<plane_data*> m_planes;
+
+    std::vector<KmsPlane> m_kms;
+
+    bool m_atomic;
+};
+
+#endif // KMSPLANEBACKEND_H
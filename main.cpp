@@ -4,102 +4,206 @@
  *
  * SPDX-License-Identifier: Apache-2.0
  */
+#include "animationengine.h"
+#include "assetpack.h"
+#include "entitysystem.h"
+#include "evdevinput.h"
 #include "planemanager.h"
+#include "framescheduler.h"
+#include "graphicsentityitem.h"
+#include "graphicshuditem.h"
 #include "graphicslayeritem.h"
 #include "graphicsspriteitem.h"
 #include "graphicsplaneview.h"
-#include "tools.h"
+#include "memoryledger.h"
+#include "pixelkernels.h"
+#include "planescene.h"
+#include "startupprofiler.h"
+#include "systemsampler.h"
+#include "trace.h"
 
 #include <QApplication>
 #include <QTimer>
-#include <QTimeLine>
 #include <QProgressBar>
 #include <QPropertyAnimation>
 #include <QStateMachine>
 #include <QSignalTransition>
 #include <QDebug>
 #include <QGraphicsProxyWidget>
+#include <QPainter>
 #include <QMessageBox>
 #include <QDesktopWidget>
+#include <QFutureWatcher>
+#include <QThreadPool>
+#include <QtConcurrent>
 
-#include <map>
+#include <cstdio>
+#include <functional>
 #include <memory>
 
-/**
- * @brief The AnimationStateMachine class
- *
- * A helper class that treats QTimeLine objects like they are states.
+/*
+ * What the cowboy can do.  The tables are indexed by these enums, and compiled against the
+ * sprite when it is loaded.
  */
-class AnimationStateMachine : public QObject
+enum CowboyState
 {
-    Q_OBJECT
-public:
+    Walking,
+    Jumping,
+    Firing,
+};
 
-    void addTimeLine(const QString& name, QTimeLine* timeline)
-    {
-        m_timelines.insert(std::pair<QString, std::shared_ptr<QTimeLine>>(name, std::shared_ptr<QTimeLine>(timeline)));
-        QObject::connect(timeline, &QTimeLine::finished, this, &AnimationStateMachine::transition);
-    }
+enum CowboyEvent
+{
+    Jump,
+    Fire,
+    CowboyEvents,
+};
 
-    void addTransition(const QString& from, const QString& to)
-    {
-        m_transitions[from] = to;
-    }
+/*
+ * Entity types.
+ */
+enum
+{
+    Shot,
+    Tumbleweed,
+};
 
-    void activate(const QString& name)
-    {
-        qDebug() << "AnimationStateMachine::activate " << name;
+/** Pixels per second. */
+static const float SHOT_SPEED = 600;
+static const float TUMBLEWEED_SPEED = 90;
 
-        if (m_current.length())
-            m_timelines[m_current]->stop();
+/** Milliseconds between tumbleweeds. */
+static const int TUMBLEWEED_INTERVAL = 2500;
 
-        if (m_timelines.find(name) != m_timelines.end())
-        {
-            m_current = name;
-            m_timelines[m_current]->start();
-        }
-    }
+static const AnimationEngine::StateDef COWBOY_STATES[] = {
+    {"walking", 0, Walking},
+    {"jumping", 1, Walking},
+    {"firing", 1, Walking},
+};
 
-public slots:
+static const AnimationEngine::TransitionDef COWBOY_TRANSITIONS[] = {
+    {Jump, Walking, Jumping},
+    {Fire, Walking, Firing},
+};
 
-    void transition()
-    {
-        if (m_transitions.find(m_current) != m_transitions.end())
-        {
-            activate(m_transitions[m_current]);
-        }
-    }
+/**
+ * @brief Load an image from the asset pack, or decode it from the resources.
+ * @param name Path of the image relative to the source tree, such as "media/man.png".
+ */
+static QImage load_image(const AssetPack& assets, const QString& name)
+{
+    QImage image = assets.image(name.toStdString());
+    if (!image.isNull())
+        return image;
 
-    void event(const QString& from, const QString& to)
-    {
-        if (m_current == from)
-        {
-            activate(to);
-        }
-    }
+    return QImage(":/" + name);
+}
 
-protected:
+/**
+ * @brief Load an image on the global thread pool.
+ *
+ * assets is used from the thread pool, so it has to outlive the decode.
+ *
+ * @param plane Also convert it to the format planes are drawn in.
+ */
+static QFuture<QImage> decode_image(const AssetPack& assets, const QString& name, bool plane)
+{
+    return QtConcurrent::run([&assets, name, plane]() {
+        StartupProfiler::Scope scope("decode:" + name);
+        TRACE_SCOPE(Trace::Assets, "decode");
 
-    QString m_current;
-    std::map<QString, std::shared_ptr<QTimeLine> > m_timelines;
-    std::map<QString, QString> m_transitions;
-};
+        QImage image = load_image(assets, name);
+        return plane ? PixelKernels::premultiplied(image) : image;
+    });
+}
+
+/**
+ * @brief Call upload on the GUI thread once an image has been decoded.
+ */
+static void upload_image(QObject* parent, const QString& name, const QFuture<QImage>& future,
+                         std::function<void(const QImage&)> upload)
+{
+    QFutureWatcher<QImage>* watcher = new QFutureWatcher<QImage>(parent);
+    QObject::connect(watcher, &QFutureWatcher<QImage>::finished, [watcher, name, upload]() {
+        {
+            StartupProfiler::Scope scope("upload:" + name);
+            TRACE_SCOPE(Trace::Assets, "upload");
+            upload(watcher->result());
+        }
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
 
 int main(int argc, char *argv[])
 {
+    StartupProfiler& profiler = StartupProfiler::instance();
+    profiler.mark("main");
+
+    profiler.begin("qt_init");
     QApplication app(argc, argv);
+    profiler.end("qt_init");
+
+    /*
+     * WILDWEST_TRACE=<file> records a trace, written on exit and on SIGUSR2.
+     */
+    Trace::install();
+    Trace::setThreadName("main");
+
+    /*
+     * Images from the pack point into the mapping, so it stays open for as long as the app
+     * runs.
+     */
+    AssetPack assets;
+    QString pack = qEnvironmentVariableIsSet("WILDWEST_ASSETS") ?
+                QString::fromLocal8Bit(qgetenv("WILDWEST_ASSETS")) :
+                QCoreApplication::applicationDirPath() + "/wildwest.pack";
+    if (!assets.open(pack))
+        qDebug() << "no asset pack, decoding images";
+
+    /*
+     * Start decoding everything at once, and set up the planes while that runs.  Nothing but
+     * the background is waited for, the planes fade in as their images arrive.
+     */
+    QFuture<QImage> primaryImage = decode_image(assets, "media/primary.png", false);
+    QFuture<QImage> logoImage = decode_image(assets, "media/logo.png", false);
+    QFuture<QImage> overlay0Image = decode_image(assets, "media/overlay0.png", true);
+    QFuture<QImage> overlay1Image = decode_image(assets, "media/overlay1.png", true);
+    QFuture<QImage> manImage = decode_image(assets, "media/man.png", true);
+
+    /*
+     * The decodes read the asset pack, which is unmapped when main returns, however early
+     * that is.  This goes before it and waits for them.
+     */
+    struct WaitForDecodes
+    {
+        ~WaitForDecodes()
+        {
+            QThreadPool::globalInstance()->waitForDone();
+        }
+    } waitForDecodes;
 
     PlaneManager planes;
-    if (!planes.load("wildwest.screen"))
+    profiler.begin("planes_load");
+    bool loaded = planes.load("wildwest.screen");
+    profiler.end("planes_load");
+    if (!loaded)
     {
         QMessageBox::critical(0, "Failed to Setup Planes",
                               "This demo requires a version of Qt that provides access to the DRI file descriptor,"
                               " a valid planes screen.config file, and using the linuxfb backend with the env var "
-                              "QT_QPA_FB_DRM set.\n");
+                              "QT_QPA_FB_DRM set.  Set WILDWEST_PLANES=software to run without "
+                              "DRM hardware.\n");
         return -1;
     }
 
-    QRect screen = QApplication::desktop()->screenGeometry();
+    /*
+     * The software backend brings its own screen, otherwise the planes are on the same screen
+     * as Qt.
+     */
+    QRect screen = planes.screenSize().isValid() ?
+                QRect(QPoint(0, 0), planes.screenSize()) :
+                QApplication::desktop()->screenGeometry();
 
     if (screen.width() != 800 || screen.height() != 480)
     {
@@ -115,124 +219,328 @@ int main(int argc, char *argv[])
      * translate to hardware plane usage behind the scenes.
      */
 
-    QGraphicsPixmapItem* logo = new QGraphicsPixmapItem(QPixmap(":/media/logo.png"));
+    QGraphicsPixmapItem* logo = new QGraphicsPixmapItem();
     logo->setPos(10, 10);
     scene.addItem(logo);
 
-    GraphicsLayerItem overlay0(planes.get("overlay0"), QPixmap(":/media/overlay0.png"),
-                               screen.width(), 330, 2);
-    overlay0.setPos(0,70);
-    scene.addItem(&overlay0);
-
-    GraphicsLayerItem overlay1(planes.get("overlay1"), QPixmap(":/media/overlay1.png"),
-                               screen.width(), 110, 4);
-    overlay1.setPos(0,370);
-    scene.addItem(&overlay1);
-
-    GraphicsSpriteItem man(planes.get("overlay2"), QPixmap(":/media/man.png"), 88, 151);
-    man.addSequence("walking", 24, 0, 68, 150, 8);
-    man.addSequence("jumping", 14, 152, 80, 151, 7);
-    man.addSequence("firing", 14, 310, 88, 151, 4);
-    man.setPos((screen.width() / 2) - (88/2), (screen.height() * 0.90) - man.height());
-    scene.addItem(&man);
-
-    QProgressBar* progress = new QProgressBar();
-    progress->setOrientation(Qt::Horizontal);
-    progress->setRange(0, 100);
-    progress->setTextVisible(true);
-    progress->setAlignment(Qt::AlignCenter);
-    progress->setFormat("CPU: %p%");
-    progress->setValue(0);
-    QPalette p = progress->palette();
-    p.setColor(QPalette::Highlight, Qt::red);
-    p.setBrush(QPalette::Background, Qt::transparent);
-    progress->setPalette(p);
-    progress->setMaximumWidth(200);
-    QGraphicsProxyWidget *proxy = scene.addWidget(progress);
-    proxy->setPos(screen.width() - 200 - 10, 10);
+    /*
+     * Plane items live in their own scene, which the QGraphicsScene never sees.  The layers
+     * are advanced by it on every frame.
+     *
+     * Plane items start out empty and transparent, and get their images once decoded.
+     */
+    PlaneScene planeScene(planes);
+
+    GraphicsLayerItem overlay0(planes, planes.get("overlay0"), QImage(), screen.width(), 330, 60);
+    overlay0.moveTo(0, 70);
+    planes.setAlpha(planes.get("overlay0"), 0);
+    planeScene.addItem(&overlay0, 0, PlaneScene::Advance);
+
+    GraphicsLayerItem overlay1(planes, planes.get("overlay1"), QImage(), screen.width(), 110, 120);
+    overlay1.moveTo(0, 370);
+    planes.setAlpha(planes.get("overlay1"), 0);
+    planeScene.addItem(&overlay1, 1, PlaneScene::Advance);
+
+    GraphicsSpriteItem man(planes, planes.get("overlay2"), QImage(), 88, 151);
+    if (!man.loadManifest(":/media/man.sprite"))
+        qFatal("failed to load sprite manifest");
+    man.moveTo((screen.width() / 2) - (88/2), (screen.height() * 9 / 10) - man.height());
+    planes.setAlpha(planes.get("overlay2"), 0);
+    planeScene.addItem(&man, 2);
+
+    /*
+     * The /proc files are read on the sampler thread, the GUI thread only picks up the
+     * latest sample.
+     */
+    SystemSampler sampler;
+    sampler.start(1000);
+
+    /*
+     * The performance HUD needs a plane of its own, a "hud" plane in the screen config, or a
+     * virtual plane when WILDWEST_HUD is set.  Without one, the CPU load is shown on the
+     * primary plane.
+     */
+    struct plane_data* hudPlane = planes.get("hud");
+    if (!hudPlane && qEnvironmentVariableIsSet("WILDWEST_HUD"))
+        hudPlane = planes.create("hud", 256, 96, 10);
+
+    std::unique_ptr<GraphicsHudItem> hud;
+    QProgressBar* progress = 0;
+    if (hudPlane)
+    {
+        hud.reset(new GraphicsHudItem(planes, hudPlane, sampler));
+        hud->moveTo(screen.width() - hud->width() - 10, 10);
+        planeScene.addItem(hud.get(), 3);
+    }
+    else
+    {
+        progress = new QProgressBar();
+        progress->setOrientation(Qt::Horizontal);
+        progress->setRange(0, 100);
+        progress->setTextVisible(true);
+        progress->setAlignment(Qt::AlignCenter);
+        progress->setFormat("CPU: %p%");
+        progress->setValue(0);
+        QPalette p = progress->palette();
+        p.setColor(QPalette::Highlight, Qt::red);
+        p.setBrush(QPalette::Background, Qt::transparent);
+        progress->setPalette(p);
+        progress->setMaximumWidth(200);
+        QGraphicsProxyWidget *proxy = scene.addWidget(progress);
+        proxy->setPos(screen.width() - 200 - 10, 10);
+    }
 
     /*
      * Setup the view.
      */
 
     GraphicsPlaneView view(&scene);
+    view.setPlaneScene(&planeScene);
     view.setStyleSheet( "QGraphicsView { border-style: none; }" );
-    view.setBackgroundBrush(QPixmap(":/media/primary.png"));
+    view.setBackgroundBrush(QPixmap::fromImage(primaryImage.result()));
+    primaryImage = QFuture<QImage>();
     view.setCacheMode(QGraphicsView::CacheBackground);
     view.resize(screen.width(), screen.height());
     view.setSceneRect(0, 0, screen.width(), screen.height());
     view.setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff );
     view.setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff );
     view.show();
+    profiler.mark("view_shown");
+
+    int loading = 4;
+    upload_image(&app, "media/logo.png", logoImage, [logo, &loading](const QImage& image) {
+        logo->setPixmap(QPixmap::fromImage(image));
+        loading--;
+    });
+    upload_image(&app, "media/overlay0.png", overlay0Image, [&overlay0, &loading](const QImage& image) {
+        overlay0.setImage(image);
+        overlay0.fadeIn(300);
+        loading--;
+    });
+    upload_image(&app, "media/overlay1.png", overlay1Image, [&overlay1, &loading](const QImage& image) {
+        overlay1.setImage(image);
+        overlay1.fadeIn(300);
+        loading--;
+    });
+    upload_image(&app, "media/man.png", manImage, [&man, &loading](const QImage& image) {
+        man.setImage(image);
+        man.fadeIn(300);
+        loading--;
+    });
 
     /*
-     * Setup states and animations.
+     * The watchers have the futures now.  Dropping these lets each decoded image go as soon
+     * as its item has drawn it to the plane.
      */
+    logoImage = overlay0Image = overlay1Image = manImage = QFuture<QImage>();
 
-    AnimationStateMachine machine;
-
-    QTimeLine *walking = new QTimeLine(600);
-    walking->setUpdateInterval(1000 / 32);
-    walking->setLoopCount(0);
-    walking->setCurveShape(QTimeLine::LinearCurve);
-    walking->setFrameRange(0, man.frameCount("walking")-1);
-    QObject::connect(walking, &QTimeLine::frameChanged, &man, &GraphicsSpriteItem::setFrame);
-    QObject::connect(walking, SIGNAL(valueChanged(qreal)), &scene, SLOT(advance()));
-    QObject::connect(walking, &QTimeLine::stateChanged, [&machine,&man](QTimeLine::State newState){
-        if (newState == QTimeLine::Running)
-            man.setSequence("walking");
+    /*
+     * Plane items account for themselves, this is everything else that holds an image.
+     * WILDWEST_MEMORY prints the ledger to stderr once startup is over, and on exit.
+     */
+    MemoryLedger& ledger = MemoryLedger::instance();
+    ledger.add("background", [&view]() {
+        MemoryLedger::Usage usage;
+        usage.cpu = MemoryLedger::bytes(view.backgroundBrush().texture());
+        usage.cache = view.cacheMode() & QGraphicsView::CacheBackground ?
+            (qint64)view.viewport()->width() * view.viewport()->height() *
+            view.viewport()->depth() / 8 : 0;
+        usage.plane = 0;
+        return usage;
+    });
+    ledger.add("logo", [logo]() {
+        MemoryLedger::Usage usage;
+        usage.cpu = MemoryLedger::bytes(logo->pixmap());
+        usage.cache = 0;
+        usage.plane = 0;
+        return usage;
     });
-    machine.addTimeLine("walking", walking);
-
-    QTimeLine *jumping = new QTimeLine(600);
-    jumping->setUpdateInterval(100);
-    jumping->setLoopCount(1);
-    jumping->setCurveShape(QTimeLine::LinearCurve);
-    jumping->setFrameRange(0, man.frameCount("jumping")-1);
-    QObject::connect(jumping, &QTimeLine::frameChanged, &man, &GraphicsSpriteItem::setFrame);
-    QObject::connect(jumping, &QTimeLine::stateChanged, [&machine,&man](QTimeLine::State newState){
-        if (newState == QTimeLine::Running)
-            man.setSequence("jumping");
+    ledger.add("asset pack", [&assets]() {
+        MemoryLedger::Usage usage;
+        usage.cpu = assets.size();
+        usage.cache = 0;
+        usage.plane = 0;
+        return usage;
     });
-    machine.addTimeLine("jumping", jumping);
-    machine.addTransition("jumping", "walking");
-
-    QTimeLine *firing = new QTimeLine(300);
-    firing->setUpdateInterval(1000 / 32);
-    firing->setLoopCount(1);
-    firing->setCurveShape(QTimeLine::LinearCurve);
-    firing->setFrameRange(0, man.frameCount("firing")-1);
-    QObject::connect(firing, SIGNAL(frameChanged(int)), &man, SLOT(setFrame(int)));
-    QObject::connect(firing, &QTimeLine::stateChanged, [&machine,&man](QTimeLine::State newState){
-        if (newState == QTimeLine::Running)
-            man.setSequence("firing");
+
+    bool memoryReport = qEnvironmentVariableIsSet("WILDWEST_MEMORY");
+    if (memoryReport)
+    {
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&ledger]() {
+            fputs(ledger.report().toLocal8Bit().constData(), stderr);
+        });
+    }
+
+    /*
+     * WILDWEST_BANDWIDTH is a budget for the memory bus traffic of the planes in MB/s.  Going
+     * over it prints where the bandwidth goes, and so does quitting.
+     */
+    if (qEnvironmentVariableIsSet("WILDWEST_BANDWIDTH"))
+    {
+        planes.setBandwidthBudget(qgetenv("WILDWEST_BANDWIDTH").toDouble() * 1000000.0);
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&planes]() {
+            fputs(planes.bandwidthReport().toLocal8Bit().constData(), stderr);
+        });
+    }
+
+    /*
+     * Setup states and animations.  Everything is driven from the display refresh.  The layers
+     * and the animations all move on the same frame, so they all land in the same plane
+     * commit.
+     */
+    FrameScheduler& scheduler = planes.scheduler();
+
+    AnimationEngine animations(scheduler);
+    AnimationEngine::Machine cowboy(COWBOY_STATES, COWBOY_TRANSITIONS, CowboyEvents, man);
+    const int cowboyActor = animations.addActor(&cowboy, &man, Walking);
+
+    /*
+     * Every shot and tumbleweed is an entity, and they are all drawn into one plane across
+     * the screen at the height of the cowboy.  That takes the "shots" plane of the screen
+     * config, or a virtual plane.  Without one, they still move and collide but are not
+     * shown.
+     */
+    EntitySystem shots(scheduler, 16, screen);
+    struct plane_data* shotsPlane = planes.get("shots");
+    if (!shotsPlane)
+        shotsPlane = planes.create("shots", screen.width(), man.height(), 3);
+
+    std::unique_ptr<GraphicsEntityItem> shotsItem;
+    if (shotsPlane)
+    {
+        QImage bullet(8, 3, QImage::Format_ARGB32_Premultiplied);
+        bullet.fill(QColor(255, 224, 96));
+
+        QImage tumbleweed(24, 24, QImage::Format_ARGB32_Premultiplied);
+        tumbleweed.fill(Qt::transparent);
+        QPainter painter(&tumbleweed);
+        painter.setRenderHint(QPainter::Antialiasing);
+        painter.setPen(QPen(QColor(150, 110, 60), 2));
+        painter.drawEllipse(QRectF(2, 2, 20, 20));
+        painter.drawEllipse(QRectF(6, 5, 12, 13));
+        painter.end();
+
+        shotsItem.reset(new GraphicsEntityItem(planes, shotsPlane, shots));
+        shotsItem->setImage(Shot, bullet);
+        shotsItem->setImage(Tumbleweed, tumbleweed);
+        shotsItem->moveTo(0, man.planePos().y());
+    }
+
+    /*
+     * Tumbleweeds roll in from either side at the height of the gun, and a shot that hits
+     * one takes both out.
+     */
+    shots.setCollisionHandler(Shot, Tumbleweed, [&shots](int shot, int tumbleweed) {
+        shots.despawn(shot);
+        shots.despawn(tumbleweed);
     });
-    machine.addTimeLine("firing", firing);
-    machine.addTransition("firing", "walking");
 
-    QObject::connect(&man, &GraphicsSpriteItem::clicked, [&machine](){
-        machine.event("walking","firing");
+    QTimer tumbleweedTimer;
+    bool fromLeft = false;
+    QObject::connect(&tumbleweedTimer, &QTimer::timeout, [&shots, &man, &screen, &fromLeft]() {
+        fromLeft = !fromLeft;
+        float y = man.planePos().y() + man.height() / 3 - 12;
+        shots.spawn(Tumbleweed, fromLeft ? 0 : screen.width() - 24, y,
+                    fromLeft ? TUMBLEWEED_SPEED : -TUMBLEWEED_SPEED, 0, 24, 24);
     });
+    tumbleweedTimer.start(TUMBLEWEED_INTERVAL);
+
+    QObject::connect(&animations, &AnimationEngine::entered,
+                     [&shots, &man, cowboyActor](int actor, int state) {
+        if (actor != cowboyActor || state != Firing)
+            return;
+
+        /*
+         * Out of the gun, a third of the way down the sprite on the side it faces.
+         */
+        bool left = man.flipHorizontal();
+        QPoint muzzle = man.planePos() + QPoint(left ? 0 : man.width(), man.height() / 3);
+        shots.spawn(Shot, muzzle.x(), muzzle.y(), left ? -SHOT_SPEED : SHOT_SPEED, 0, 8, 3);
+    });
+
+    /*
+     * WILDWEST_TOUCH=/dev/input/eventN reads the touchscreen directly, and prints the latency
+     * of touches to stderr on exit.  Otherwise touches come through Qt.
+     */
+    EvdevInput input(planes, screen);
+    if (qEnvironmentVariableIsSet("WILDWEST_TOUCH") &&
+        input.open(QString::fromLocal8Bit(qgetenv("WILDWEST_TOUCH"))))
+    {
+        QObject::connect(&input, &EvdevInput::pressed,
+                         [&planeScene, &man, &animations, cowboyActor](const QPoint& pos) {
+            animations.post(cowboyActor, planeScene.itemAt(pos) == &man ? Fire : Jump);
+        });
+
+        QObject::connect(&app, &QCoreApplication::aboutToQuit, [&input]() {
+            fputs(input.report().toLocal8Bit().constData(), stderr);
+        });
+    }
+    else
+    {
+        QObject::connect(&man, &GraphicsSpriteItem::clicked, [&animations, cowboyActor](){
+            animations.post(cowboyActor, Fire);
+        });
+
+        QObject::connect(&view, &GraphicsPlaneView::clicked, [&animations, cowboyActor](){
+            animations.post(cowboyActor, Jump);
+        });
+    }
 
-    QObject::connect(&view, &GraphicsPlaneView::clicked, [&machine](){
-        machine.event("walking","jumping");
+    /*
+     * Startup is over with the first commit that has every image in it.
+     */
+    bool firstCommit = true;
+    QMetaObject::Connection startup;
+    startup = QObject::connect(&scheduler, &FrameScheduler::committed,
+                               [&profiler, &firstCommit, &loading, &startup, &ledger,
+                                memoryReport](qint64 time) {
+        Q_UNUSED(time);
+
+        if (firstCommit)
+        {
+            profiler.mark("first_commit");
+            firstCommit = false;
+        }
+
+        if (!loading)
+        {
+            profiler.finish();
+            if (memoryReport)
+                fputs(ledger.report().toLocal8Bit().constData(), stderr);
+            QObject::disconnect(startup);
+        }
     });
 
-    machine.activate("walking");
+    /*
+     * Animations look the same at any frame rate, WILDWEST_FPS runs them off a timer at a
+     * different rate than the display.
+     */
+    int fps = qgetenv("WILDWEST_FPS").toInt();
+    if (fps > 0)
+    {
+        scheduler.setRefreshRate(fps);
+        scheduler.start(FrameScheduler::Timer);
+    }
+    else
+    {
+        scheduler.start(FrameScheduler::Vblank);
+    }
 
     /*
      * Update the progress bar independently.
      */
 
-    Tools tools;
     QTimer cpuTimer;
-    QObject::connect(&cpuTimer, &QTimer::timeout, [&tools,&progress]() {
-        tools.updateCpuUsage();
-        progress->setValue(tools.cpu_usage[0]);
-    });
-    cpuTimer.start(1000);
+    if (progress)
+    {
+        QObject::connect(&cpuTimer, &QTimer::timeout, [&sampler,progress]() {
+            SystemSampler::Sample sample;
+            if (sampler.latest(sample))
+                progress->setValue(sample.total);
+        });
+        cpuTimer.start(1000);
+    }
 
     return app.exec();
 }
 
-#include "main.moc"
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "memoryledger.h"
+#include <QFile>
+#include <QMutexLocker>
+#include <unistd.h>
+
+MemoryLedger& MemoryLedger::instance()
+{
+    static MemoryLedger ledger;
+    return ledger;
+}
+
+MemoryLedger::MemoryLedger()
+    : m_next(0)
+{
+}
+
+int MemoryLedger::add(const QString& name, Account account)
+{
+    QMutexLocker locker(&m_lock);
+    m_entries.push_back({m_next, name, account});
+    return m_next++;
+}
+
+void MemoryLedger::remove(int id)
+{
+    QMutexLocker locker(&m_lock);
+    for (auto i = m_entries.begin(); i != m_entries.end(); ++i)
+    {
+        if (i->id == id)
+        {
+            m_entries.erase(i);
+            return;
+        }
+    }
+}
+
+MemoryLedger::Usage MemoryLedger::total() const
+{
+    QMutexLocker locker(&m_lock);
+
+    Usage total = {0, 0, 0};
+    for (auto& e: m_entries)
+    {
+        Usage usage = e.account();
+        total.cpu += usage.cpu;
+        total.cache += usage.cache;
+        total.plane += usage.plane;
+    }
+
+    return total;
+}
+
+qint64 MemoryLedger::rss()
+{
+    /*
+     * The second field is the resident size in pages.
+     */
+    QFile file("/proc/self/statm");
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    QList<QByteArray> fields = file.readAll().split(' ');
+    if (fields.size() < 2)
+        return -1;
+
+    return fields[1].toLongLong() * sysconf(_SC_PAGESIZE);
+}
+
+QString MemoryLedger::report() const
+{
+    QMutexLocker locker(&m_lock);
+
+    QString out = QString("memory by asset, KiB:\n  %1 %2 %3 %4\n")
+        .arg("asset", -20).arg("cpu", 8).arg("cache", 8).arg("plane", 8);
+
+    Usage total = {0, 0, 0};
+    for (auto& e: m_entries)
+    {
+        Usage usage = e.account();
+        out += QString("  %1 %2 %3 %4\n").arg(e.name, -20)
+            .arg(usage.cpu / 1024, 8).arg(usage.cache / 1024, 8).arg(usage.plane / 1024, 8);
+
+        total.cpu += usage.cpu;
+        total.cache += usage.cache;
+        total.plane += usage.plane;
+    }
+
+    out += QString("  %1 %2 %3 %4\n").arg("total", -20)
+        .arg(total.cpu / 1024, 8).arg(total.cache / 1024, 8).arg(total.plane / 1024, 8);
+    out += QString("  %1 %2\n").arg("process rss", -20).arg(rss() / 1024, 8);
+
+    return out;
+}
+
+MemoryLedger::~MemoryLedger()
+{
+}
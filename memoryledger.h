@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef MEMORYLEDGER_H
+#define MEMORYLEDGER_H
+
+#include <QImage>
+#include <QMutex>
+#include <QPixmap>
+#include <QString>
+#include <functional>
+#include <vector>
+
+/**
+ * @brief The MemoryLedger class
+ *
+ * Where the memory of each asset goes, to see what the RSS is made of.
+ *
+ * Whatever holds memory for an asset adds an account, a function that returns how much it
+ * holds right now.  Accounts are only called for a report, so keeping the ledger costs
+ * nothing.  Bytes are split into CPU memory the app owns, memory Qt keeps in its caches, and
+ * plane framebuffers.
+ *
+ * Images are counted at their full size even when they share pixels with another image, or
+ * point into the mapped asset pack, so the ledger shows an upper bound.
+ */
+class MemoryLedger
+{
+public:
+
+    struct Usage
+    {
+        qint64 cpu;
+        qint64 cache;
+        qint64 plane;
+    };
+
+    typedef std::function<Usage()> Account;
+
+    static MemoryLedger& instance();
+
+    /**
+     * @return Id of the account, for remove().
+     */
+    int add(const QString& name, Account account);
+
+    void remove(int id);
+
+    /**
+     * @brief Usage of all accounts together.
+     */
+    Usage total() const;
+
+    /**
+     * @brief A table of every account, with the totals and the resident size of the process.
+     */
+    QString report() const;
+
+    /**
+     * @brief Bytes of pixels an image holds, 0 for a null image.
+     */
+    static qint64 bytes(const QImage& image)
+    {
+        return image.isNull() ? 0 : (qint64)image.bytesPerLine() * image.height();
+    }
+
+    static qint64 bytes(const QPixmap& pixmap)
+    {
+        return (qint64)pixmap.width() * pixmap.height() * pixmap.depth() / 8;
+    }
+
+    /**
+     * @brief Resident size of the process in bytes, or -1.
+     */
+    static qint64 rss();
+
+    virtual ~MemoryLedger();
+
+protected:
+
+    MemoryLedger();
+
+    struct Entry
+    {
+        int id;
+        QString name;
+        Account account;
+    };
+
+    mutable QMutex m_lock;
+    std::vector<Entry> m_entries;
+    int m_next;
+};
+
+#endif // MEMORYLEDGER_H
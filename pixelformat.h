@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PIXELFORMAT_H
+#define PIXELFORMAT_H
+
+#ifdef WILDWEST_SOFTWARE_ONLY
+#include <drm/drm_fourcc.h>
+#else
+#include <drm_fourcc.h>
+#endif
+#include <QImage>
+#include <QString>
+#include <cstdint>
+
+/**
+ * @brief Bytes per pixel of a DRM format, 0 if unknown.
+ */
+static inline int formatBytesPerPixel(uint32_t format)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_ARGB8888:
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_ABGR8888:
+    case DRM_FORMAT_XBGR8888:
+        return 4;
+    case DRM_FORMAT_RGB888:
+        return 3;
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_ARGB4444:
+    case DRM_FORMAT_ARGB1555:
+        return 2;
+    case DRM_FORMAT_C8:
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief QImage format that matches the memory layout of a DRM format.
+ */
+static inline QImage::Format formatImageFormat(uint32_t format)
+{
+    switch (format)
+    {
+    case DRM_FORMAT_ARGB8888:
+        return QImage::Format_ARGB32_Premultiplied;
+    case DRM_FORMAT_XRGB8888:
+        return QImage::Format_RGB32;
+    case DRM_FORMAT_RGB565:
+        return QImage::Format_RGB16;
+    case DRM_FORMAT_ARGB4444:
+        return QImage::Format_ARGB4444_Premultiplied;
+    case DRM_FORMAT_C8:
+        return QImage::Format_Indexed8;
+    }
+
+    return QImage::Format_Invalid;
+}
+
+/**
+ * @brief DRM format by the name a planes config file uses for it, 0 if unknown.
+ */
+static inline uint32_t formatFromName(const QString& name)
+{
+    static const struct
+    {
+        const char* name;
+        uint32_t format;
+    } formats[] =
+    {
+        {"DRM_FORMAT_ARGB8888", DRM_FORMAT_ARGB8888},
+        {"DRM_FORMAT_XRGB8888", DRM_FORMAT_XRGB8888},
+        {"DRM_FORMAT_RGB565", DRM_FORMAT_RGB565},
+        {"DRM_FORMAT_ARGB4444", DRM_FORMAT_ARGB4444},
+        {"DRM_FORMAT_C8", DRM_FORMAT_C8},
+    };
+
+    for (auto& f: formats)
+        if (name == f.name)
+            return f.format;
+
+    return 0;
+}
+
+#endif // PIXELFORMAT_H
@@ -0,0 +1,873 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "pixelkernels.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXELKERNELS_NEON
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#define PIXELKERNELS_SSE2
+#include <emmintrin.h>
+#ifdef __AVX2__
+#define PIXELKERNELS_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+bool PixelKernels::s_simd = true;
+
+/*
+ * Scalar reference versions.  The SIMD versions below only handle whole vectors and return
+ * how many pixels they did, the rest of the row is always done here.
+ */
+
+static inline uint32_t premultiply_pixel(uint32_t p)
+{
+    uint32_t a = p >> 24;
+    uint32_t t = (p & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+    uint32_t g = ((p >> 8) & 0xff) * a;
+    g = (g + ((g >> 8) & 0xff) + 0x80) & 0xff00;
+    return (a << 24) | g | t;
+}
+
+static inline uint32_t lerp_pixel(uint32_t a, uint32_t b, uint32_t weight)
+{
+    uint32_t rb = (((a & 0xff00ff) * (256 - weight) + (b & 0xff00ff) * weight + 0x800080) >> 8) &
+        0xff00ff;
+    uint32_t ag = (((a >> 8) & 0xff00ff) * (256 - weight) + ((b >> 8) & 0xff00ff) * weight +
+                   0x800080) & 0xff00ff00;
+    return ag | rb;
+}
+
+static inline uint16_t to_rgb565_pixel(uint32_t p)
+{
+    return ((p >> 3) & 0x001f) | ((p >> 5) & 0x07e0) | ((p >> 8) & 0xf800);
+}
+
+static inline uint32_t from_rgb565_pixel(uint32_t c)
+{
+    return 0xff000000 |
+        ((c << 3) & 0xf8) | ((c >> 2) & 0x7) |
+        ((c << 5) & 0xfc00) | ((c >> 1) & 0x300) |
+        ((c << 8) & 0xf80000) | ((c << 3) & 0x70000);
+}
+
+/*
+ * 4x4 ordered dither thresholds from 0 to 15, indexed by row and then column.
+ */
+static const uint8_t BAYER[4][4] =
+{
+    { 0,  8,  2, 10},
+    {12,  4, 14,  6},
+    { 3, 11,  1,  9},
+    {15,  7, 13,  5},
+};
+
+/*
+ * Bytes added to a pixel before it is truncated, up to one step of each channel less one.
+ */
+static inline uint32_t rgb565_bias(uint32_t t)
+{
+    return ((t >> 1) << 16) | ((t >> 2) << 8) | (t >> 1);
+}
+
+static inline uint32_t argb4444_bias(uint32_t t)
+{
+    return t * 0x01010101;
+}
+
+/*
+ * Biases of four pixels in a row starting at x.  The pattern repeats every four pixels, so
+ * every vector of a row uses the same ones.
+ */
+static inline void dither_biases(uint32_t* biases, int x, int y, bool rgb565)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t t = BAYER[y & 3][(x + i) & 3];
+        biases[i] = rgb565 ? rgb565_bias(t) : argb4444_bias(t);
+    }
+}
+
+/*
+ * A level v of n bits is shown as v * 255 / (2^n - 1), so before the bias each channel is
+ * scaled by (2^n - 1) / 2^n, taking c >> n off c.  Without that the dither would average
+ * out to c * 2^n / 256 steps and come out up to one step too bright.
+ */
+static inline uint32_t rgb565_scaled(uint32_t p)
+{
+    return p - (((p >> 5) & 0x00070007) | ((p >> 6) & 0x00000300));
+}
+
+static inline uint32_t argb4444_scaled(uint32_t p)
+{
+    return p - ((p >> 4) & 0x0f0f0f0f);
+}
+
+static inline uint32_t adds_pixel(uint32_t p, uint32_t bias)
+{
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+        uint32_t c = ((p >> shift) & 0xff) + ((bias >> shift) & 0xff);
+        result |= (c > 0xff ? 0xff : c) << shift;
+    }
+    return result;
+}
+
+static inline uint16_t to_argb4444_pixel(uint32_t p)
+{
+    /*
+     * Color and alpha are dithered apart, so keep the color premultiplied.
+     */
+    uint32_t a = p >> 28;
+    uint32_t r = std::min<uint32_t>((p >> 20) & 0xf, a);
+    uint32_t g = std::min<uint32_t>((p >> 12) & 0xf, a);
+    uint32_t b = std::min<uint32_t>((p >> 4) & 0xf, a);
+    return (a << 12) | (r << 8) | (g << 4) | b;
+}
+
+#if defined(PIXELKERNELS_NEON)
+
+static int premultiply_simd(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint8x8x4_t p = vld4_u8(reinterpret_cast<const uint8_t*>(src + i));
+        for (int c = 0; c < 3; c++)
+        {
+            uint16x8_t v = vmull_u8(p.val[c], p.val[3]);
+            p.val[c] = vrshrn_n_u16(vsraq_n_u16(v, v, 8), 8);
+        }
+        vst4_u8(reinterpret_cast<uint8_t*>(dst + i), p);
+    }
+    return i;
+}
+
+static int mirror_simd(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint32x4_t p = vrev64q_u32(vld1q_u32(src + count - 4 - i));
+        vst1q_u32(dst + i, vcombine_u32(vget_high_u32(p), vget_low_u32(p)));
+    }
+    return i;
+}
+
+static int lerp_simd(uint32_t* dst, const uint32_t* a, const uint32_t* b, int weight, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        uint8x16_t pa = vld1q_u8(reinterpret_cast<const uint8_t*>(a + i));
+        uint8x16_t pb = vld1q_u8(reinterpret_cast<const uint8_t*>(b + i));
+        uint16x8_t lo = vmulq_n_u16(vmovl_u8(vget_low_u8(pa)), 256 - weight);
+        uint16x8_t hi = vmulq_n_u16(vmovl_u8(vget_high_u8(pa)), 256 - weight);
+        lo = vmlaq_n_u16(lo, vmovl_u8(vget_low_u8(pb)), weight);
+        hi = vmlaq_n_u16(hi, vmovl_u8(vget_high_u8(pb)), weight);
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i),
+                 vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+    }
+    return i;
+}
+
+static inline uint32x4_t to_rgb565_neon(uint32x4_t p)
+{
+    uint32x4_t b = vandq_u32(vshrq_n_u32(p, 3), vdupq_n_u32(0x001f));
+    uint32x4_t g = vandq_u32(vshrq_n_u32(p, 5), vdupq_n_u32(0x07e0));
+    uint32x4_t r = vandq_u32(vshrq_n_u32(p, 8), vdupq_n_u32(0xf800));
+    return vorrq_u32(vorrq_u32(b, g), r);
+}
+
+static int to_rgb565_simd(uint16_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x4_t lo = vmovn_u32(to_rgb565_neon(vld1q_u32(src + i)));
+        uint16x4_t hi = vmovn_u32(to_rgb565_neon(vld1q_u32(src + i + 4)));
+        vst1q_u16(dst + i, vcombine_u16(lo, hi));
+    }
+    return i;
+}
+
+static inline uint32x4_t adds_neon(uint32x4_t p, uint32x4_t bias)
+{
+    return vreinterpretq_u32_u8(vqaddq_u8(vreinterpretq_u8_u32(p), vreinterpretq_u8_u32(bias)));
+}
+
+static inline uint32x4_t rgb565_scaled_neon(uint32x4_t p)
+{
+    uint32x4_t s = vorrq_u32(vandq_u32(vshrq_n_u32(p, 5), vdupq_n_u32(0x00070007)),
+                             vandq_u32(vshrq_n_u32(p, 6), vdupq_n_u32(0x00000300)));
+    return vsubq_u32(p, s);
+}
+
+static inline uint32x4_t argb4444_scaled_neon(uint32x4_t p)
+{
+    uint8x16_t b = vreinterpretq_u8_u32(p);
+    return vreinterpretq_u32_u8(vsubq_u8(b, vshrq_n_u8(b, 4)));
+}
+
+static int to_rgb565_dither_simd(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    uint32_t biases[4];
+    dither_biases(biases, x, y, true);
+    const uint32x4_t bias = vld1q_u32(biases);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x4_t lo = vmovn_u32(to_rgb565_neon(
+            adds_neon(rgb565_scaled_neon(vld1q_u32(src + i)), bias)));
+        uint16x4_t hi = vmovn_u32(to_rgb565_neon(
+            adds_neon(rgb565_scaled_neon(vld1q_u32(src + i + 4)), bias)));
+        vst1q_u16(dst + i, vcombine_u16(lo, hi));
+    }
+    return i;
+}
+
+static inline uint32x4_t to_argb4444_neon(uint32x4_t p)
+{
+    uint8x16_t n = vshrq_n_u8(vreinterpretq_u8_u32(p), 4);
+    uint32x4_t a = vmulq_n_u32(vshrq_n_u32(vreinterpretq_u32_u8(n), 24), 0x01010101);
+    uint32x4_t c = vreinterpretq_u32_u8(vminq_u8(n, vreinterpretq_u8_u32(a)));
+    /*
+     * Nibbles are one per byte, fold blue and green into the low byte and red and alpha into
+     * the third one.
+     */
+    uint32x4_t t = vorrq_u32(c, vshrq_n_u32(c, 4));
+    return vorrq_u32(vandq_u32(t, vdupq_n_u32(0xff)),
+                     vandq_u32(vshrq_n_u32(t, 8), vdupq_n_u32(0xff00)));
+}
+
+static int to_argb4444_dither_simd(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    uint32_t biases[4];
+    dither_biases(biases, x, y, false);
+    const uint32x4_t bias = vld1q_u32(biases);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x4_t lo = vmovn_u32(to_argb4444_neon(
+            adds_neon(argb4444_scaled_neon(vld1q_u32(src + i)), bias)));
+        uint16x4_t hi = vmovn_u32(to_argb4444_neon(
+            adds_neon(argb4444_scaled_neon(vld1q_u32(src + i + 4)), bias)));
+        vst1q_u16(dst + i, vcombine_u16(lo, hi));
+    }
+    return i;
+}
+
+static inline uint32x4_t from_rgb565_neon(uint32x4_t c)
+{
+    uint32x4_t b = vorrq_u32(vandq_u32(vshlq_n_u32(c, 3), vdupq_n_u32(0xf8)),
+                             vandq_u32(vshrq_n_u32(c, 2), vdupq_n_u32(0x7)));
+    uint32x4_t g = vorrq_u32(vandq_u32(vshlq_n_u32(c, 5), vdupq_n_u32(0xfc00)),
+                             vandq_u32(vshrq_n_u32(c, 1), vdupq_n_u32(0x300)));
+    uint32x4_t r = vorrq_u32(vandq_u32(vshlq_n_u32(c, 8), vdupq_n_u32(0xf80000)),
+                             vandq_u32(vshlq_n_u32(c, 3), vdupq_n_u32(0x70000)));
+    return vorrq_u32(vorrq_u32(b, g), vorrq_u32(r, vdupq_n_u32(0xff000000)));
+}
+
+static int from_rgb565_simd(uint32_t* dst, const uint16_t* src, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        uint16x8_t c = vld1q_u16(src + i);
+        vst1q_u32(dst + i, from_rgb565_neon(vmovl_u16(vget_low_u16(c))));
+        vst1q_u32(dst + i + 4, from_rgb565_neon(vmovl_u16(vget_high_u16(c))));
+    }
+    return i;
+}
+
+#elif defined(PIXELKERNELS_SSE2)
+
+static inline __m128i premultiply_sse2(__m128i p)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(0x80);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+
+    __m128i lo = _mm_unpacklo_epi8(p, zero);
+    __m128i hi = _mm_unpackhi_epi8(p, zero);
+    __m128i alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)),
+                                      _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)),
+                                      _MM_SHUFFLE(3, 3, 3, 3));
+    lo = _mm_mullo_epi16(lo, alo);
+    hi = _mm_mullo_epi16(hi, ahi);
+    lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), half), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), half), 8);
+
+    /*
+     * Alpha got multiplied by itself, put the original back.
+     */
+    __m128i r = _mm_packus_epi16(lo, hi);
+    return _mm_or_si128(_mm_andnot_si128(alpha, r), _mm_and_si128(alpha, p));
+}
+
+#ifdef PIXELKERNELS_AVX2
+static inline __m256i premultiply_avx2(__m256i p)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(0x80);
+    const __m256i alpha = _mm256_set1_epi32(0xff000000);
+
+    /*
+     * Same as SSE2.  Unpack and pack both work within 128 bit lanes, so pixel order is kept.
+     */
+    __m256i lo = _mm256_unpacklo_epi8(p, zero);
+    __m256i hi = _mm256_unpackhi_epi8(p, zero);
+    __m256i alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)),
+                                         _MM_SHUFFLE(3, 3, 3, 3));
+    __m256i ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)),
+                                         _MM_SHUFFLE(3, 3, 3, 3));
+    lo = _mm256_mullo_epi16(lo, alo);
+    hi = _mm256_mullo_epi16(hi, ahi);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), half), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), half), 8);
+
+    __m256i r = _mm256_packus_epi16(lo, hi);
+    return _mm256_or_si256(_mm256_andnot_si256(alpha, r), _mm256_and_si256(alpha, p));
+}
+#endif
+
+static int premultiply_simd(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+#ifdef PIXELKERNELS_AVX2
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            premultiply_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i))));
+#endif
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         premultiply_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))));
+    return i;
+}
+
+static int mirror_simd(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+#ifdef PIXELKERNELS_AVX2
+    const __m256i reverse = _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + count - 8 - i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            _mm256_permutevar8x32_epi32(p, reverse));
+    }
+#endif
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + count - 4 - i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 1, 2, 3)));
+    }
+    return i;
+}
+
+static inline __m128i lerp_sse2(__m128i a, __m128i b, __m128i wa, __m128i wb)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi16(0x80);
+
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), wa),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), wb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), wa),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), wb));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+#ifdef PIXELKERNELS_AVX2
+static inline __m256i lerp_avx2(__m256i a, __m256i b, __m256i wa, __m256i wb)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i half = _mm256_set1_epi16(0x80);
+
+    __m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(a, zero), wa),
+                                  _mm256_mullo_epi16(_mm256_unpacklo_epi8(b, zero), wb));
+    __m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(a, zero), wa),
+                                  _mm256_mullo_epi16(_mm256_unpackhi_epi8(b, zero), wb));
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, half), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, half), 8);
+    return _mm256_packus_epi16(lo, hi);
+}
+#endif
+
+static int lerp_simd(uint32_t* dst, const uint32_t* a, const uint32_t* b, int weight, int count)
+{
+    int i = 0;
+#ifdef PIXELKERNELS_AVX2
+    const __m256i wa8 = _mm256_set1_epi16(256 - weight);
+    const __m256i wb8 = _mm256_set1_epi16(weight);
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                            lerp_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)),
+                                      wa8, wb8));
+#endif
+    const __m128i wa = _mm_set1_epi16(256 - weight);
+    const __m128i wb = _mm_set1_epi16(weight);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         lerp_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)),
+                                   _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)),
+                                   wa, wb));
+    return i;
+}
+
+static inline __m128i to_rgb565_sse2(__m128i p)
+{
+    __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001f));
+    __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07e0));
+    __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xf800));
+    /*
+     * SSE2 only packs with signed saturation, so move the range down and back up.
+     */
+    return _mm_sub_epi32(_mm_or_si128(_mm_or_si128(b, g), r), _mm_set1_epi32(0x8000));
+}
+
+static int to_rgb565_simd(uint16_t* dst, const uint32_t* src, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = to_rgb565_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+        __m128i hi = to_rgb565_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16(-0x8000)));
+    }
+    return i;
+}
+
+static inline __m128i rgb565_scaled_sse2(__m128i p)
+{
+    __m128i s = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x00070007)),
+                             _mm_and_si128(_mm_srli_epi32(p, 6), _mm_set1_epi32(0x00000300)));
+    return _mm_sub_epi32(p, s);
+}
+
+static inline __m128i argb4444_scaled_sse2(__m128i p)
+{
+    return _mm_sub_epi8(p, _mm_and_si128(_mm_srli_epi16(p, 4), _mm_set1_epi8(0x0f)));
+}
+
+static int to_rgb565_dither_simd(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    uint32_t biases[4];
+    dither_biases(biases, x, y, true);
+    const __m128i bias = _mm_loadu_si128(reinterpret_cast<const __m128i*>(biases));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = to_rgb565_sse2(_mm_adds_epu8(rgb565_scaled_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))), bias));
+        __m128i hi = to_rgb565_sse2(_mm_adds_epu8(rgb565_scaled_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4))), bias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16(-0x8000)));
+    }
+    return i;
+}
+
+static inline __m128i to_argb4444_sse2(__m128i p)
+{
+    __m128i n = _mm_and_si128(_mm_srli_epi16(p, 4), _mm_set1_epi8(0x0f));
+    __m128i a = _mm_srli_epi32(n, 24);
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+    a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    __m128i c = _mm_min_epu8(n, a);
+    /*
+     * Nibbles are one per byte, fold blue and green into the low byte and red and alpha into
+     * the third one.
+     */
+    __m128i t = _mm_or_si128(c, _mm_srli_epi32(c, 4));
+    __m128i v = _mm_or_si128(_mm_and_si128(t, _mm_set1_epi32(0xff)),
+                             _mm_and_si128(_mm_srli_epi32(t, 8), _mm_set1_epi32(0xff00)));
+    return _mm_sub_epi32(v, _mm_set1_epi32(0x8000));
+}
+
+static int to_argb4444_dither_simd(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    uint32_t biases[4];
+    dither_biases(biases, x, y, false);
+    const __m128i bias = _mm_loadu_si128(reinterpret_cast<const __m128i*>(biases));
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i lo = to_argb4444_sse2(_mm_adds_epu8(argb4444_scaled_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i))), bias));
+        __m128i hi = to_argb4444_sse2(_mm_adds_epu8(argb4444_scaled_sse2(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 4))), bias));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_xor_si128(_mm_packs_epi32(lo, hi), _mm_set1_epi16(-0x8000)));
+    }
+    return i;
+}
+
+static inline __m128i from_rgb565_sse2(__m128i c)
+{
+    __m128i b = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 3), _mm_set1_epi32(0xf8)),
+                             _mm_and_si128(_mm_srli_epi32(c, 2), _mm_set1_epi32(0x7)));
+    __m128i g = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 5), _mm_set1_epi32(0xfc00)),
+                             _mm_and_si128(_mm_srli_epi32(c, 1), _mm_set1_epi32(0x300)));
+    __m128i r = _mm_or_si128(_mm_and_si128(_mm_slli_epi32(c, 8), _mm_set1_epi32(0xf80000)),
+                             _mm_and_si128(_mm_slli_epi32(c, 3), _mm_set1_epi32(0x70000)));
+    return _mm_or_si128(_mm_or_si128(b, g), _mm_or_si128(r, _mm_set1_epi32(0xff000000)));
+}
+
+static int from_rgb565_simd(uint32_t* dst, const uint16_t* src, int count)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         from_rgb565_sse2(_mm_unpacklo_epi16(c, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4),
+                         from_rgb565_sse2(_mm_unpackhi_epi16(c, zero)));
+    }
+    return i;
+}
+
+#else
+
+static int premultiply_simd(uint32_t*, const uint32_t*, int)
+{
+    return 0;
+}
+
+static int mirror_simd(uint32_t*, const uint32_t*, int)
+{
+    return 0;
+}
+
+static int lerp_simd(uint32_t*, const uint32_t*, const uint32_t*, int, int)
+{
+    return 0;
+}
+
+static int to_rgb565_simd(uint16_t*, const uint32_t*, int)
+{
+    return 0;
+}
+
+static int from_rgb565_simd(uint32_t*, const uint16_t*, int)
+{
+    return 0;
+}
+
+static int to_rgb565_dither_simd(uint16_t*, const uint32_t*, int, int, int)
+{
+    return 0;
+}
+
+static int to_argb4444_dither_simd(uint16_t*, const uint32_t*, int, int, int)
+{
+    return 0;
+}
+
+#endif
+
+const char* PixelKernels::simd()
+{
+#if defined(PIXELKERNELS_NEON)
+    return "neon";
+#elif defined(PIXELKERNELS_AVX2)
+    return "avx2";
+#elif defined(PIXELKERNELS_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+void PixelKernels::setSimdEnabled(bool enabled)
+{
+    s_simd = enabled;
+}
+
+bool PixelKernels::simdEnabled()
+{
+    return s_simd;
+}
+
+void PixelKernels::premultiply(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = s_simd ? premultiply_simd(dst, src, count) : 0;
+    for (; i < count; i++)
+        dst[i] = premultiply_pixel(src[i]);
+}
+
+void PixelKernels::mirror(uint32_t* dst, const uint32_t* src, int count)
+{
+    int i = s_simd ? mirror_simd(dst, src, count) : 0;
+    for (; i < count; i++)
+        dst[i] = src[count - 1 - i];
+}
+
+void PixelKernels::lerp(uint32_t* dst, const uint32_t* a, const uint32_t* b, int weight, int count)
+{
+    int i = s_simd ? lerp_simd(dst, a, b, weight, count) : 0;
+    for (; i < count; i++)
+        dst[i] = lerp_pixel(a[i], b[i], weight);
+}
+
+void PixelKernels::toRgb565(uint16_t* dst, const uint32_t* src, int count)
+{
+    int i = s_simd ? to_rgb565_simd(dst, src, count) : 0;
+    for (; i < count; i++)
+        dst[i] = to_rgb565_pixel(src[i]);
+}
+
+void PixelKernels::fromRgb565(uint32_t* dst, const uint16_t* src, int count)
+{
+    int i = s_simd ? from_rgb565_simd(dst, src, count) : 0;
+    for (; i < count; i++)
+        dst[i] = from_rgb565_pixel(src[i]);
+}
+
+void PixelKernels::toRgb565Dithered(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    int i = s_simd ? to_rgb565_dither_simd(dst, src, count, x, y) : 0;
+    for (; i < count; i++)
+        dst[i] = to_rgb565_pixel(adds_pixel(rgb565_scaled(src[i]),
+                                            rgb565_bias(BAYER[y & 3][(x + i) & 3])));
+}
+
+void PixelKernels::toArgb4444Dithered(uint16_t* dst, const uint32_t* src, int count, int x, int y)
+{
+    int i = s_simd ? to_argb4444_dither_simd(dst, src, count, x, y) : 0;
+    for (; i < count; i++)
+        dst[i] = to_argb4444_pixel(adds_pixel(argb4444_scaled(src[i]),
+                                                      argb4444_bias(BAYER[y & 3][(x + i) & 3])));
+}
+
+/**
+ * @brief Fixed point 16.16 sample positions for bilinear scaling along one axis.
+ *
+ * Pixel centers are aligned, so an exact 2:1 downscale averages pairs of pixels.
+ */
+struct SampleTable
+{
+    SampleTable(int from, int to)
+        : index(to),
+          weight(to)
+    {
+        int step = (from << 16) / to;
+        int pos = step / 2 - 0x8000;
+
+        for (int i = 0; i < to; i++, pos += step)
+        {
+            int p = pos < 0 ? 0 : pos;
+            index[i] = p >> 16;
+            weight[i] = (p >> 8) & 0xff;
+            if (index[i] >= from - 1)
+            {
+                index[i] = from - 1;
+                weight[i] = 0;
+            }
+        }
+    }
+
+    std::vector<int> index;
+    std::vector<int> weight;
+};
+
+bool PixelKernels::blit(const QImage& src, QImage& dst, const QSize& size,
+                        bool horizontal, bool vertical, bool dither)
+{
+    if (src.format() != QImage::Format_ARGB32_Premultiplied ||
+        (dst.format() != QImage::Format_ARGB32_Premultiplied &&
+         dst.format() != QImage::Format_RGB16 &&
+         (dst.format() != QImage::Format_ARGB4444_Premultiplied || !dither)))
+        return false;
+
+    const int width = size.width();
+    const int height = size.height();
+    const int columns = qMin(width, dst.width());
+    const int lines = qMin(height, dst.height());
+    if (columns <= 0 || lines <= 0 || src.isNull())
+        return true;
+
+    const bool scaled = size != src.size();
+    const bool direct = dst.format() == QImage::Format_ARGB32_Premultiplied;
+
+    std::vector<uint32_t> blend;
+    std::vector<uint32_t> row;
+    std::vector<uint32_t> mirrored;
+    if (scaled)
+    {
+        blend.resize(src.width());
+        row.resize(width);
+    }
+    if (horizontal)
+        mirrored.resize(width);
+
+    SampleTable xs(scaled ? src.width() : 1, scaled ? width : 1);
+    SampleTable ys(scaled ? src.height() : 1, scaled ? height : 1);
+
+    for (int y = 0; y < lines; y++)
+    {
+        /*
+         * Output rows are mirrored, so the source row they sample is too.
+         */
+        int sy = vertical ? height - 1 - y : y;
+
+        uint32_t* out = direct ? reinterpret_cast<uint32_t*>(dst.scanLine(y)) : 0;
+        const uint32_t* line;
+
+        if (scaled)
+        {
+            const uint32_t* a = reinterpret_cast<const uint32_t*>(src.constScanLine(ys.index[sy]));
+            if (ys.weight[sy])
+            {
+                const uint32_t* b =
+                    reinterpret_cast<const uint32_t*>(src.constScanLine(ys.index[sy] + 1));
+                lerp(blend.data(), a, b, ys.weight[sy], src.width());
+                a = blend.data();
+            }
+
+            /*
+             * Without anything else to do, the horizontal pass writes straight into the
+             * framebuffer.
+             */
+            uint32_t* target = (direct && !horizontal && columns == width) ? out : row.data();
+            for (int x = 0; x < width; x++)
+            {
+                int i = xs.index[x];
+                target[x] = xs.weight[x] ? lerp_pixel(a[i], a[i + 1], xs.weight[x]) : a[i];
+            }
+
+            if (target == out)
+                continue;
+
+            line = row.data();
+        }
+        else
+        {
+            line = reinterpret_cast<const uint32_t*>(src.constScanLine(sy));
+        }
+
+        if (horizontal)
+        {
+            if (direct && columns == width)
+            {
+                mirror(out, line, width);
+                continue;
+            }
+
+            mirror(mirrored.data(), line, width);
+            line = mirrored.data();
+        }
+
+        uint16_t* out16 = reinterpret_cast<uint16_t*>(dst.scanLine(y));
+        if (direct)
+            memcpy(out, line, columns * sizeof(uint32_t));
+        else if (dst.format() == QImage::Format_ARGB4444_Premultiplied)
+            toArgb4444Dithered(out16, line, columns, 0, y);
+        else if (dither)
+            toRgb565Dithered(out16, line, columns, 0, y);
+        else
+            toRgb565(out16, line, columns);
+    }
+
+    return true;
+}
+
+QImage PixelKernels::premultiplied(const QImage& image)
+{
+    if (image.format() != QImage::Format_ARGB32)
+        return image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QImage result(image.size(), QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < image.height(); y++)
+        premultiply(reinterpret_cast<uint32_t*>(result.scanLine(y)),
+                    reinterpret_cast<const uint32_t*>(image.constScanLine(y)), image.width());
+
+    return result;
+}
+
+PixelKernels::Usage PixelKernels::usage(const QImage& image)
+{
+    QImage pixels = image.format() == QImage::Format_ARGB32_Premultiplied ?
+        image : premultiplied(image);
+
+    /*
+     * Open addressing set of the colors seen so far.  It never holds more than MAX_COLORS + 1
+     * of them, so it stays at most a quarter full.
+     */
+    const uint32_t size = 1024;
+    std::vector<uint32_t> table(size);
+    std::vector<bool> used(size);
+
+    Usage result = {true, 0, 0};
+    bool first = true;
+    uint32_t last = 0;
+
+    for (int y = 0; y < pixels.height(); y++)
+    {
+        const uint32_t* line = reinterpret_cast<const uint32_t*>(pixels.constScanLine(y));
+        for (int x = 0; x < pixels.width(); x++)
+        {
+            uint32_t p = line[x];
+            if (p < 0xff000000)
+                result.opaque = false;
+
+            /*
+             * Runs of the same color are common, and only have to be looked up once.
+             */
+            if ((p == last && !first) || result.colors > MAX_COLORS)
+                continue;
+            first = false;
+            last = p;
+
+            uint32_t h = (p * 2654435761u) >> 22;
+            while (used[h] && table[h] != p)
+                h = (h + 1) & (size - 1);
+
+            if (!used[h])
+            {
+                used[h] = true;
+                table[h] = p;
+                result.colors++;
+
+                /*
+                 * ARGB4444 is expanded by the display as v * 17.
+                 */
+                for (int shift = 0; shift < 32; shift += 8)
+                {
+                    int c = (p >> shift) & 0xff;
+                    int v = (c * 15 + 127) / 255;
+                    result.nibbleError = std::max(result.nibbleError, std::abs(c - v * 17));
+                }
+            }
+        }
+
+        if (!result.opaque && result.colors > MAX_COLORS)
+            break;
+    }
+
+    return result;
+}
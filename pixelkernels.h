@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <QImage>
+#include <QSize>
+#include <cstdint>
+
+/**
+ * @brief The PixelKernels class
+ *
+ * Pixel loops used to prepare images and draw them into plane framebuffers, without the
+ * temporary images QImage::scaled(), QImage::mirrored() and QImage::convertToFormat() allocate.
+ *
+ * Every kernel has a scalar reference version and a SIMD version, which is NEON on ARM and
+ * SSE2 or AVX2 on the host.  The SIMD instruction set is picked at compile time.  The results
+ * of both versions are identical.
+ *
+ * 32 bit pixels are QImage::Format_ARGB32_Premultiplied unless noted.  Source and destination
+ * must not overlap.
+ */
+class PixelKernels
+{
+public:
+
+    /**
+     * @brief Name of the SIMD instruction set compiled in, or "scalar".
+     */
+    static const char* simd();
+
+    /**
+     * @brief Turn the SIMD versions off to run the scalar reference versions.
+     */
+    static void setSimdEnabled(bool enabled);
+
+    static bool simdEnabled();
+
+    /**
+     * @brief Convert ARGB32 to ARGB32_Premultiplied, rounding the same way Qt does.
+     */
+    static void premultiply(uint32_t* dst, const uint32_t* src, int count);
+
+    /**
+     * @brief Reverse the order of pixels in a row.
+     */
+    static void mirror(uint32_t* dst, const uint32_t* src, int count);
+
+    /**
+     * @brief Blend two rows together.
+     * @param weight Weight of b, from 0 to 256.
+     */
+    static void lerp(uint32_t* dst, const uint32_t* a, const uint32_t* b, int weight, int count);
+
+    /**
+     * @brief Convert ARGB32 to RGB565 by truncation, the same way Qt does.
+     */
+    static void toRgb565(uint16_t* dst, const uint32_t* src, int count);
+
+    /**
+     * @brief Convert RGB565 to opaque ARGB32 by bit replication, the same way Qt does.
+     */
+    static void fromRgb565(uint32_t* dst, const uint16_t* src, int count);
+
+    /**
+     * @brief Convert ARGB32 to RGB565 with a 4x4 ordered dither.
+     *
+     * Each channel gets up to one step of its 16 bit precision added before it is truncated,
+     * so flat areas average out to their real color instead of banding.
+     *
+     * @param x Position of the first pixel in the image, the pattern is anchored to the image.
+     * @param y Row of the image.
+     */
+    static void toRgb565Dithered(uint16_t* dst, const uint32_t* src, int count, int x, int y);
+
+    /**
+     * @brief Convert ARGB32 to ARGB4444_Premultiplied with a 4x4 ordered dither.
+     */
+    static void toArgb4444Dithered(uint16_t* dst, const uint32_t* src, int count, int x, int y);
+
+    /**
+     * @brief Draw an image into the top left corner of another one.
+     *
+     * The image is bilinear scaled to size, mirrored, and converted to the format of dst in a
+     * single pass, one row at a time.
+     *
+     * @param dither Convert to 16 bit formats with an ordered dither instead of truncating.
+     * @return false if the combination of formats is not supported, and nothing was drawn.
+     * src must be ARGB32_Premultiplied, dst ARGB32_Premultiplied or RGB16, or
+     * ARGB4444_Premultiplied when dithering.
+     */
+    static bool blit(const QImage& src, QImage& dst, const QSize& size,
+                     bool horizontal = false, bool vertical = false, bool dither = false);
+
+    /**
+     * @brief Return a copy of an image in ARGB32_Premultiplied.
+     */
+    static QImage premultiplied(const QImage& image);
+
+    /**
+     * @brief What of its pixel format an image actually uses.
+     */
+    struct Usage
+    {
+        /** Every pixel is fully opaque. */
+        bool opaque;
+        /** Distinct pixel values, counted up to MAX_COLORS + 1. */
+        int colors;
+        /** Largest distance of a channel of those colors from the nearest 4 bit level. */
+        int nibbleError;
+    };
+
+    /**
+     * @brief Colors a palette based format holds, and the most an image can use to count as
+     * low color.
+     */
+    static const int MAX_COLORS = 256;
+
+    /**
+     * @brief Largest nibbleError of an image that can be held in ARGB4444 without visibly
+     * changing it, a quarter of a 4 bit step.
+     */
+    static const int MAX_NIBBLE_ERROR = 4;
+
+    /**
+     * @brief Scan an image for alpha, the number of colors it uses and how close they are
+     * to 4 bit levels.
+     *
+     * A plain scalar loop, it runs once per asset when it is loaded.
+     */
+    static Usage usage(const QImage& image);
+
+private:
+
+    static bool s_simd;
+};
+
+#endif // PIXELKERNELS_H
@@ -0,0 +1,355 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PLANEBACKEND_H
+#define PLANEBACKEND_H
+
+#include "pixelformat.h"
+#ifndef WILDWEST_SOFTWARE_ONLY
+#include <planes/plane.h>
+#endif
+#include <QImage>
+#include <QSize>
+#include <string>
+#include <vector>
+#include <climits>
+
+#ifdef WILDWEST_SOFTWARE_ONLY
+/*
+ * Without libplanes there is no KMS backend, and planes are only ever handles.
+ */
+struct plane_data
+{
+    int unused;
+};
+#endif
+
+/**
+ * @brief Properties of a plane that are tracked by the PlaneManager.
+ *
+ * Fields that have never been set hold INT_MIN, or a negative value for sizes and scale.
+ */
+struct PlaneState
+{
+    int x;
+    int y;
+    double scale;
+    int pan_x;
+    int pan_y;
+    int pan_width;
+    int pan_height;
+    /** Index of the framebuffer to scan out, for planes with more than one. */
+    int buffer;
+    /** Bitmask of Reflect* values, mirroring the plane as it is scanned out. */
+    int reflection;
+    /** Opacity of the whole plane, from 0 to 255. */
+    int alpha;
+
+    enum
+    {
+        ReflectX = 1 << 0,
+        ReflectY = 1 << 1,
+    };
+
+    static PlaneState unset()
+    {
+        return {INT_MIN, INT_MIN, -1.0, INT_MIN, INT_MIN, -1, -1, -1, -1, -1};
+    }
+};
+
+/**
+ * @brief A change to a single plane that is part of a commit.
+ */
+struct PlaneUpdate
+{
+    enum
+    {
+        DirtyPos = 1 << 0,
+        DirtyScale = 1 << 1,
+        DirtyPanPos = 1 << 2,
+        DirtyPanSize = 1 << 3,
+        /** Plane must be fully applied, not just updated. */
+        DirtyFull = 1 << 4,
+        /** Flip to another framebuffer. */
+        DirtyBuffer = 1 << 5,
+        /** Content of the displayed framebuffer was written in place. */
+        DirtyContent = 1 << 6,
+        DirtyReflection = 1 << 7,
+        DirtyAlpha = 1 << 8,
+    };
+
+    struct plane_data* plane;
+    /** Requested state of the plane. */
+    PlaneState state;
+    /** Bitmask of fields in state that changed. */
+    unsigned int dirty;
+    /** Set by the backend when the update made it to the hardware. */
+    bool applied;
+};
+
+/**
+ * @brief Bookkeeping of the framebuffers of a plane that flips between several.
+ *
+ * A framebuffer is either shown (front), queued in a commit and waiting for the flip to
+ * happen (pending), acquired by someone rendering into it, or free.
+ */
+struct BufferRing
+{
+    int count;
+    int front;
+    int pending;
+    unsigned int acquired;
+
+    BufferRing()
+        : count(1),
+          front(0),
+          pending(-1),
+          acquired(0)
+    {}
+
+    int acquire()
+    {
+        for (int i = 0; i < count; i++)
+        {
+            if (i != front && i != pending && !(acquired & (1u << i)))
+            {
+                acquired |= 1u << i;
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    void release(int index)
+    {
+        if (index >= 0)
+            acquired &= ~(1u << index);
+    }
+
+    void queue(int index)
+    {
+        release(index);
+        pending = index;
+    }
+
+    void flipped()
+    {
+        if (pending >= 0)
+        {
+            front = pending;
+            pending = -1;
+        }
+    }
+};
+
+/**
+ * @brief The PlaneBackend class
+ *
+ * Interface between the PlaneManager and whatever actually shows the planes.  The manager
+ * deals with transactions and shadow state, a backend only has to create planes, give access
+ * to their framebuffers, and push commits.
+ *
+ * Planes are always handled as struct plane_data pointers, but a backend other than the KMS
+ * one is free to treat them as opaque handles.
+ */
+class PlaneBackend
+{
+public:
+
+    virtual ~PlaneBackend()
+    {}
+
+    /**
+     * @brief Create the planes described by a config file.
+     * @param configfile
+     * @param planes Filled with the created planes.
+     * @return
+     */
+    virtual bool load(const std::string& configfile, std::vector<plane_data*>& planes) = 0;
+
+    /**
+     * @brief Name of a plane as given in the config file.
+     */
+    virtual std::string name(struct plane_data* plane) const = 0;
+
+    /**
+     * @brief Create a plane that is not in the config file.
+     * @return 0 if the backend can only show the planes in the config file.
+     */
+    virtual struct plane_data* create(const std::string& name, int width, int height, int zpos)
+    {
+        Q_UNUSED(name);
+        Q_UNUSED(width);
+        Q_UNUSED(height);
+        Q_UNUSED(zpos);
+        return 0;
+    }
+
+    /**
+     * @brief Push updates to the display.
+     * @param updates
+     * @return Number of commits pushed.
+     */
+    virtual int commit(std::vector<PlaneUpdate>& updates) = 0;
+
+    /**
+     * @brief Map the framebuffer of a plane that is currently shown.
+     */
+    virtual void* map(struct plane_data* plane) = 0;
+
+    /**
+     * @brief Reallocate the framebuffer of a plane.
+     */
+    virtual bool reallocate(struct plane_data* plane, int width, int height, uint32_t format) = 0;
+
+    virtual int width(struct plane_data* plane) const = 0;
+    virtual int height(struct plane_data* plane) const = 0;
+    virtual uint32_t format(struct plane_data* plane) const = 0;
+
+    /**
+     * @brief Pixel formats a plane can be reallocated in.
+     */
+    virtual std::vector<uint32_t> formats(struct plane_data* plane) const
+    {
+        return {format(plane)};
+    }
+
+    /**
+     * @brief Bytes per line of the framebuffer of a plane.
+     */
+    virtual int pitch(struct plane_data* plane) const = 0;
+
+    /**
+     * @brief Give a plane its own set of framebuffers to flip between.
+     * @param plane
+     * @param count Number of framebuffers, 1 goes back to the single framebuffer.
+     * @return false if the backend can not flip this plane.
+     */
+    virtual bool setBufferCount(struct plane_data* plane, int count) = 0;
+
+    virtual int bufferCount(struct plane_data* plane) const = 0;
+
+    /**
+     * @brief Get a framebuffer that is neither shown nor waiting to be shown.
+     * @return Index of the framebuffer, or -1 if none is free yet.
+     */
+    virtual int acquireBuffer(struct plane_data* plane) = 0;
+
+    /**
+     * @brief Give back a framebuffer from acquireBuffer() without flipping to it.
+     */
+    virtual void releaseBuffer(struct plane_data* plane, int index) = 0;
+
+    /**
+     * @brief Map one of the framebuffers of a plane.
+     */
+    virtual void* mapBuffer(struct plane_data* plane, int index) = 0;
+
+    /**
+     * @brief Called when a flip requested by a commit has hit the screen.
+     */
+    virtual void flipped()
+    {}
+
+    /**
+     * @brief The backend that requests page flip events, and passes itself as their user
+     * data.  A backend that wraps another one returns the one it wraps.
+     */
+    virtual PlaneBackend* flipBackend()
+    {
+        return this;
+    }
+
+    /**
+     * @brief True if the display controller reads the plane itself, false if it is
+     * composited into another plane.
+     */
+    virtual bool scannedOut(struct plane_data* plane) const
+    {
+        Q_UNUSED(plane);
+        return true;
+    }
+
+    /**
+     * @brief A hardware plane other planes are composited into, hidden from the manager.
+     */
+    struct SharedPlane
+    {
+        struct plane_data* plane;
+        PlaneState state;
+    };
+
+    /**
+     * @brief Hardware planes the backend composites other planes into.
+     */
+    virtual std::vector<SharedPlane> sharedPlanes() const
+    {
+        return {};
+    }
+
+    /**
+     * @brief Bytes the backend copied into hardware framebuffers for a plane on its own, such
+     * as when compositing it, since the last call.
+     */
+    virtual qint64 takeUploaded(struct plane_data* plane)
+    {
+        Q_UNUSED(plane);
+        return 0;
+    }
+
+    /**
+     * @brief Bitmask of the PlaneState::Reflect* values a plane can do while scanning out.
+     */
+    virtual int reflections(struct plane_data* plane) const
+    {
+        Q_UNUSED(plane);
+        return 0;
+    }
+
+    /**
+     * @brief True if a mapped framebuffer is not what is scanned out, so writes to it only
+     * show up with the next commit.
+     */
+    virtual bool copiesContent(struct plane_data* plane) const
+    {
+        Q_UNUSED(plane);
+        return false;
+    }
+
+    /**
+     * @brief True if the opacity of a plane can be set as a whole.
+     */
+    virtual bool hasAlpha(struct plane_data* plane) const
+    {
+        Q_UNUSED(plane);
+        return false;
+    }
+
+    /**
+     * @brief DRM file descriptor for vblank events, or -1 if there is none.
+     */
+    virtual int fd() const
+    {
+        return -1;
+    }
+
+    /**
+     * @brief Size of the screen, or an invalid size if the backend follows Qt.
+     */
+    virtual QSize screenSize() const
+    {
+        return QSize();
+    }
+
+    /**
+     * @brief Perform an engine step, if the backend has one.
+     */
+    virtual void step()
+    {}
+};
+
+#endif // PLANEBACKEND_H
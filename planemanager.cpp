@@ -5,66 +5,109 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include "planemanager.h"
-#include <planes/engine.h>
-#include <planes/kms.h>
-#include <QApplication>
+#include "framescheduler.h"
+#ifndef WILDWEST_SOFTWARE_ONLY
+#include "kmsplanebackend.h"
+#endif
+#include "softwareplanebackend.h"
+#include "trace.h"
+#include "virtualplanebackend.h"
 #include <QDebug>
-#include <qpa/qplatformnativeinterface.h>
+#include <QGuiApplication>
+#include <QRectF>
+#include <QScreen>
 
-/**
- * @brief This requires a custom version of Qt to work with a patch for getting the DRI
- * file descriptor used internally by the linuxfb backend configured in DRM mode.
- */
-static int get_dri_fd()
+PlaneManager::PlaneManager(QObject* parent)
+    : QObject(parent),
+      m_depth(0),
+      m_pending(false),
+      m_commits(0),
+      m_commitTime(0),
+      m_windowStart(-1),
+      m_budget(0),
+      m_overBudget(false),
+      m_scheduler(new FrameScheduler(*this, this))
 {
-    static int dri_fd = -1;
-    if (dri_fd == -1)
-    {
-        void *p = reinterpret_cast<QApplication*>(QApplication::instance())->
-                platformNativeInterface()->nativeResourceForIntegration("dri_fd");
-        if (p)
-            dri_fd = (int)(qintptr)p;
-    }
-    return dri_fd;
 }
 
-PlaneManager::PlaneManager()
+void PlaneManager::setBackend(std::unique_ptr<PlaneBackend> backend)
 {
+    m_backend = std::move(backend);
 }
 
 bool PlaneManager::load(const std::string& configfile)
 {
-    int fd = get_dri_fd();
-    if (fd < 0)
+    if (!m_backend)
     {
-        qDebug() << "No dri fd available from platform";
-        return false;
-    }
-    else
-    {
-        qDebug() << "dri fd = " << fd;
+        std::unique_ptr<PlaneBackend> hardware;
+#ifdef WILDWEST_SOFTWARE_ONLY
+        hardware.reset(new SoftwarePlaneBackend());
+#else
+        if (qgetenv("WILDWEST_PLANES") == "software")
+            hardware.reset(new SoftwarePlaneBackend());
+        else
+            hardware.reset(new KmsPlaneBackend());
+#endif
+
+        /*
+         * Passes everything through to the hardware unless the config file declares
+         * virtual planes.
+         */
+        m_backend.reset(new VirtualPlaneBackend(std::move(hardware)));
     }
 
-    m_device.reset(kms_device_open(fd));
-    if (!m_device)
+    if (!m_backend->load(configfile, m_planes))
         return false;
 
-    m_planes.resize(m_device->num_planes, 0);
+    m_shadows.clear();
+    for (auto i: m_planes)
+        if (i)
+            addShadow(i);
+
+    m_scheduler->setBackend(m_backend->flipBackend());
+
+    return true;
+}
 
-    return !(engine_load_config(configfile.c_str(), m_device.get(), m_planes.data(), m_planes.size(), 0));
+void PlaneManager::addShadow(struct plane_data* plane)
+{
+    PlaneShadow shadow;
+    shadow.plane = plane;
+    shadow.name = m_backend->name(plane);
+    shadow.pending = PlaneState::unset();
+    shadow.committed = shadow.pending;
+    shadow.dirty = PlaneUpdate::DirtyFull;
+    shadow.uploaded = 0;
+    shadow.uploadRate = 0;
+    m_shadows.push_back(shadow);
+}
+
+struct plane_data* PlaneManager::create(const std::string& name, int width, int height, int zpos)
+{
+    if (!m_backend || get(name))
+        return 0;
+
+    struct plane_data* plane = m_backend->create(name, width, height, zpos);
+    if (!plane)
+        return 0;
+
+    m_planes.push_back(plane);
+    addShadow(plane);
+
+    return plane;
 }
 
 void PlaneManager::step()
 {
-    engine_run_once(m_device.get(), m_planes.data(), m_planes.size(), 0);
+    if (m_backend)
+        m_backend->step();
 }
 
 struct plane_data* PlaneManager::get(const std::string& name)
 {
-    for (auto i: m_planes)
-        if (i)
-            if (std::string(i->name) == name)
-                return i;
+    for (auto& i: m_shadows)
+        if (i.name == name)
+            return i.plane;
 
     return 0;
 }
@@ -77,12 +120,558 @@ struct plane_data* PlaneManager::get(unsigned int index)
     return 0;
 }
 
-PlaneManager::~PlaneManager()
+PlaneManager::PlaneShadow* PlaneManager::shadow(struct plane_data* plane)
 {
-    for (auto i: m_planes)
-        if (i)
-            free(i);
+    /*
+     * There are only a handful of planes, a linear search beats anything fancier.
+     */
+    for (auto& i: m_shadows)
+        if (i.plane == plane)
+            return &i;
+
+    return 0;
+}
+
+const PlaneManager::PlaneShadow* PlaneManager::shadow(struct plane_data* plane) const
+{
+    for (auto& i: m_shadows)
+        if (i.plane == plane)
+            return &i;
+
+    return 0;
+}
+
+void PlaneManager::markDirty(PlaneShadow* shadow)
+{
+    Q_UNUSED(shadow);
+
+    if (m_depth || m_pending)
+        return;
+
+    /*
+     * Not inside of an explicit transaction, so collect everything that happens until we
+     * get back to the event loop into one commit.
+     */
+    m_pending = true;
+    QMetaObject::invokeMethod(this, "commitPending", Qt::QueuedConnection);
+}
+
+void PlaneManager::setPos(struct plane_data* plane, int x, int y)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->pending.x = x;
+    s->pending.y = y;
+
+    if (s->committed.x != x || s->committed.y != y)
+    {
+        s->dirty |= PlaneUpdate::DirtyPos;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyPos;
+    }
+}
+
+void PlaneManager::setScale(struct plane_data* plane, double scale)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->pending.scale = scale;
+
+    if (s->committed.scale != scale)
+    {
+        s->dirty |= PlaneUpdate::DirtyScale;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyScale;
+    }
+}
+
+void PlaneManager::setPanPos(struct plane_data* plane, int x, int y)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->pending.pan_x = x;
+    s->pending.pan_y = y;
+
+    if (s->committed.pan_x != x || s->committed.pan_y != y)
+    {
+        s->dirty |= PlaneUpdate::DirtyPanPos;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyPanPos;
+    }
+}
+
+void PlaneManager::setPanSize(struct plane_data* plane, int width, int height)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->pending.pan_width = width;
+    s->pending.pan_height = height;
+
+    if (s->committed.pan_width != width || s->committed.pan_height != height)
+    {
+        s->dirty |= PlaneUpdate::DirtyPanSize;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyPanSize;
+    }
+}
+
+void PlaneManager::setReflection(struct plane_data* plane, int reflection)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->pending.reflection = reflection;
+
+    /*
+     * Never having set a reflection is the same as not reflecting.
+     */
+    int committed = s->committed.reflection < 0 ? 0 : s->committed.reflection;
+    if (committed != reflection)
+    {
+        s->dirty |= PlaneUpdate::DirtyReflection;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyReflection;
+    }
+}
+
+int PlaneManager::reflections(struct plane_data* plane) const
+{
+    return m_backend->reflections(plane);
+}
+
+void PlaneManager::setAlpha(struct plane_data* plane, int alpha)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    alpha = qBound(0, alpha, 255);
+    s->pending.alpha = alpha;
+
+    /*
+     * Never having set alpha is the same as being opaque.
+     */
+    int committed = s->committed.alpha < 0 ? 255 : s->committed.alpha;
+    if (committed != alpha)
+    {
+        s->dirty |= PlaneUpdate::DirtyAlpha;
+        markDirty(s);
+    }
+    else
+    {
+        s->dirty &= ~PlaneUpdate::DirtyAlpha;
+    }
+}
+
+bool PlaneManager::hasAlpha(struct plane_data* plane) const
+{
+    return m_backend->hasAlpha(plane);
+}
+
+void PlaneManager::invalidate(struct plane_data* plane)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->dirty |= PlaneUpdate::DirtyFull;
+    markDirty(s);
+}
+
+void PlaneManager::damage(struct plane_data* plane)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    s->dirty |= PlaneUpdate::DirtyContent;
+    markDirty(s);
+}
+
+void* PlaneManager::map(struct plane_data* plane)
+{
+    void* bits = m_backend->map(plane);
+
+    /*
+     * Whatever is written to the framebuffer has to be pushed out by a commit.
+     */
+    if (bits && m_backend->copiesContent(plane))
+        damage(plane);
+
+    return bits;
+}
+
+bool PlaneManager::reallocate(struct plane_data* plane, int width, int height)
+{
+    return reallocate(plane, width, height, m_backend->format(plane));
+}
+
+bool PlaneManager::reallocate(struct plane_data* plane, int width, int height, uint32_t format)
+{
+    if (!m_backend->reallocate(plane, width, height, format))
+        return false;
+
+    invalidate(plane);
+
+    return true;
+}
+
+bool PlaneManager::setBufferCount(struct plane_data* plane, int count)
+{
+    if (!m_backend->setBufferCount(plane, count))
+        return false;
+
+    PlaneShadow* s = shadow(plane);
+    if (s)
+        s->pending.buffer = -1;
 
-    if (m_device)
-        kms_device_close(m_device.get());
+    invalidate(plane);
+
+    return true;
+}
+
+int PlaneManager::bufferCount(struct plane_data* plane) const
+{
+    return m_backend->bufferCount(plane);
+}
+
+int PlaneManager::acquireBuffer(struct plane_data* plane)
+{
+    return m_backend->acquireBuffer(plane);
+}
+
+void PlaneManager::releaseBuffer(struct plane_data* plane, int index)
+{
+    m_backend->releaseBuffer(plane, index);
+}
+
+void* PlaneManager::mapBuffer(struct plane_data* plane, int index)
+{
+    void* bits = m_backend->mapBuffer(plane, index);
+
+    if (bits && m_backend->copiesContent(plane))
+        damage(plane);
+
+    return bits;
+}
+
+void PlaneManager::flip(struct plane_data* plane, int index)
+{
+    PlaneShadow* s = shadow(plane);
+    if (!s)
+        return;
+
+    /*
+     * Flipping twice in the same frame gives the first buffer back, it was never shown.
+     */
+    if ((s->dirty & PlaneUpdate::DirtyBuffer) && s->pending.buffer != index)
+        m_backend->releaseBuffer(plane, s->pending.buffer);
+
+    s->pending.buffer = index;
+    s->dirty |= PlaneUpdate::DirtyBuffer;
+    markDirty(s);
+}
+
+std::string PlaneManager::name(struct plane_data* plane) const
+{
+    return m_backend->name(plane);
+}
+
+int PlaneManager::width(struct plane_data* plane) const
+{
+    return m_backend->width(plane);
+}
+
+int PlaneManager::height(struct plane_data* plane) const
+{
+    return m_backend->height(plane);
+}
+
+uint32_t PlaneManager::format(struct plane_data* plane) const
+{
+    return m_backend->format(plane);
+}
+
+std::vector<uint32_t> PlaneManager::formats(struct plane_data* plane) const
+{
+    return m_backend->formats(plane);
+}
+
+int PlaneManager::pitch(struct plane_data* plane) const
+{
+    return m_backend->pitch(plane);
+}
+
+void PlaneManager::beginFrame()
+{
+    m_depth++;
+}
+
+bool PlaneManager::commitFrame()
+{
+    if (m_depth > 1)
+    {
+        m_depth--;
+        return true;
+    }
+
+    /*
+     * Keep the transaction open while content is flushed, so writes made from
+     * aboutToCommit() end up in this commit instead of scheduling another one.
+     */
+    m_depth = 1;
+    emit aboutToCommit();
+    m_depth = 0;
+
+    sampleBandwidth();
+
+    TRACE_SCOPE(Trace::Planes, "commit");
+
+    m_updates.clear();
+    for (auto& s: m_shadows)
+        if (s.dirty)
+            m_updates.push_back({s.plane, s.pending, s.dirty, false});
+
+    if (m_updates.empty())
+        return true;
+
+    qint64 start = Trace::now();
+    m_commits += m_backend->commit(m_updates);
+    m_commitTime = Trace::now() - start;
+
+    bool ok = true;
+    for (auto& u: m_updates)
+    {
+        if (!u.applied)
+        {
+            ok = false;
+            continue;
+        }
+
+        PlaneShadow* s = shadow(u.plane);
+        s->committed = u.state;
+        s->dirty = 0;
+    }
+
+    return ok;
+}
+
+void PlaneManager::commitPending()
+{
+    m_pending = false;
+
+    if (!m_depth)
+    {
+        m_depth = 1;
+        commitFrame();
+    }
+}
+
+void PlaneManager::addUpload(struct plane_data* plane, qint64 bytes)
+{
+    PlaneShadow* s = shadow(plane);
+    if (s)
+        s->uploaded += bytes;
+}
+
+qint64 PlaneManager::scanout(const PlaneShadow& shadow) const
+{
+    /*
+     * A virtual plane composited into a shared plane is not read by the display controller,
+     * the shared plane is.
+     */
+    if (!m_backend->scannedOut(shadow.plane))
+        return 0;
+
+    return scanout(shadow.plane, shadow.committed);
+}
+
+qint64 PlaneManager::scanout(struct plane_data* plane, const PlaneState& state) const
+{
+    /*
+     * A plane that was never committed is not shown.
+     */
+    if (state.x == INT_MIN || state.y == INT_MIN)
+        return 0;
+
+    int width = state.pan_width > 0 ? state.pan_width : m_backend->width(plane);
+    int height = state.pan_height > 0 ? state.pan_height : m_backend->height(plane);
+    double scale = state.scale > 0 ? state.scale : 1.0;
+
+    /*
+     * The display controller only fetches the part of the plane that ends up on the screen.
+     */
+    QRectF shown(state.x, state.y, width * scale, height * scale);
+    QSize screen = shownScreenSize();
+    if (screen.isValid())
+        shown &= QRectF(QPointF(0, 0), screen);
+
+    double pixels = shown.width() * shown.height() / (scale * scale);
+    return pixels * formatBytesPerPixel(m_backend->format(plane)) *
+        m_scheduler->refreshRate();
+}
+
+qint64 PlaneManager::primaryScanout() const
+{
+    QScreen* qscreen = QGuiApplication::primaryScreen();
+    QSize screen = shownScreenSize();
+    if (!qscreen || !screen.isValid())
+        return 0;
+
+    /*
+     * linuxfb reports 24 for a 32 bit framebuffer without alpha.
+     */
+    int depth = qscreen->depth();
+    int bytes = depth > 16 ? 4 : (depth > 8 ? 2 : 1);
+
+    return (qint64)screen.width() * screen.height() * bytes * m_scheduler->refreshRate();
+}
+
+QSize PlaneManager::shownScreenSize() const
+{
+    QSize screen = screenSize();
+    if (!screen.isValid() && QGuiApplication::primaryScreen())
+        screen = QGuiApplication::primaryScreen()->size();
+    return screen;
+}
+
+PlaneManager::Bandwidth PlaneManager::bandwidth(struct plane_data* plane) const
+{
+    if (!plane)
+        return {primaryScanout(), 0};
+
+    const PlaneShadow* s = shadow(plane);
+    if (!s)
+        return {0, 0};
+
+    return {scanout(*s), s->uploadRate};
+}
+
+PlaneManager::Bandwidth PlaneManager::totalBandwidth() const
+{
+    Bandwidth total = {primaryScanout(), 0};
+    for (auto& s: m_shadows)
+    {
+        total.scanout += scanout(s);
+        total.upload += s.uploadRate;
+    }
+
+    for (auto& shared: m_backend->sharedPlanes())
+        total.scanout += scanout(shared.plane, shared.state);
+
+    return total;
+}
+
+void PlaneManager::setBandwidthBudget(qint64 bytes)
+{
+    m_budget = qMax(0LL, bytes);
+    m_overBudget = false;
+}
+
+void PlaneManager::sampleBandwidth()
+{
+    /*
+     * Frame time instead of the clock, so a Manual scheduler measures the same as a real one.
+     * Switching clocks can move time backwards, which starts the window over.
+     */
+    qint64 now = m_scheduler->time();
+    if (m_windowStart < 0 || now < m_windowStart)
+        m_windowStart = now;
+
+    qint64 elapsed = now - m_windowStart;
+    if (elapsed < BANDWIDTH_WINDOW)
+        return;
+
+    /*
+     * Copies the backend made on its own are picked up once per window.
+     */
+    for (auto plane: m_planes)
+        if (plane)
+            addUpload(plane, m_backend->takeUploaded(plane));
+
+    for (auto& s: m_shadows)
+    {
+        s.uploadRate = s.uploaded * 1000000000LL / elapsed;
+        s.uploaded = 0;
+    }
+    m_windowStart = now;
+
+    if (!m_budget)
+        return;
+
+    qint64 total = totalBandwidth().total();
+    bool over = total > m_budget;
+    if (over && !m_overBudget)
+    {
+        qWarning("plane bandwidth %.1f MB/s is over the budget of %.1f MB/s\n%s",
+                 total / 1000000.0, m_budget / 1000000.0, qPrintable(bandwidthReport()));
+        emit overBudget(total);
+    }
+    m_overBudget = over;
+}
+
+QString PlaneManager::bandwidthReport() const
+{
+    QString out = QString("plane bandwidth at %1 Hz, MB/s:\n  %2 %3 %4\n")
+        .arg(m_scheduler->refreshRate()).arg("plane", -20).arg("scanout", 8).arg("upload", 8);
+
+    qint64 primary = primaryScanout();
+    out += QString("  %1 %2 %3\n").arg("primary", -20)
+        .arg(primary / 1000000.0, 8, 'f', 1).arg(0.0, 8, 'f', 1);
+
+    Bandwidth total = {primary, 0};
+    for (auto& s: m_shadows)
+    {
+        Bandwidth b = {scanout(s), s.uploadRate};
+        out += QString("  %1 %2 %3\n").arg(QString::fromStdString(s.name), -20)
+            .arg(b.scanout / 1000000.0, 8, 'f', 1).arg(b.upload / 1000000.0, 8, 'f', 1);
+
+        total.scanout += b.scanout;
+        total.upload += b.upload;
+    }
+
+    for (auto& shared: m_backend->sharedPlanes())
+    {
+        qint64 b = scanout(shared.plane, shared.state);
+        out += QString("  %1 %2 %3\n")
+            .arg(QString::fromStdString(m_backend->name(shared.plane)) + " (shared)", -20)
+            .arg(b / 1000000.0, 8, 'f', 1).arg(0.0, 8, 'f', 1);
+
+        total.scanout += b;
+    }
+
+    out += QString("  %1 %2 %3\n").arg("total", -20)
+        .arg(total.scanout / 1000000.0, 8, 'f', 1).arg(total.upload / 1000000.0, 8, 'f', 1);
+    if (m_budget)
+        out += QString("  %1 %2\n").arg("budget", -20).arg(m_budget / 1000000.0, 8, 'f', 1);
+
+    return out;
+}
+
+PlaneManager::~PlaneManager()
+{
 }
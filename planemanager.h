@@ -7,24 +7,48 @@
 #ifndef PLANEMANAGER_H
 #define PLANEMANAGER_H
 
-#include <planes/plane.h>
+#include "planebackend.h"
+#include <QObject>
+#include <QString>
 #include <string>
 #include <memory>
 #include <vector>
 
+class FrameScheduler;
+
 /**
  * @brief The PlaneManager class
  *
- * This is a central manager for planes.  It uses libplanes to configure and manage planes.
+ * This is a central manager for planes.  It uses a PlaneBackend to configure and manage
+ * planes, which is libplanes on real hardware.
  *
  * When using this class, you can choose to use the built in config and/or the engine provided
  * by libplanes, or chose not to use it.
+ *
+ * Plane properties should be written through the manager instead of calling libplanes directly.
+ * The manager keeps shadow state for every plane, drops writes that do not change anything, and
+ * pushes all changed planes to the hardware in a single atomic commit per frame.
  */
-class PlaneManager
+class PlaneManager : public QObject
 {
+    Q_OBJECT
+
 public:
 
-    PlaneManager();
+    PlaneManager(QObject* parent = 0);
+
+    /**
+     * @brief Use a specific backend.
+     *
+     * Must be called before load().  If no backend is set, load() picks one based on the
+     * WILDWEST_PLANES environment variable, which can be "kms" (the default) or "software".
+     */
+    void setBackend(std::unique_ptr<PlaneBackend> backend);
+
+    inline PlaneBackend* backend() const
+    {
+        return m_backend.get();
+    }
 
     /**
      * @brief Load a config file to configure the planes.
@@ -47,6 +71,16 @@ public:
      */
     virtual struct plane_data* get(const std::string& name);
 
+    /**
+     * @brief Create a plane that is not in the config file.
+     *
+     * Only possible when the config file declares virtual planes, see VirtualPlaneBackend.
+     *
+     * @param zpos Stacking order among the virtual planes, bottom first.
+     * @return 0 if no plane can be created.
+     */
+    struct plane_data* create(const std::string& name, int width, int height, int zpos);
+
     /**
      * @brief Get a plane by index.
      * @param index
@@ -54,19 +88,345 @@ public:
      */
     virtual struct plane_data* get(unsigned int index);
 
+    /**
+     * @brief File descriptor of the DRM device, or -1 if there is none.
+     */
+    inline int fd() const
+    {
+        return m_backend ? m_backend->fd() : -1;
+    }
+
+    /**
+     * @brief Size of the screen the planes are shown on.
+     *
+     * Invalid if the planes share the screen of the Qt platform.
+     */
+    inline QSize screenSize() const
+    {
+        return m_backend ? m_backend->screenSize() : QSize();
+    }
+
+    /**
+     * @brief The scheduler that drives frames for these planes.
+     */
+    inline FrameScheduler& scheduler()
+    {
+        return *m_scheduler;
+    }
+
+    /**
+     * @brief Begin a frame transaction.
+     *
+     * All plane writes until the matching commitFrame() are collected and committed together.
+     * Transactions nest, and only the outermost commitFrame() touches the hardware.
+     *
+     * Writes made outside of a transaction are not lost, they are collected into an implicit
+     * transaction that is committed when control returns to the event loop.
+     */
+    void beginFrame();
+
+    /**
+     * @brief Commit all planes changed since beginFrame().
+     * @return false if the commit failed.  Failed planes stay dirty and are retried on the
+     * next commit.
+     */
+    bool commitFrame();
+
+    /**
+     * @brief Set the position of a plane on the screen.
+     */
+    void setPos(struct plane_data* plane, int x, int y);
+
+    /**
+     * @brief Set the scale factor of a plane.
+     */
+    void setScale(struct plane_data* plane, double scale);
+
+    /**
+     * @brief Set the position of the pan window inside of the plane framebuffer.
+     */
+    void setPanPos(struct plane_data* plane, int x, int y);
+
+    /**
+     * @brief Set the size of the pan window inside of the plane framebuffer.
+     */
+    void setPanSize(struct plane_data* plane, int width, int height);
+
+    /**
+     * @brief Mirror a plane while it is scanned out.
+     * @param reflection Bitmask of PlaneState::Reflect* values.  Only the ones in
+     * reflections() have any effect.
+     */
+    void setReflection(struct plane_data* plane, int reflection);
+
+    /**
+     * @brief Bitmask of the PlaneState::Reflect* values the hardware can do for a plane.
+     */
+    int reflections(struct plane_data* plane) const;
+
+    /**
+     * @brief Set the opacity of a whole plane, from 0 to 255.
+     *
+     * Has no effect unless hasAlpha() is true for the plane.
+     */
+    void setAlpha(struct plane_data* plane, int alpha);
+
+    bool hasAlpha(struct plane_data* plane) const;
+
+    /**
+     * @brief Force a full apply of the plane on the next commit.
+     *
+     * Must be called after anything that changes the plane outside of the manager.
+     */
+    void invalidate(struct plane_data* plane);
+
+    /**
+     * @brief Note that content of a plane was changed, so a commit happens for it.
+     *
+     * Items use aboutToCommit() to write the content before the commit goes out.
+     */
+    void damage(struct plane_data* plane);
+
+    /**
+     * @brief Map the framebuffer of a plane.
+     */
+    void* map(struct plane_data* plane);
+
+    /**
+     * @brief Reallocate the framebuffer of a plane, keeping its format.
+     */
+    bool reallocate(struct plane_data* plane, int width, int height);
+
+    /**
+     * @brief Reallocate the framebuffer of a plane in another format, one of formats().
+     */
+    bool reallocate(struct plane_data* plane, int width, int height, uint32_t format);
+
+    /**
+     * @brief Give a plane two or three framebuffers to flip between.
+     *
+     * Content is then rendered into a framebuffer from acquireBuffer() and shown with flip(),
+     * which takes effect with the next commit on vblank, so nothing is ever drawn into the
+     * framebuffer being scanned out.
+     *
+     * @return false if the backend can not flip this plane.
+     */
+    bool setBufferCount(struct plane_data* plane, int count);
+
+    int bufferCount(struct plane_data* plane) const;
+
+    /**
+     * @brief Get a framebuffer that is free to render into.
+     * @return Index of the framebuffer, or -1 if all of them are busy.
+     */
+    int acquireBuffer(struct plane_data* plane);
+
+    /**
+     * @brief Give back a framebuffer from acquireBuffer() without showing it.
+     */
+    void releaseBuffer(struct plane_data* plane, int index);
+
+    void* mapBuffer(struct plane_data* plane, int index);
+
+    /**
+     * @brief Show a framebuffer from acquireBuffer() with the next commit.
+     */
+    void flip(struct plane_data* plane, int index);
+
+    /**
+     * @brief Name of a plane as given in the config file.
+     */
+    std::string name(struct plane_data* plane) const;
+
+    int width(struct plane_data* plane) const;
+    int height(struct plane_data* plane) const;
+    uint32_t format(struct plane_data* plane) const;
+
+    /**
+     * @brief Pixel formats the plane can be reallocated in.
+     */
+    std::vector<uint32_t> formats(struct plane_data* plane) const;
+
+    int pitch(struct plane_data* plane) const;
+
+    /**
+     * @brief Number of commits pushed to the hardware so far.
+     */
+    inline unsigned int commitCount() const
+    {
+        return m_commits;
+    }
+
+    /**
+     * @brief Time the backend took for the last commit, in nanoseconds.
+     */
+    inline qint64 commitTime() const
+    {
+        return m_commitTime;
+    }
+
+    /**
+     * @brief Memory bus traffic of a plane, in bytes per second.
+     */
+    struct Bandwidth
+    {
+        /** Read by the display controller to scan the plane out. */
+        qint64 scanout;
+        /** Written into the framebuffers of the plane by the CPU. */
+        qint64 upload;
+
+        inline qint64 total() const
+        {
+            return scanout + upload;
+        }
+    };
+
+    /**
+     * @brief Bandwidth a plane uses right now.
+     *
+     * Scanout follows from the committed state of the plane: the part of its pan window that
+     * is on the screen, its format and the refresh rate.  Scaling changes what the plane
+     * covers on the screen, not what is read of it.  Only planes the display controller
+     * reads have scanout.  A virtual plane composited into a shared hardware plane has none,
+     * the shared plane is counted in totalBandwidth() instead.
+     *
+     * Upload is what was passed to addUpload() over the last BANDWIDTH_WINDOW, including what
+     * the backend copied on its own, like the compositing of a virtual plane.
+     *
+     * A null plane is the primary plane Qt draws into.  It always covers the whole screen at
+     * the depth of the Qt screen, and its upload is not counted.
+     */
+    Bandwidth bandwidth(struct plane_data* plane) const;
+
+    /**
+     * @brief Bandwidth of all planes together, the primary plane, and the hardware planes
+     * the backend composites into.
+     */
+    Bandwidth totalBandwidth() const;
+
+    /**
+     * @brief Count bytes the CPU wrote into the framebuffers of a plane.
+     *
+     * Plane items call this for every draw and upload, so the total includes streamed tiles
+     * and damage as well as full redraws.
+     */
+    void addUpload(struct plane_data* plane, qint64 bytes);
+
+    /**
+     * @brief Warn when the total bandwidth goes over a budget.
+     *
+     * Checked once every BANDWIDTH_WINDOW.  Going over prints a warning with
+     * bandwidthReport() and emits overBudget(), once until the total is back under the
+     * budget.
+     *
+     * @param bytes Bytes per second, 0 for no budget.
+     */
+    void setBandwidthBudget(qint64 bytes);
+
+    inline qint64 bandwidthBudget() const
+    {
+        return m_budget;
+    }
+
+    /**
+     * @brief A table of the bandwidth of every plane, with the total and the budget.
+     */
+    QString bandwidthReport() const;
+
+    /**
+     * @brief Frame time upload bandwidth is averaged over, in nanoseconds.
+     */
+    static const qint64 BANDWIDTH_WINDOW = 1000000000LL;
+
     virtual ~PlaneManager();
 
+signals:
+
+    /**
+     * @brief Emitted by the outermost commitFrame() before any plane is committed.
+     *
+     * The frame transaction is still open, so anything written here goes out with the same
+     * commit.
+     */
+    void aboutToCommit();
+
+    /**
+     * @brief Emitted when the total bandwidth goes over the budget.
+     * @param bytes Total bytes per second.
+     */
+    void overBudget(qint64 bytes);
+
+protected slots:
+
+    void commitPending();
+
 protected:
 
     /**
-     * @brief The KMS device used to manage planes.
+     * @brief Shadow state for a single plane.
      */
-    std::shared_ptr<kms_device> m_device;
+    struct PlaneShadow
+    {
+        struct plane_data* plane;
+        std::string name;
+        /** State requested for the next commit. */
+        PlaneState pending;
+        /** State last pushed to the hardware. */
+        PlaneState committed;
+        /** Bitmask of PlaneUpdate::Dirty* fields in pending that differ from committed. */
+        unsigned int dirty;
+        /** Bytes uploaded since the bandwidth window started. */
+        qint64 uploaded;
+        /** Upload bytes per second over the last window. */
+        qint64 uploadRate;
+    };
+
+    PlaneShadow* shadow(struct plane_data* plane);
+    const PlaneShadow* shadow(struct plane_data* plane) const;
+    qint64 scanout(const PlaneShadow& shadow) const;
+    qint64 scanout(struct plane_data* plane, const PlaneState& state) const;
+    qint64 primaryScanout() const;
+    QSize shownScreenSize() const;
+    void sampleBandwidth();
+    void addShadow(struct plane_data* plane);
+    void markDirty(PlaneShadow* shadow);
+
+    std::unique_ptr<PlaneBackend> m_backend;
 
     /**
      * @brief List of configured planes based on config file.
      */
     std::vector<plane_data*> m_planes;
+
+    /**
+     * @brief Shadow state for every configured plane.
+     */
+    std::vector<PlaneShadow> m_shadows;
+
+    /**
+     * @brief Updates of the commit in progress, kept around to avoid allocating every frame.
+     */
+    std::vector<PlaneUpdate> m_updates;
+
+    /**
+     * @brief Nesting depth of frame transactions.
+     */
+    int m_depth;
+
+    /**
+     * @brief True when an implicit transaction is waiting for the event loop.
+     */
+    bool m_pending;
+
+    unsigned int m_commits;
+    qint64 m_commitTime;
+
+    /** Start of the bandwidth window, -1 before the first commit. */
+    qint64 m_windowStart;
+    qint64 m_budget;
+    bool m_overBudget;
+
+    FrameScheduler* m_scheduler;
 };
 
 #endif // PLANEMANAGER_H
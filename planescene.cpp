@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "planescene.h"
+#include "framescheduler.h"
+#include "graphicsplaneitem.h"
+#include "planemanager.h"
+#include <algorithm>
+
+PlaneScene::PlaneScene(PlaneManager& planes, QObject* parent)
+    : QObject(parent),
+      m_planes(planes)
+{
+    m_planes.scheduler().setScene(this);
+}
+
+void PlaneScene::addItem(GraphicsPlaneItem* item, int z, unsigned int flags)
+{
+    removeItem(item);
+
+    auto i = std::upper_bound(m_items.begin(), m_items.end(), z,
+                              [](int z, const Item& item) {
+        return z < item.z;
+    });
+    m_items.insert(i, {item, z, flags});
+
+    m_advance.clear();
+    for (auto& i: m_items)
+        if (i.flags & Advance)
+            m_advance.push_back(i.item);
+}
+
+void PlaneScene::removeItem(GraphicsPlaneItem* item)
+{
+    m_items.erase(std::remove_if(m_items.begin(), m_items.end(),
+                                 [item](const Item& i) {
+        return i.item == item;
+    }), m_items.end());
+
+    m_advance.erase(std::remove(m_advance.begin(), m_advance.end(), item), m_advance.end());
+}
+
+GraphicsPlaneItem* PlaneScene::itemAt(const QPoint& pos) const
+{
+    for (auto i = m_items.rbegin(); i != m_items.rend(); ++i)
+        if (i->item->planeRect().contains(pos))
+            return i->item;
+
+    return 0;
+}
+
+bool PlaneScene::press(const QPoint& pos)
+{
+    for (auto i = m_items.rbegin(); i != m_items.rend(); ++i)
+    {
+        GraphicsPlaneItem* item = i->item;
+        if (item->planeRect().contains(pos) && item->pressEvent(pos - item->planePos()))
+            return true;
+    }
+
+    return false;
+}
+
+void PlaneScene::advance()
+{
+    for (int step = 0; step < 2; step++)
+        for (auto item: m_advance)
+            item->advance(step);
+}
+
+PlaneScene::~PlaneScene()
+{
+    m_planes.scheduler().setScene(0);
+}
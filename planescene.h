@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef PLANESCENE_H
+#define PLANESCENE_H
+
+#include <QObject>
+#include <QPoint>
+#include <vector>
+
+class GraphicsPlaneItem;
+class PlaneManager;
+
+/**
+ * @brief The PlaneScene class
+ *
+ * A scene for plane items only, next to the QGraphicsScene that keeps the widgets on the primary
+ * plane.
+ *
+ * Plane items do not need anything QGraphicsScene does for them.  The hardware stacks and
+ * draws them, so there is no index to maintain, no painting, and no need for double precision
+ * geometry.  Items in a PlaneScene are moved with GraphicsPlaneItem::moveTo(), which goes
+ * straight to the PlaneManager, and are advanced by the FrameScheduler from one flat array.
+ *
+ * The z value of an item is only used to find the item under a press.  The order planes are
+ * shown in is set by the hardware.
+ */
+class PlaneScene : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    enum Flags
+    {
+        /** Call advance() on the item every frame. */
+        Advance = 1 << 0,
+    };
+
+    PlaneScene(PlaneManager& planes, QObject* parent = 0);
+
+    void addItem(GraphicsPlaneItem* item, int z = 0, unsigned int flags = 0);
+
+    void removeItem(GraphicsPlaneItem* item);
+
+    /**
+     * @brief Topmost item under a point, or 0.
+     */
+    GraphicsPlaneItem* itemAt(const QPoint& pos) const;
+
+    /**
+     * @brief Deliver a press to the items under a point, top first.
+     * @return true if an item took it.
+     */
+    bool press(const QPoint& pos);
+
+    /**
+     * @brief Advance all items that asked for it, in two phases like QGraphicsScene::advance().
+     */
+    void advance();
+
+    inline int count() const
+    {
+        return m_items.size();
+    }
+
+    virtual ~PlaneScene();
+
+protected:
+
+    struct Item
+    {
+        GraphicsPlaneItem* item;
+        int z;
+        unsigned int flags;
+    };
+
+    PlaneManager& m_planes;
+
+    /**
+     * @brief Items sorted by z, bottom first.
+     */
+    std::vector<Item> m_items;
+
+    /**
+     * @brief Items with the Advance flag, in z order.
+     */
+    std::vector<GraphicsPlaneItem*> m_advance;
+};
+
+#endif // PLANESCENE_H
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "softwareplanebackend.h"
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QDebug>
+#include <algorithm>
+#include <cstdlib>
+
+SoftwarePlaneBackend::SoftwarePlaneBackend(const QSize& screen)
+    : m_screen(screen, QImage::Format_RGB32),
+      m_compositeOnCommit(true)
+{
+    m_screen.fill(Qt::black);
+}
+
+bool SoftwarePlaneBackend::load(const std::string& configfile, std::vector<plane_data*>& planes)
+{
+    QFile file(QString::fromStdString(configfile));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qDebug() << "failed to open " << file.fileName();
+        return false;
+    }
+
+    QJsonParseError error;
+    QJsonDocument doc = QJsonDocument::fromJson(file.readAll(), &error);
+    if (doc.isNull())
+    {
+        qDebug() << "failed to parse " << file.fileName() << error.errorString();
+        return false;
+    }
+
+    QJsonArray array = doc.object().value("planes").toArray();
+    for (int i = 0; i < array.size(); i++)
+    {
+        QJsonObject object = array.at(i).toObject();
+
+        SoftwarePlane plane;
+        plane.name = object.value("name").toString().toStdString();
+        plane.zpos = object.value("zpos").toInt(object.value("index").toInt(i));
+        plane.format = formatFromName(object.value("format").toString());
+        plane.state = PlaneState::unset();
+        plane.visible = false;
+
+        if (!plane.format)
+            plane.format = DRM_FORMAT_ARGB8888;
+
+        QImage buffer(object.value("width").toInt(m_screen.width()),
+                      object.value("height").toInt(m_screen.height()),
+                      formatImageFormat(plane.format));
+        buffer.fill(0);
+        plane.buffers.push_back(buffer);
+
+        /*
+         * Only the address is used, as a handle.
+         */
+        plane.handle = static_cast<struct plane_data*>(calloc(1, sizeof(struct plane_data)));
+
+        m_planes.push_back(plane);
+    }
+
+    std::stable_sort(m_planes.begin(), m_planes.end(),
+                     [](const SoftwarePlane& a, const SoftwarePlane& b) {
+        return a.zpos < b.zpos;
+    });
+
+    planes.clear();
+    for (auto& i: m_planes)
+        planes.push_back(i.handle);
+
+    return !m_planes.empty();
+}
+
+SoftwarePlaneBackend::SoftwarePlane* SoftwarePlaneBackend::find(struct plane_data* plane)
+{
+    for (auto& i: m_planes)
+        if (i.handle == plane)
+            return &i;
+
+    return 0;
+}
+
+const SoftwarePlaneBackend::SoftwarePlane* SoftwarePlaneBackend::find(struct plane_data* plane) const
+{
+    for (auto& i: m_planes)
+        if (i.handle == plane)
+            return &i;
+
+    return 0;
+}
+
+std::string SoftwarePlaneBackend::name(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->name : std::string();
+}
+
+int SoftwarePlaneBackend::commit(std::vector<PlaneUpdate>& updates)
+{
+    for (auto& u: updates)
+    {
+        SoftwarePlane* p = find(u.plane);
+        if (!p)
+            continue;
+
+        p->state = u.state;
+        p->visible = true;
+        u.applied = true;
+
+        if (u.dirty & PlaneUpdate::DirtyBuffer)
+        {
+            p->ring.queue(u.state.buffer);
+            p->ring.flipped();
+        }
+    }
+
+    if (m_compositeOnCommit)
+        composite();
+
+    return 1;
+}
+
+const QImage& SoftwarePlaneBackend::composite()
+{
+    m_screen.fill(Qt::black);
+
+    QPainter painter(&m_screen);
+
+    for (auto& p: m_planes)
+    {
+        const QImage& buffer = p.buffers[p.ring.front];
+        if (!p.visible || buffer.isNull())
+            continue;
+
+        drawPlane(painter, buffer, p.state);
+    }
+
+    painter.end();
+
+    return m_screen;
+}
+
+QRect SoftwarePlaneBackend::source(const QImage& buffer, const PlaneState& state)
+{
+    return QRect(state.pan_x != INT_MIN ? state.pan_x : 0,
+                 state.pan_y != INT_MIN ? state.pan_y : 0,
+                 state.pan_width > 0 ? state.pan_width : buffer.width(),
+                 state.pan_height > 0 ? state.pan_height : buffer.height());
+}
+
+QRect SoftwarePlaneBackend::target(const QImage& buffer, const PlaneState& state)
+{
+    double scale = state.scale > 0 ? state.scale : 1.0;
+    QRect pan = source(buffer, state);
+
+    return QRect(state.x != INT_MIN ? state.x : 0,
+                 state.y != INT_MIN ? state.y : 0,
+                 qRound(pan.width() * scale),
+                 qRound(pan.height() * scale));
+}
+
+void SoftwarePlaneBackend::drawPlane(QPainter& painter, const QImage& buffer,
+                                     const PlaneState& state)
+{
+    QRect from = source(buffer, state);
+    QRect to = target(buffer, state);
+
+    painter.setOpacity(state.alpha >= 0 ? state.alpha / 255.0 : 1.0);
+
+    if (state.reflection > 0)
+    {
+        /*
+         * Mirror the target in place, the same as a display controller reflecting the
+         * plane while scanning it out.
+         */
+        QPointF center = QRectF(to).center();
+        painter.save();
+        painter.translate(center);
+        painter.scale(state.reflection & PlaneState::ReflectX ? -1 : 1,
+                      state.reflection & PlaneState::ReflectY ? -1 : 1);
+        painter.translate(-center);
+        painter.drawImage(to, buffer, from);
+        painter.restore();
+    }
+    else
+    {
+        painter.drawImage(to, buffer, from);
+    }
+}
+
+int SoftwarePlaneBackend::reflections(struct plane_data* plane) const
+{
+    Q_UNUSED(plane);
+    return PlaneState::ReflectX | PlaneState::ReflectY;
+}
+
+bool SoftwarePlaneBackend::hasAlpha(struct plane_data* plane) const
+{
+    Q_UNUSED(plane);
+    return true;
+}
+
+void* SoftwarePlaneBackend::map(struct plane_data* plane)
+{
+    SoftwarePlane* p = find(plane);
+    return p ? p->buffers[p->ring.front].bits() : 0;
+}
+
+bool SoftwarePlaneBackend::reallocate(struct plane_data* plane, int width, int height, uint32_t format)
+{
+    SoftwarePlane* p = find(plane);
+    if (!p)
+        return false;
+
+    QImage::Format f = formatImageFormat(format);
+    if (f == QImage::Format_Invalid)
+        return false;
+
+    p->format = format;
+    for (auto& i: p->buffers)
+    {
+        i = QImage(width, height, f);
+        i.fill(0);
+    }
+
+    return true;
+}
+
+int SoftwarePlaneBackend::width(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->buffers[0].width() : 0;
+}
+
+int SoftwarePlaneBackend::height(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->buffers[0].height() : 0;
+}
+
+uint32_t SoftwarePlaneBackend::format(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->format : 0;
+}
+
+std::vector<uint32_t> SoftwarePlaneBackend::formats(struct plane_data* plane) const
+{
+    Q_UNUSED(plane);
+
+    /*
+     * Everything QPainter composites directly.  C8 would need a palette, which nothing sets.
+     */
+    return {DRM_FORMAT_ARGB8888, DRM_FORMAT_XRGB8888, DRM_FORMAT_RGB565, DRM_FORMAT_ARGB4444};
+}
+
+int SoftwarePlaneBackend::pitch(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->buffers[0].bytesPerLine() : 0;
+}
+
+bool SoftwarePlaneBackend::setBufferCount(struct plane_data* plane, int count)
+{
+    SoftwarePlane* p = find(plane);
+    if (!p || count < 1 || count > 3)
+        return false;
+
+    /*
+     * Keep what is on screen now in every framebuffer.  Items drop their content once it is
+     * drawn, so it would be lost with the first flip otherwise.
+     */
+    QImage front = p->buffers[p->ring.front];
+    p->buffers.clear();
+    p->buffers.push_back(front);
+    for (int i = 1; i < count; i++)
+        p->buffers.push_back(front.copy());
+
+    p->ring = BufferRing();
+    p->ring.count = count;
+
+    return true;
+}
+
+int SoftwarePlaneBackend::bufferCount(struct plane_data* plane) const
+{
+    const SoftwarePlane* p = find(plane);
+    return p ? p->buffers.size() : 0;
+}
+
+int SoftwarePlaneBackend::acquireBuffer(struct plane_data* plane)
+{
+    SoftwarePlane* p = find(plane);
+    return p ? p->ring.acquire() : -1;
+}
+
+void SoftwarePlaneBackend::releaseBuffer(struct plane_data* plane, int index)
+{
+    SoftwarePlane* p = find(plane);
+    if (p)
+        p->ring.release(index);
+}
+
+void* SoftwarePlaneBackend::mapBuffer(struct plane_data* plane, int index)
+{
+    SoftwarePlane* p = find(plane);
+    if (!p || index < 0 || index >= (int)p->buffers.size())
+        return 0;
+
+    return p->buffers[index].bits();
+}
+
+SoftwarePlaneBackend::~SoftwarePlaneBackend()
+{
+    for (auto& i: m_planes)
+        free(i.handle);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SOFTWAREPLANEBACKEND_H
+#define SOFTWAREPLANEBACKEND_H
+
+#include "planebackend.h"
+#include <QImage>
+#include <QPainter>
+
+/**
+ * @brief The SoftwarePlaneBackend class
+ *
+ * Planes kept entirely in memory, for running without DRM hardware.
+ *
+ * This reads the same config file as libplanes and models planes, pan windows, scaling, and
+ * z-order.  Planes are stacked by their "zpos", or else their "index" like the KMS planes
+ * are, and otherwise in the order they appear in the config file.  Visible planes are composited into an offscreen buffer, either on every
+ * commit or on demand with composite().
+ *
+ * Flips take effect as soon as they are committed.
+ */
+class SoftwarePlaneBackend : public PlaneBackend
+{
+public:
+
+    SoftwarePlaneBackend(const QSize& screen = QSize(800, 480));
+
+    virtual bool load(const std::string& configfile, std::vector<plane_data*>& planes) override;
+    virtual std::string name(struct plane_data* plane) const override;
+    virtual int commit(std::vector<PlaneUpdate>& updates) override;
+    virtual void* map(struct plane_data* plane) override;
+    virtual bool reallocate(struct plane_data* plane, int width, int height, uint32_t format) override;
+    virtual int width(struct plane_data* plane) const override;
+    virtual int height(struct plane_data* plane) const override;
+    virtual uint32_t format(struct plane_data* plane) const override;
+    virtual std::vector<uint32_t> formats(struct plane_data* plane) const override;
+    virtual int pitch(struct plane_data* plane) const override;
+    virtual bool setBufferCount(struct plane_data* plane, int count) override;
+    virtual int bufferCount(struct plane_data* plane) const override;
+    virtual int acquireBuffer(struct plane_data* plane) override;
+    virtual void releaseBuffer(struct plane_data* plane, int index) override;
+    virtual void* mapBuffer(struct plane_data* plane, int index) override;
+    virtual int reflections(struct plane_data* plane) const override;
+    virtual bool hasAlpha(struct plane_data* plane) const override;
+
+    virtual QSize screenSize() const override
+    {
+        return m_screen.size();
+    }
+
+    /**
+     * @brief Composite all visible planes into the offscreen buffer.
+     */
+    const QImage& composite();
+
+    /**
+     * @brief The offscreen buffer, as of the last composite.
+     */
+    inline const QImage& screen() const
+    {
+        return m_screen;
+    }
+
+    inline void setCompositeOnCommit(bool enable)
+    {
+        m_compositeOnCommit = enable;
+    }
+
+    /**
+     * @brief Draw a plane the way a display controller would scan it out.
+     */
+    static void drawPlane(QPainter& painter, const QImage& buffer, const PlaneState& state);
+
+    /**
+     * @brief The pan window of a plane, in framebuffer coordinates.
+     */
+    static QRect source(const QImage& buffer, const PlaneState& state);
+
+    /**
+     * @brief Where a plane ends up on the screen.
+     */
+    static QRect target(const QImage& buffer, const PlaneState& state);
+
+    virtual ~SoftwarePlaneBackend();
+
+protected:
+
+    struct SoftwarePlane
+    {
+        struct plane_data* handle;
+        std::string name;
+        int zpos;
+        uint32_t format;
+        /** Framebuffers of the plane, the one shown is buffers[ring.front]. */
+        std::vector<QImage> buffers;
+        BufferRing ring;
+        PlaneState state;
+        bool visible;
+    };
+
+    SoftwarePlane* find(struct plane_data* plane);
+    const SoftwarePlane* find(struct plane_data* plane) const;
+
+    /**
+     * @brief Planes sorted by z-order, bottom first.
+     */
+    std::vector<SoftwarePlane> m_planes;
+
+    QImage m_screen;
+
+    bool m_compositeOnCommit;
+};
+
+#endif // SOFTWAREPLANEBACKEND_H
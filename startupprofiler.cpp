@@ -0,0 +1,147 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "startupprofiler.h"
+#include <QFile>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <cstdio>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * The start time of a process in /proc is on the boot time clock, so all timestamps are too.
+ */
+static qint64 boottime_nsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static qint64 process_start_nsecs()
+{
+    QFile file("/proc/self/stat");
+    if (!file.open(QIODevice::ReadOnly))
+        return -1;
+
+    /*
+     * The command name can have spaces in it, so count fields from after it.  starttime is
+     * field 22, the 20th after the command name.
+     */
+    QByteArray stat = file.readAll();
+    QList<QByteArray> fields = stat.mid(stat.lastIndexOf(')') + 2).split(' ');
+    if (fields.size() < 20)
+        return -1;
+
+    return fields[19].toLongLong() * (1000000000LL / sysconf(_SC_CLK_TCK));
+}
+
+StartupProfiler& StartupProfiler::instance()
+{
+    static StartupProfiler profiler;
+    return profiler;
+}
+
+StartupProfiler::StartupProfiler()
+    : m_process(process_start_nsecs()),
+      m_reported(false)
+{
+    m_records.reserve(64);
+}
+
+void StartupProfiler::mark(const QString& name)
+{
+    qint64 now = boottime_nsecs();
+
+    QMutexLocker locker(&m_lock);
+    m_records.push_back({name, now, -1, (quintptr)QThread::currentThreadId()});
+}
+
+void StartupProfiler::begin(const QString& name)
+{
+    mark(name);
+}
+
+void StartupProfiler::end(const QString& name)
+{
+    qint64 now = boottime_nsecs();
+
+    QMutexLocker locker(&m_lock);
+    for (auto i = m_records.rbegin(); i != m_records.rend(); ++i)
+    {
+        if (i->name == name && i->end < 0)
+        {
+            i->end = now;
+            break;
+        }
+    }
+}
+
+void StartupProfiler::finish()
+{
+    mark("startup_done");
+    report();
+}
+
+void StartupProfiler::report()
+{
+    QMutexLocker locker(&m_lock);
+
+    if (m_reported || !qEnvironmentVariableIsSet("WILDWEST_STARTUP"))
+        return;
+    m_reported = true;
+
+    QString output = QString::fromLocal8Bit(qgetenv("WILDWEST_STARTUP"));
+    QFile file;
+    if (output == "1")
+    {
+        file.open(stderr, QIODevice::WriteOnly);
+    }
+    else
+    {
+        file.setFileName(output);
+        file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    }
+
+    if (!file.isOpen())
+        return;
+
+    std::vector<Record> records = m_records;
+    std::sort(records.begin(), records.end(), [](const Record& a, const Record& b) {
+        return a.start < b.start;
+    });
+
+    /*
+     * Times are in milliseconds since the process was started, which includes loading and
+     * linking before main().
+     */
+    qint64 origin = m_process >= 0 ? m_process : (records.empty() ? 0 : records.front().start);
+    std::vector<quintptr> threads;
+
+    QTextStream out(&file);
+    out << "startup, ms since process start:\n";
+    for (auto& r: records)
+    {
+        auto t = std::find(threads.begin(), threads.end(), r.thread);
+        if (t == threads.end())
+            t = threads.insert(threads.end(), r.thread);
+
+        out << QString("%1").arg((r.start - origin) / 1000000.0, 10, 'f', 3);
+        if (r.end >= 0)
+            out << QString(" +%1").arg((r.end - r.start) / 1000000.0, 9, 'f', 3);
+        else
+            out << QString(10, ' ');
+        out << QString("  [%1] ").arg(t - threads.begin()) << r.name << "\n";
+    }
+}
+
+StartupProfiler::~StartupProfiler()
+{
+    report();
+}
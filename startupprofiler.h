@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef STARTUPPROFILER_H
+#define STARTUPPROFILER_H
+
+#include <QMutex>
+#include <QString>
+#include <vector>
+
+/**
+ * @brief The StartupProfiler class
+ *
+ * Timestamps the phases of startup, from any thread, to see where time to first frame goes.
+ *
+ * Nothing is reported unless WILDWEST_STARTUP is set, to "1" for stderr or to a file name.
+ * The report is written once finish() is called, or on exit if startup never finished.
+ */
+class StartupProfiler
+{
+public:
+
+    static StartupProfiler& instance();
+
+    /**
+     * @brief Record a point in time.
+     */
+    void mark(const QString& name);
+
+    /**
+     * @brief Record a span of time, from begin() to end() with the same name.
+     */
+    void begin(const QString& name);
+    void end(const QString& name);
+
+    /**
+     * @brief Startup is done, write the report.
+     */
+    void finish();
+
+    /**
+     * @brief Record a span of time for the life of a scope.
+     */
+    class Scope
+    {
+    public:
+        Scope(const QString& name)
+            : m_name(name)
+        {
+            StartupProfiler::instance().begin(m_name);
+        }
+
+        ~Scope()
+        {
+            StartupProfiler::instance().end(m_name);
+        }
+
+    private:
+        QString m_name;
+    };
+
+    virtual ~StartupProfiler();
+
+protected:
+
+    StartupProfiler();
+
+    void report();
+
+    struct Record
+    {
+        QString name;
+        qint64 start;
+        /** -1 for a mark, or a span that never ended. */
+        qint64 end;
+        quintptr thread;
+    };
+
+    QMutex m_lock;
+    std::vector<Record> m_records;
+    /** Time the process was started, from /proc. */
+    qint64 m_process;
+    bool m_reported;
+};
+
+#endif // STARTUPPROFILER_H
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "systemsampler.h"
+#include "trace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static qint64 monotonic_nsecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static const char* skip_spaces(const char* p, const char* end)
+{
+    while (p < end && *p == ' ')
+        p++;
+    return p;
+}
+
+static const char* parse_u64(const char* p, const char* end, quint64& value)
+{
+    p = skip_spaces(p, end);
+    value = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+        value = value * 10 + (*p++ - '0');
+    return p;
+}
+
+static const char* next_line(const char* p, const char* end)
+{
+    p = static_cast<const char*>(memchr(p, '\n', end - p));
+    return p ? p + 1 : end;
+}
+
+SystemSampler::SystemSampler()
+    : m_stat(::open("/proc/stat", O_RDONLY | O_CLOEXEC)),
+      m_self(::open("/proc/self/stat", O_RDONLY | O_CLOEXEC)),
+      m_meminfo(::open("/proc/meminfo", O_RDONLY | O_CLOEXEC)),
+      m_ticks(sysconf(_SC_CLK_TCK)),
+      m_pageKb(sysconf(_SC_PAGESIZE) / 1024),
+      m_lastProcess(0),
+      m_lastTime(0),
+      m_count(0),
+      m_running(false)
+{
+    memset(m_last, 0, sizeof(m_last));
+    memset(m_ring, 0, sizeof(m_ring));
+}
+
+void SystemSampler::start(int msecs)
+{
+    if (m_running)
+        return;
+
+    m_running = true;
+    m_thread = std::thread(&SystemSampler::run, this, msecs);
+}
+
+void SystemSampler::stop()
+{
+    {
+        std::lock_guard<std::mutex> locker(m_lock);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void SystemSampler::run(int msecs)
+{
+    /*
+     * Never compete with the GUI thread for a core.
+     */
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+    Trace::setThreadName("sampler");
+
+    std::unique_lock<std::mutex> locker(m_lock);
+    while (m_running)
+    {
+        locker.unlock();
+        sample();
+        locker.lock();
+
+        m_wake.wait_for(locker, std::chrono::milliseconds(msecs), [this]() {
+            return !m_running;
+        });
+    }
+}
+
+void SystemSampler::sample()
+{
+    /*
+     * The slot written is the oldest one, which readers check for after copying it.
+     */
+    quint64 count = m_count.load(std::memory_order_relaxed);
+    if (readSample(m_ring[count % HISTORY]))
+        m_count.store(count + 1, std::memory_order_release);
+}
+
+bool SystemSampler::read(int fd, char* buffer, size_t size)
+{
+    if (fd < 0)
+        return false;
+
+    ssize_t n = pread(fd, buffer, size - 1, 0);
+    if (n <= 0)
+        return false;
+
+    buffer[n] = 0;
+    return true;
+}
+
+bool SystemSampler::readSample(Sample& s)
+{
+    memset(&s, 0, sizeof(s));
+    s.time = monotonic_nsecs();
+
+    if (!read(m_stat, m_buffer, sizeof(m_buffer)))
+        return false;
+
+    /*
+     * The cpu lines come first, the total and then one per core:
+     *
+     *     cpu0 user nice system idle iowait irq softirq steal ...
+     */
+    const char* p = m_buffer;
+    const char* end = m_buffer + strlen(m_buffer);
+    while (end - p > 3 && !memcmp(p, "cpu", 3))
+    {
+        p += 3;
+
+        int index = 0;
+        if (*p != ' ')
+        {
+            quint64 cpu;
+            p = parse_u64(p, end, cpu);
+            index = cpu + 1;
+        }
+
+        quint64 t[8];
+        for (auto& v: t)
+            p = parse_u64(p, end, v);
+
+        Times times;
+        times.busy = t[0] + t[1] + t[2] + t[5] + t[6] + t[7];
+        times.total = times.busy + t[3] + t[4];
+
+        if (index <= MAX_CPUS)
+        {
+            /*
+             * The first sample is the average since boot.
+             */
+            const Times& last = m_last[index];
+            float usage = times.total > last.total ?
+                100.0f * (times.busy - last.busy) / (times.total - last.total) : 0.0f;
+
+            if (index)
+            {
+                s.cpu[index - 1] = usage;
+                s.cpus = std::max(s.cpus, index);
+            }
+            else
+            {
+                s.total = usage;
+            }
+
+            m_last[index] = times;
+        }
+
+        p = next_line(p, end);
+    }
+
+    /*
+     * Fields of /proc/self/stat, counted from the one after the command name, which can have
+     * spaces in it.
+     */
+    if (read(m_self, m_buffer, sizeof(m_buffer)))
+    {
+        const int UTIME = 11, STIME = 12, RSS = 21;
+
+        end = m_buffer + strlen(m_buffer);
+        p = strrchr(m_buffer, ')');
+
+        quint64 process = 0;
+        for (int field = -1; p && p < end && field <= RSS; field++)
+        {
+            quint64 value;
+            if (field == UTIME || field == STIME)
+            {
+                parse_u64(p, end, value);
+                process += value;
+            }
+            else if (field == RSS)
+            {
+                parse_u64(p, end, value);
+                s.rssKb = value * m_pageKb;
+            }
+
+            p = static_cast<const char*>(memchr(p, ' ', end - p));
+            if (p)
+                p++;
+        }
+
+        if (m_lastTime && s.time > m_lastTime)
+            s.process = 100.0f * (process - m_lastProcess) * 1000000000LL / m_ticks /
+                (s.time - m_lastTime);
+
+        m_lastProcess = process;
+        m_lastTime = s.time;
+    }
+
+    if (read(m_meminfo, m_buffer, sizeof(m_buffer)))
+    {
+        end = m_buffer + strlen(m_buffer);
+        for (p = m_buffer; p < end; p = next_line(p, end))
+        {
+            if (!strncmp(p, "MemTotal:", 9))
+                parse_u64(p + 9, end, s.memTotalKb);
+            else if (!strncmp(p, "MemAvailable:", 13))
+                parse_u64(p + 13, end, s.memAvailableKb);
+        }
+    }
+
+    return true;
+}
+
+bool SystemSampler::latest(Sample& sample) const
+{
+    for (;;)
+    {
+        quint64 count = m_count.load(std::memory_order_acquire);
+        if (!count)
+            return false;
+
+        sample = m_ring[(count - 1) % HISTORY];
+
+        /*
+         * Good unless the sampler got all the way around the ring and started writing the
+         * slot again while it was copied.
+         */
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_count.load(std::memory_order_relaxed) - (count - 1) < HISTORY)
+            return true;
+    }
+}
+
+int SystemSampler::history(Sample* samples, int count) const
+{
+    for (;;)
+    {
+        quint64 total = m_count.load(std::memory_order_acquire);
+        int n = std::min<quint64>(std::min(count, HISTORY - 1), total);
+
+        for (int i = 0; i < n; i++)
+            samples[i] = m_ring[(total - n + i) % HISTORY];
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_count.load(std::memory_order_relaxed) - (total - n) < HISTORY)
+            return n;
+    }
+}
+
+SystemSampler::~SystemSampler()
+{
+    stop();
+
+    if (m_stat >= 0)
+        ::close(m_stat);
+    if (m_self >= 0)
+        ::close(m_self);
+    if (m_meminfo >= 0)
+        ::close(m_meminfo);
+}
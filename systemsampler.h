@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef SYSTEMSAMPLER_H
+#define SYSTEMSAMPLER_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * @brief The SystemSampler class
+ *
+ * Samples CPU and memory use on a thread of its own, so watching the system does not add
+ * jitter to the GUI thread.
+ *
+ * /proc/stat, /proc/self/stat and /proc/meminfo are opened once and read with pread() into
+ * fixed buffers, and parsed in place.  Samples go into a short history ring that any thread can
+ * read without taking a lock.
+ */
+class SystemSampler
+{
+public:
+
+    /**
+     * @brief Most cores reported, any others are only counted in the total.
+     */
+    static const int MAX_CPUS = 8;
+
+    /**
+     * @brief Samples kept in the history.
+     */
+    static const int HISTORY = 64;
+
+    struct Sample
+    {
+        /** Time of the sample in nanoseconds on the monotonic clock. */
+        qint64 time;
+        /** Number of cores in cpu. */
+        int cpus;
+        /** Busy percentage of all cores together. */
+        float total;
+        /** Busy percentage of each core. */
+        float cpu[MAX_CPUS];
+        /** CPU used by this process, in percent of one core. */
+        float process;
+        /** Resident memory of this process. */
+        quint64 rssKb;
+        quint64 memTotalKb;
+        quint64 memAvailableKb;
+    };
+
+    SystemSampler();
+
+    /**
+     * @brief Start sampling on a background thread.
+     */
+    void start(int msecs = 1000);
+
+    void stop();
+
+    /**
+     * @brief Take a sample on the calling thread.
+     *
+     * Only one thread may take samples, so this is for when the sampler is not started.
+     */
+    void sample();
+
+    /**
+     * @brief Get the newest sample.
+     * @return false if there is none yet.
+     */
+    bool latest(Sample& sample) const;
+
+    /**
+     * @brief Get up to count of the newest samples, oldest first.
+     * @return Number of samples copied.
+     */
+    int history(Sample* samples, int count) const;
+
+    virtual ~SystemSampler();
+
+protected:
+
+    struct Times
+    {
+        quint64 busy;
+        quint64 total;
+    };
+
+    void run(int msecs);
+    bool read(int fd, char* buffer, size_t size);
+    bool readSample(Sample& sample);
+
+    int m_stat;
+    int m_self;
+    int m_meminfo;
+    long m_ticks;
+    long m_pageKb;
+
+    /** Jiffies of the previous sample, the total first. */
+    Times m_last[MAX_CPUS + 1];
+    quint64 m_lastProcess;
+    qint64 m_lastTime;
+
+    /** Buffer the /proc files are read into. */
+    char m_buffer[4096];
+
+    Sample m_ring[HISTORY];
+    /** Number of samples ever published, only the sampling thread writes it. */
+    std::atomic<quint64> m_count;
+
+    std::thread m_thread;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    bool m_running;
+};
+
+#endif // SYSTEMSAMPLER_H
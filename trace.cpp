@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "trace.h"
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTextStream>
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+std::atomic<bool> Trace::s_enabled(false);
+
+namespace
+{
+
+/*
+ * One per thread that ever recorded an event.  Rings are never freed, so events of threads
+ * that have exited still make it into the trace.
+ */
+struct Ring
+{
+    Trace::Event events[Trace::RING_SIZE];
+    /** Number of events ever written, only the owning thread writes it. */
+    std::atomic<quint64> head;
+    long tid;
+    char name[32];
+    Ring* next;
+};
+
+std::atomic<Ring*> rings(0);
+thread_local Ring* ring = 0;
+
+int signalPipe[2] = {-1, -1};
+
+Ring* threadRing()
+{
+    if (ring)
+        return ring;
+
+    ring = new Ring;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tid = syscall(SYS_gettid);
+    ring->name[0] = 0;
+
+    /*
+     * Push onto the list of rings, the only time threads have to agree on anything.
+     */
+    Ring* first = rings.load(std::memory_order_relaxed);
+    do
+    {
+        ring->next = first;
+    } while (!rings.compare_exchange_weak(first, ring, std::memory_order_release,
+                                          std::memory_order_relaxed));
+
+    return ring;
+}
+
+const char* categoryName(int category)
+{
+    switch (category)
+    {
+    case Trace::Frame:
+        return "frame";
+    case Trace::Planes:
+        return "planes";
+    case Trace::Assets:
+        return "assets";
+    case Trace::Input:
+        return "input";
+    case Trace::Animation:
+        return "animation";
+    case Trace::Graphics:
+        return "graphics";
+    }
+
+    return "other";
+}
+
+void signalHandler(int)
+{
+    /*
+     * Nothing in here is safe to do from a signal handler but write(), the trace is written
+     * from the event loop.
+     */
+    char c = 0;
+    ssize_t ret = write(signalPipe[1], &c, 1);
+    Q_UNUSED(ret);
+}
+
+}
+
+void Trace::start()
+{
+    s_enabled.store(true, std::memory_order_relaxed);
+}
+
+void Trace::stop()
+{
+    s_enabled.store(false, std::memory_order_relaxed);
+}
+
+qint64 Trace::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void Trace::record(Type type, int category, const char* name, qint64 time, qint64 value)
+{
+    Ring* r = threadRing();
+    quint64 head = r->head.load(std::memory_order_relaxed);
+
+    Event& e = r->events[head & (RING_SIZE - 1)];
+    e.time = time;
+    e.value = value;
+    e.name = name;
+    e.type = type;
+    e.category = category;
+
+    r->head.store(head + 1, std::memory_order_release);
+}
+
+void Trace::setThreadName(const char* name)
+{
+    if (!enabled())
+        return;
+
+    Ring* r = threadRing();
+    strncpy(r->name, name, sizeof(r->name) - 1);
+    r->name[sizeof(r->name) - 1] = 0;
+}
+
+void Trace::install()
+{
+    if (!qEnvironmentVariableIsSet("WILDWEST_TRACE"))
+        return;
+
+    QString filename = QString::fromLocal8Bit(qgetenv("WILDWEST_TRACE"));
+
+    QCoreApplication* app = QCoreApplication::instance();
+    if (!app)
+        return;
+
+    QObject::connect(app, &QCoreApplication::aboutToQuit, [filename]() {
+        dump(filename);
+    });
+
+    if (pipe2(signalPipe, O_CLOEXEC | O_NONBLOCK) == 0)
+    {
+        QSocketNotifier* notifier = new QSocketNotifier(signalPipe[0], QSocketNotifier::Read, app);
+        QObject::connect(notifier, &QSocketNotifier::activated, [filename]() {
+            char c;
+            while (read(signalPipe[0], &c, 1) > 0)
+                ;
+            dump(filename);
+        });
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = signalHandler;
+        sa.sa_flags = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR2, &sa, 0);
+    }
+
+    start();
+}
+
+bool Trace::dump(const QString& filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qDebug() << "failed to open trace file " << filename;
+        return false;
+    }
+
+    QTextStream out(&file);
+    out.setRealNumberNotation(QTextStream::FixedNotation);
+    out.setRealNumberPrecision(3);
+
+    const qint64 pid = getpid();
+    bool first = true;
+    auto separator = [&out, &first]() {
+        if (!first)
+            out << ",\n";
+        first = false;
+    };
+
+    std::vector<Event> events(RING_SIZE);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    for (Ring* r = rings.load(std::memory_order_acquire); r; r = r->next)
+    {
+        /*
+         * The owner keeps writing while the ring is copied.  When head reads as after, it
+         * may already be writing event after, which goes in the slot of event
+         * after - RING_SIZE.  Events up to that one are dropped, none of the slots of the
+         * rest were written to while they were copied.
+         */
+        quint64 head = r->head.load(std::memory_order_acquire);
+        quint64 begin = head > (quint64)RING_SIZE ? head - RING_SIZE : 0;
+        for (quint64 i = begin; i < head; i++)
+            events[i - begin] = r->events[i & (RING_SIZE - 1)];
+        quint64 after = r->head.load(std::memory_order_acquire);
+        quint64 valid = after + 1 > (quint64)RING_SIZE ? after + 1 - RING_SIZE : 0;
+
+        if (r->name[0])
+        {
+            separator();
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" <<
+                r->tid << ",\"args\":{\"name\":\"" << r->name << "\"}}";
+        }
+
+        for (quint64 i = std::max(begin, valid); i < head; i++)
+        {
+            const Event& e = events[i - begin];
+
+            separator();
+            out << "{\"name\":\"" << e.name << "\",\"cat\":\"" << categoryName(e.category) <<
+                "\",\"pid\":" << pid << ",\"tid\":" << r->tid << ",\"ts\":" << e.time / 1000.0;
+
+            switch (e.type)
+            {
+            case Complete:
+                out << ",\"ph\":\"X\",\"dur\":" << e.value / 1000.0 << "}";
+                break;
+            case Instant:
+                out << ",\"ph\":\"i\",\"s\":\"t\"}";
+                break;
+            case Counter:
+                out << ",\"ph\":\"C\",\"args\":{\"value\":" << e.value << "}}";
+                break;
+            }
+        }
+    }
+    out << "\n]}\n";
+
+    return out.status() == QTextStream::Ok;
+}
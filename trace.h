@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+#include <atomic>
+
+/**
+ * @brief The Trace class
+ *
+ * Binary trace of what happens on every thread, cheap enough to leave in the hot paths.
+ *
+ * Every thread writes fixed size events into a ring buffer of its own, so recording an event
+ * takes no lock and never allocates.  When a ring is full the oldest events are overwritten,
+ * which keeps the last few seconds around at all times.  The rings are written out as Chrome
+ * trace JSON, which chrome://tracing and ui.perfetto.dev both open.
+ *
+ * Trace points are the TRACE_* macros below.  Building with CONFIG += NOTRACE compiles them
+ * out.  Otherwise WILDWEST_TRACE_CATEGORIES, a mask of Category, picks the categories that are
+ * compiled in, and a trace point costs one relaxed load until tracing is started.
+ *
+ * Event names are not copied and have to be string literals.
+ */
+class Trace
+{
+public:
+
+    enum Category
+    {
+        Frame = 1 << 0,
+        Planes = 1 << 1,
+        Assets = 1 << 2,
+        Input = 1 << 3,
+        Animation = 1 << 4,
+        /** QGraphicsItem and QGraphicsView callbacks, very frequent. */
+        Graphics = 1 << 5,
+        All = 0xff,
+    };
+
+    enum Type
+    {
+        /** A span of time, value is the duration. */
+        Complete,
+        /** A point in time. */
+        Instant,
+        /** A value at a point in time. */
+        Counter,
+    };
+
+    struct Event
+    {
+        qint64 time;
+        qint64 value;
+        const char* name;
+        quint8 type;
+        quint8 category;
+    };
+
+    /**
+     * @brief Events kept per thread, a power of two.
+     */
+    static const int RING_SIZE = 8192;
+
+    static inline bool enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    static void start();
+    static void stop();
+
+    /**
+     * @brief Start tracing if WILDWEST_TRACE is set to a file name.
+     *
+     * The trace is written to that file when the application quits, and every time the
+     * process gets SIGUSR2.  Call once the QCoreApplication exists.
+     */
+    static void install();
+
+    /**
+     * @brief Time events are recorded with, in nanoseconds on the monotonic clock.
+     *
+     * The same clock as the FrameScheduler, so frame times line up with the trace.
+     */
+    static qint64 now();
+
+    static void record(Type type, int category, const char* name, qint64 time, qint64 value);
+
+    /**
+     * @brief Name the calling thread in the trace, if tracing.
+     */
+    static void setThreadName(const char* name);
+
+    /**
+     * @brief Write every ring as Chrome trace JSON.
+     */
+    static bool dump(const QString& filename);
+
+    /**
+     * @brief Record a Complete event for the life of a scope.
+     */
+    class Scope
+    {
+    public:
+        Scope(bool compiled, int category, const char* name)
+            : m_name(compiled && Trace::enabled() ? name : 0),
+              m_category(category),
+              m_start(m_name ? Trace::now() : 0)
+        {
+        }
+
+        ~Scope()
+        {
+            if (m_name)
+                Trace::record(Complete, m_category, m_name, m_start, Trace::now() - m_start);
+        }
+
+    private:
+        const char* m_name;
+        int m_category;
+        qint64 m_start;
+    };
+
+protected:
+
+    static std::atomic<bool> s_enabled;
+};
+
+#ifndef WILDWEST_TRACE_CATEGORIES
+#define WILDWEST_TRACE_CATEGORIES (Trace::All & ~Trace::Graphics)
+#endif
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef WILDWEST_TRACE
+
+#define TRACE_ON(category) \
+    (((WILDWEST_TRACE_CATEGORIES) & (category)) && Trace::enabled())
+
+#define TRACE_SCOPE(category, name) \
+    Trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)( \
+        ((WILDWEST_TRACE_CATEGORIES) & (category)) != 0, category, name)
+
+#define TRACE_INSTANT(category, name) \
+    do { \
+        if (TRACE_ON(category)) \
+            Trace::record(Trace::Instant, category, name, Trace::now(), 0); \
+    } while (0)
+
+#define TRACE_COUNTER(category, name, value) \
+    do { \
+        if (TRACE_ON(category)) \
+            Trace::record(Trace::Counter, category, name, Trace::now(), value); \
+    } while (0)
+
+#else
+
+#define TRACE_ON(category) false
+#define TRACE_SCOPE(category, name) do {} while (0)
+#define TRACE_INSTANT(category, name) do {} while (0)
+#define TRACE_COUNTER(category, name, value) do {} while (0)
+
+#endif
+
+#endif // TRACE_H
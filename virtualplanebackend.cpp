@@ -0,0 +1,790 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include "virtualplanebackend.h"
+#include "softwareplanebackend.h"
+#include <QFile>
+#include <QGuiApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QPainter>
+#include <QScreen>
+#include <QDebug>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+/*
+ * Weight of the latest commit in the moving average of how busy a plane is.
+ */
+static const double RATE_WEIGHT = 1.0 / 8.0;
+
+/*
+ * How much busier another plane has to be to take a hardware plane away.
+ */
+static const double HYSTERESIS = 0.25;
+
+/*
+ * Everything that has to be written to show a state on a plane that was showing something
+ * else.
+ */
+static unsigned int state_dirty(const PlaneState& state)
+{
+    unsigned int dirty = PlaneUpdate::DirtyFull;
+
+    if (state.x != INT_MIN)
+        dirty |= PlaneUpdate::DirtyPos;
+    if (state.scale > 0)
+        dirty |= PlaneUpdate::DirtyScale;
+    if (state.pan_x != INT_MIN)
+        dirty |= PlaneUpdate::DirtyPanPos;
+    if (state.pan_width > 0)
+        dirty |= PlaneUpdate::DirtyPanSize;
+    if (state.reflection >= 0)
+        dirty |= PlaneUpdate::DirtyReflection;
+    if (state.alpha >= 0)
+        dirty |= PlaneUpdate::DirtyAlpha;
+
+    return dirty;
+}
+
+/*
+ * Unset fields are left alone on the hardware, so undo whatever the previous virtual plane
+ * on it set.
+ */
+static PlaneState hardware_state(const PlaneState& state, const PlaneState& previous)
+{
+    PlaneState result = state;
+    result.buffer = -1;
+
+    if (result.reflection < 0 && previous.reflection > 0)
+        result.reflection = 0;
+    if (result.alpha < 0 && previous.alpha >= 0)
+        result.alpha = 255;
+
+    return result;
+}
+
+VirtualPlaneBackend::VirtualPlaneBackend(std::unique_ptr<PlaneBackend> hardware)
+    : m_hardware(std::move(hardware)),
+      m_commits(0),
+      m_reassign(false)
+{
+}
+
+bool VirtualPlaneBackend::load(const std::string& configfile, std::vector<plane_data*>& planes)
+{
+    std::vector<plane_data*> hardware;
+    if (!m_hardware->load(configfile, hardware))
+        return false;
+
+    planes = hardware;
+
+    QFile file(QString::fromStdString(configfile));
+    if (!file.open(QIODevice::ReadOnly))
+        return true;
+
+    QJsonObject root = QJsonDocument::fromJson(file.readAll()).object();
+    QJsonArray array = root.value("virtual").toArray();
+    if (array.isEmpty())
+        return true;
+
+    /*
+     * Hardware planes are stacked the same way the software backend stacks them.
+     */
+    QJsonArray config = root.value("planes").toArray();
+    for (auto plane: hardware)
+    {
+        if (!plane)
+            continue;
+
+        int zpos = 0;
+        for (int i = 0; i < config.size(); i++)
+        {
+            QJsonObject object = config.at(i).toObject();
+            if (object.value("name").toString().toStdString() == m_hardware->name(plane))
+                zpos = object.value("zpos").toInt(object.value("index").toInt(i));
+        }
+
+        m_pool.push_back({plane, zpos, 0, false, true, PlaneState::unset(), 0});
+    }
+
+    std::stable_sort(m_pool.begin(), m_pool.end(),
+                     [](const HardwarePlane& a, const HardwarePlane& b) {
+        return a.zpos < b.zpos;
+    });
+
+    QSize screen = screenSize();
+    if (!screen.isValid() && QGuiApplication::primaryScreen())
+        screen = QGuiApplication::primaryScreen()->size();
+
+    for (int i = 0; i < array.size(); i++)
+    {
+        QJsonObject object = array.at(i).toObject();
+        int width = object.value("width").toInt(screen.width());
+        int height = object.value("height").toInt(screen.height());
+
+        struct plane_data* plane = create(object.value("name").toString().toStdString(),
+                                          width, height, object.value("zpos").toInt(i));
+        if (!plane)
+            return false;
+
+        uint32_t format = formatFromName(object.value("format").toString());
+        if (format && !reallocate(plane, width, height, format))
+            return false;
+    }
+
+    planes.clear();
+    for (auto& i: m_planes)
+        planes.push_back(i.handle);
+
+    qDebug() << m_planes.size() << " virtual planes on " << m_pool.size() << " hardware planes";
+
+    return true;
+}
+
+VirtualPlaneBackend::VirtualPlane* VirtualPlaneBackend::find(struct plane_data* plane)
+{
+    for (auto& i: m_planes)
+        if (i.handle == plane)
+            return &i;
+
+    return 0;
+}
+
+const VirtualPlaneBackend::VirtualPlane* VirtualPlaneBackend::find(struct plane_data* plane) const
+{
+    for (auto& i: m_planes)
+        if (i.handle == plane)
+            return &i;
+
+    return 0;
+}
+
+VirtualPlaneBackend::HardwarePlane* VirtualPlaneBackend::findHardware(struct plane_data* plane)
+{
+    for (auto& i: m_pool)
+        if (i.plane == plane)
+            return &i;
+
+    return 0;
+}
+
+std::string VirtualPlaneBackend::name(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->name : m_hardware->name(plane);
+}
+
+struct plane_data* VirtualPlaneBackend::create(const std::string& name, int width, int height,
+                                               int zpos)
+{
+    if (m_pool.empty() || width <= 0 || height <= 0)
+        return 0;
+
+    VirtualPlane v;
+    v.name = name;
+    v.zpos = zpos;
+    v.format = DRM_FORMAT_ARGB8888;
+    v.image = QImage(width, height, formatImageFormat(v.format));
+    v.image.fill(0);
+    v.state = PlaneState::unset();
+    v.visible = false;
+    v.dirty = 0;
+    v.rate = 0;
+    v.hardware = 0;
+    v.uploaded = 0;
+
+    /*
+     * Only the address is used, as a handle.
+     */
+    v.handle = static_cast<struct plane_data*>(calloc(1, sizeof(struct plane_data)));
+
+    auto i = std::upper_bound(m_planes.begin(), m_planes.end(), zpos,
+                              [](int z, const VirtualPlane& p) {
+        return z < p.zpos;
+    });
+    m_planes.insert(i, v);
+
+    m_reassign = true;
+
+    return v.handle;
+}
+
+int VirtualPlaneBackend::commit(std::vector<PlaneUpdate>& updates)
+{
+    m_updates.clear();
+    m_direct.clear();
+
+    for (auto& v: m_planes)
+        v.rate *= 1.0 - RATE_WEIGHT;
+
+    /*
+     * Virtual planes only take the state here, the hardware planes get it below.  Anything
+     * else is a hardware plane used directly and goes straight through.
+     */
+    bool moved = false;
+    for (size_t i = 0; i < updates.size(); i++)
+    {
+        PlaneUpdate& u = updates[i];
+        VirtualPlane* v = find(u.plane);
+        if (!v)
+        {
+            m_direct.push_back(i);
+            m_updates.push_back(u);
+            continue;
+        }
+
+        if (!v->visible)
+        {
+            v->visible = true;
+            m_reassign = true;
+        }
+
+        v->state = u.state;
+        v->dirty |= u.dirty;
+        v->rate += RATE_WEIGHT;
+        u.applied = true;
+
+        if (u.dirty & PlaneUpdate::DirtyPos)
+            moved = true;
+    }
+
+    /*
+     * A move can put a composited plane over a promoted one below it, which would then be
+     * drawn on top of it, so that has to be sorted out in this commit.
+     */
+    if (moved && !m_reassign && promotedCovered())
+        m_reassign = true;
+
+    m_commits++;
+    if (m_reassign || !(m_commits % REASSIGN_INTERVAL))
+        reassign();
+
+    for (auto& h: m_pool)
+    {
+        if (h.owner)
+        {
+            VirtualPlane* v = find(h.owner);
+            if (v && v->dirty)
+            {
+                if (v->dirty & (PlaneUpdate::DirtyContent | PlaneUpdate::DirtyFull))
+                    upload(*v, h);
+
+                h.state = hardware_state(v->state, h.state);
+                h.dirty |= v->dirty & ~PlaneUpdate::DirtyBuffer;
+                v->dirty = 0;
+            }
+        }
+        else if (h.shared)
+        {
+            composite(h, h.dirty & PlaneUpdate::DirtyFull);
+        }
+        else if (!h.cleared)
+        {
+            clear(h);
+        }
+
+        /*
+         * Hardware planes stay dirty until a commit gets through, so failed commits are
+         * retried.
+         */
+        if (h.dirty)
+            m_updates.push_back({h.plane, h.state, h.dirty, false});
+    }
+
+    if (m_updates.empty())
+        return 0;
+
+    int commits = m_hardware->commit(m_updates);
+
+    for (size_t i = 0; i < m_updates.size(); i++)
+    {
+        if (i < m_direct.size())
+        {
+            updates[m_direct[i]].applied = m_updates[i].applied;
+        }
+        else if (m_updates[i].applied)
+        {
+            HardwarePlane* h = findHardware(m_updates[i].plane);
+            if (h)
+                h->dirty = 0;
+        }
+    }
+
+    return commits;
+}
+
+bool VirtualPlaneBackend::promotedCovered() const
+{
+    for (auto& p: m_planes)
+    {
+        if (!p.visible || !p.hardware)
+            continue;
+
+        QRect rect = SoftwarePlaneBackend::target(p.image, p.state);
+        for (auto& o: m_planes)
+            if (&o > &p && o.visible && !o.hardware &&
+                rect.intersects(SoftwarePlaneBackend::target(o.image, o.state)))
+                return true;
+    }
+
+    return false;
+}
+
+void VirtualPlaneBackend::reassign()
+{
+    m_reassign = false;
+
+    if (m_pool.empty())
+        return;
+
+    /*
+     * Pointers into m_planes are in z-order, bottom first.
+     */
+    std::vector<VirtualPlane*> visible;
+    for (auto& v: m_planes)
+        if (v.visible)
+            visible.push_back(&v);
+
+    size_t slots = m_pool.size();
+    bool shared = visible.size() > slots;
+    if (shared)
+        slots--;
+
+    std::vector<VirtualPlane*> chosen;
+    if (!shared)
+    {
+        chosen = visible;
+    }
+    else
+    {
+        /*
+         * Busiest first.  A plane keeps its hardware plane unless another one is clearly
+         * busier, so planes do not flap back and forth.
+         */
+        std::vector<VirtualPlane*> candidates = visible;
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [](const VirtualPlane* a, const VirtualPlane* b) {
+            double ra = a->rate + (a->hardware ? HYSTERESIS : 0);
+            double rb = b->rate + (b->hardware ? HYSTERESIS : 0);
+            return ra > rb || (ra == rb && a > b);
+        });
+
+        /*
+         * A plane can not be promoted while a composited plane above it overlaps it.
+         * Promoting a plane only ever unblocks others, so go around until nothing changes.
+         */
+        bool progress = true;
+        while (progress && chosen.size() < slots)
+        {
+            progress = false;
+            for (auto c: candidates)
+            {
+                if (chosen.size() >= slots)
+                    break;
+                if (std::find(chosen.begin(), chosen.end(), c) != chosen.end())
+                    continue;
+
+                QRect rect = SoftwarePlaneBackend::target(c->image, c->state);
+                bool blocked = false;
+                for (auto o: visible)
+                {
+                    if (o <= c || std::find(chosen.begin(), chosen.end(), o) != chosen.end())
+                        continue;
+
+                    if (rect.intersects(SoftwarePlaneBackend::target(o->image, o->state)))
+                    {
+                        blocked = true;
+                        break;
+                    }
+                }
+
+                if (!blocked)
+                {
+                    chosen.push_back(c);
+                    progress = true;
+                }
+            }
+        }
+
+        std::sort(chosen.begin(), chosen.end());
+    }
+
+    std::vector<struct plane_data*> previous;
+    for (auto& v: m_planes)
+    {
+        previous.push_back(v.hardware);
+        v.hardware = 0;
+    }
+
+    /*
+     * The shared plane is the bottom one, and the chosen planes go on top of it in order.
+     */
+    size_t first = shared ? 1 : 0;
+    for (size_t i = 0; i < m_pool.size(); i++)
+    {
+        HardwarePlane& h = m_pool[i];
+        bool isShared = shared && i == 0;
+        VirtualPlane* owner = !isShared && i - first < chosen.size() ? chosen[i - first] : 0;
+
+        if (owner)
+            owner->hardware = h.plane;
+
+        if ((owner ? owner->handle : 0) == h.owner && isShared == h.shared)
+            continue;
+
+        if (isShared)
+        {
+            QSize screen = screenSize();
+            if (!screen.isValid() && QGuiApplication::primaryScreen())
+                screen = QGuiApplication::primaryScreen()->size();
+
+            if (m_hardware->width(h.plane) != screen.width() ||
+                m_hardware->height(h.plane) != screen.height() ||
+                m_hardware->format(h.plane) != DRM_FORMAT_ARGB8888)
+                m_hardware->reallocate(h.plane, screen.width(), screen.height(),
+                                       DRM_FORMAT_ARGB8888);
+
+            h.state = {0, 0, 1.0, 0, 0, screen.width(), screen.height(), -1,
+                       h.state.reflection > 0 ? 0 : -1, h.state.alpha >= 0 ? 255 : -1};
+            h.dirty |= state_dirty(h.state);
+        }
+
+        if (owner)
+            owner->dirty |= state_dirty(owner->state) | PlaneUpdate::DirtyContent;
+
+        h.owner = owner ? owner->handle : 0;
+        h.shared = isShared;
+        h.cleared = owner || isShared;
+    }
+
+    for (size_t i = 0; i < m_planes.size(); i++)
+    {
+        VirtualPlane& v = m_planes[i];
+
+        if (previous[i] && !v.hardware)
+        {
+            qDebug() << "demoted virtual plane " << v.name.c_str();
+            v.dirty |= PlaneUpdate::DirtyContent;
+        }
+        else if (!previous[i] && v.hardware && v.composited.isValid())
+        {
+            qDebug() << "promoted virtual plane " << v.name.c_str();
+            m_damage += v.composited;
+            v.composited = QRect();
+        }
+    }
+}
+
+bool VirtualPlaneBackend::upload(VirtualPlane& v, HardwarePlane& h)
+{
+    if (m_hardware->width(h.plane) != v.image.width() ||
+        m_hardware->height(h.plane) != v.image.height() ||
+        m_hardware->format(h.plane) != v.format)
+    {
+        if (!m_hardware->reallocate(h.plane, v.image.width(), v.image.height(), v.format))
+        {
+            qDebug() << "failed to reallocate hardware plane for " << v.name.c_str();
+            return false;
+        }
+
+        h.dirty |= PlaneUpdate::DirtyFull;
+    }
+
+    uchar* bits = static_cast<uchar*>(m_hardware->map(h.plane));
+    if (!bits)
+        return false;
+
+    int pitch = m_hardware->pitch(h.plane);
+    int bytes = qMin(pitch, v.image.bytesPerLine());
+    for (int y = 0; y < v.image.height(); y++)
+        memcpy(bits + y * pitch, v.image.constScanLine(y), bytes);
+
+    v.uploaded += (qint64)bytes * v.image.height();
+    h.dirty |= PlaneUpdate::DirtyContent;
+
+    return true;
+}
+
+void VirtualPlaneBackend::composite(HardwarePlane& h, bool full)
+{
+    QRect bounds(0, 0, m_hardware->width(h.plane), m_hardware->height(h.plane));
+
+    /*
+     * Only redraw where composited planes were and are now.
+     */
+    QRegion damage = m_damage;
+    for (auto& v: m_planes)
+    {
+        if (!v.visible || v.hardware || (!v.dirty && !full))
+            continue;
+
+        QRect rect = SoftwarePlaneBackend::target(v.image, v.state);
+        damage += v.composited;
+        damage += rect;
+        v.composited = rect;
+        v.dirty = 0;
+    }
+
+    m_damage = QRegion();
+
+    if (full)
+        damage = bounds;
+
+    damage &= bounds;
+    if (damage.isEmpty())
+        return;
+
+    uchar* bits = static_cast<uchar*>(m_hardware->map(h.plane));
+    if (!bits)
+        return;
+
+    QImage fb(bits, bounds.width(), bounds.height(), m_hardware->pitch(h.plane),
+              formatImageFormat(m_hardware->format(h.plane)));
+
+    QPainter painter(&fb);
+    painter.setClipRegion(damage);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(damage.boundingRect(), Qt::transparent);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    int depth = fb.depth() / 8;
+    for (auto& v: m_planes)
+    {
+        if (!v.visible || v.hardware || !damage.intersects(v.composited))
+            continue;
+
+        SoftwarePlaneBackend::drawPlane(painter, v.image, v.state);
+
+        for (const QRect& rect: damage & v.composited)
+            v.uploaded += (qint64)rect.width() * rect.height() * depth;
+    }
+
+    painter.end();
+
+    h.dirty |= PlaneUpdate::DirtyContent;
+}
+
+void VirtualPlaneBackend::clear(HardwarePlane& h)
+{
+    /*
+     * A hardware plane nobody uses shows a transparent framebuffer.
+     */
+    void* bits = m_hardware->map(h.plane);
+    if (bits)
+        memset(bits, 0, m_hardware->pitch(h.plane) * m_hardware->height(h.plane));
+
+    h.cleared = true;
+    h.dirty |= PlaneUpdate::DirtyContent;
+}
+
+bool VirtualPlaneBackend::scannedOut(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return !v || v->hardware;
+}
+
+std::vector<PlaneBackend::SharedPlane> VirtualPlaneBackend::sharedPlanes() const
+{
+    std::vector<SharedPlane> shared;
+    for (auto& h: m_pool)
+        if (h.shared)
+            shared.push_back({h.plane, h.state});
+
+    return shared;
+}
+
+qint64 VirtualPlaneBackend::takeUploaded(struct plane_data* plane)
+{
+    VirtualPlane* v = find(plane);
+    if (!v)
+        return 0;
+
+    qint64 bytes = v->uploaded;
+    v->uploaded = 0;
+    return bytes;
+}
+
+struct plane_data* VirtualPlaneBackend::assigned(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->hardware : plane;
+}
+
+void* VirtualPlaneBackend::map(struct plane_data* plane)
+{
+    VirtualPlane* v = find(plane);
+    return v ? v->image.bits() : m_hardware->map(plane);
+}
+
+bool VirtualPlaneBackend::reallocate(struct plane_data* plane, int width, int height,
+                                     uint32_t format)
+{
+    VirtualPlane* v = find(plane);
+    if (!v)
+        return m_hardware->reallocate(plane, width, height, format);
+
+    QImage::Format f = formatImageFormat(format);
+    if (f == QImage::Format_Invalid)
+        return false;
+
+    v->format = format;
+    v->image = QImage(width, height, f);
+    v->image.fill(0);
+    v->dirty |= PlaneUpdate::DirtyFull;
+
+    /*
+     * The size decides which planes overlap.
+     */
+    m_reassign = true;
+
+    return true;
+}
+
+int VirtualPlaneBackend::width(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->image.width() : m_hardware->width(plane);
+}
+
+int VirtualPlaneBackend::height(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->image.height() : m_hardware->height(plane);
+}
+
+uint32_t VirtualPlaneBackend::format(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->format : m_hardware->format(plane);
+}
+
+std::vector<uint32_t> VirtualPlaneBackend::formats(struct plane_data* plane) const
+{
+    /*
+     * A virtual plane can end up on any hardware plane, so it stays in the one format it was
+     * given.
+     */
+    if (find(plane))
+        return PlaneBackend::formats(plane);
+
+    return m_hardware->formats(plane);
+}
+
+int VirtualPlaneBackend::pitch(struct plane_data* plane) const
+{
+    const VirtualPlane* v = find(plane);
+    return v ? v->image.bytesPerLine() : m_hardware->pitch(plane);
+}
+
+/*
+ * Content of virtual planes is copied to the hardware at commit time anyway, so there is
+ * nothing to gain from flipping them.
+ */
+bool VirtualPlaneBackend::setBufferCount(struct plane_data* plane, int count)
+{
+    if (!find(plane))
+        return m_hardware->setBufferCount(plane, count);
+
+    return count == 1;
+}
+
+int VirtualPlaneBackend::bufferCount(struct plane_data* plane) const
+{
+    if (!find(plane))
+        return m_hardware->bufferCount(plane);
+
+    return 1;
+}
+
+int VirtualPlaneBackend::acquireBuffer(struct plane_data* plane)
+{
+    if (!find(plane))
+        return m_hardware->acquireBuffer(plane);
+
+    return -1;
+}
+
+void VirtualPlaneBackend::releaseBuffer(struct plane_data* plane, int index)
+{
+    if (!find(plane))
+        m_hardware->releaseBuffer(plane, index);
+}
+
+void* VirtualPlaneBackend::mapBuffer(struct plane_data* plane, int index)
+{
+    VirtualPlane* v = find(plane);
+    if (!v)
+        return m_hardware->mapBuffer(plane, index);
+
+    return index == 0 ? v->image.bits() : 0;
+}
+
+void VirtualPlaneBackend::flipped()
+{
+    m_hardware->flipped();
+}
+
+PlaneBackend* VirtualPlaneBackend::flipBackend()
+{
+    return m_hardware->flipBackend();
+}
+
+/*
+ * A virtual plane can end up on any hardware plane, or be composited, which can do
+ * everything.  Only what every plane of the pool can do is safe to use.
+ */
+int VirtualPlaneBackend::reflections(struct plane_data* plane) const
+{
+    if (!find(plane))
+        return m_hardware->reflections(plane);
+
+    int result = PlaneState::ReflectX | PlaneState::ReflectY;
+    for (auto& h: m_pool)
+        result &= m_hardware->reflections(h.plane);
+
+    return result;
+}
+
+bool VirtualPlaneBackend::copiesContent(struct plane_data* plane) const
+{
+    return find(plane) || m_hardware->copiesContent(plane);
+}
+
+bool VirtualPlaneBackend::hasAlpha(struct plane_data* plane) const
+{
+    if (!find(plane))
+        return m_hardware->hasAlpha(plane);
+
+    for (auto& h: m_pool)
+        if (!m_hardware->hasAlpha(h.plane))
+            return false;
+
+    return true;
+}
+
+int VirtualPlaneBackend::fd() const
+{
+    return m_hardware->fd();
+}
+
+QSize VirtualPlaneBackend::screenSize() const
+{
+    return m_hardware->screenSize();
+}
+
+void VirtualPlaneBackend::step()
+{
+    m_hardware->step();
+}
+
+VirtualPlaneBackend::~VirtualPlaneBackend()
+{
+    for (auto& i: m_planes)
+        free(i.handle);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (C) 2018 Microchip Technology Inc.  All rights reserved.
+ * Joshua Henderson <joshua.henderson@microchip.com>
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#ifndef VIRTUALPLANEBACKEND_H
+#define VIRTUALPLANEBACKEND_H
+
+#include "planebackend.h"
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <memory>
+
+/**
+ * @brief The VirtualPlaneBackend class
+ *
+ * Shows any number of virtual planes on the few planes the hardware has.
+ *
+ * Virtual planes are declared in the config file next to the hardware planes:
+ *
+ *     "virtual": [
+ *         {"name": "cactus", "width": 120, "height": 200, "zpos": 1}
+ *     ]
+ *
+ * Without that, every call goes straight to the hardware backend.  With it, the hardware planes
+ * become a pool and only the virtual planes are handed out.
+ *
+ * Every virtual plane has its own framebuffer in memory.  The hottest planes, the ones that
+ * change most often, get a hardware plane of their own and their content is copied to it when
+ * it changes.  When there are more visible virtual planes than hardware planes, the bottom
+ * hardware plane is shared and everything else is composited into it in software.  Planes are
+ * promoted and demoted as they get busier or quieter.
+ *
+ * A plane is only promoted if no composited plane above it overlaps it, because composited
+ * planes always end up below the ones with a plane of their own.  A move that makes them
+ * overlap reassigns the planes in the same commit.
+ */
+class VirtualPlaneBackend : public PlaneBackend
+{
+public:
+
+    VirtualPlaneBackend(std::unique_ptr<PlaneBackend> hardware);
+
+    inline PlaneBackend* hardware() const
+    {
+        return m_hardware.get();
+    }
+
+    virtual bool load(const std::string& configfile, std::vector<plane_data*>& planes) override;
+    virtual std::string name(struct plane_data* plane) const override;
+    virtual struct plane_data* create(const std::string& name, int width, int height,
+                                      int zpos) override;
+    virtual int commit(std::vector<PlaneUpdate>& updates) override;
+    virtual void* map(struct plane_data* plane) override;
+    virtual bool reallocate(struct plane_data* plane, int width, int height, uint32_t format) override;
+    virtual int width(struct plane_data* plane) const override;
+    virtual int height(struct plane_data* plane) const override;
+    virtual uint32_t format(struct plane_data* plane) const override;
+    virtual std::vector<uint32_t> formats(struct plane_data* plane) const override;
+    virtual int pitch(struct plane_data* plane) const override;
+    virtual bool setBufferCount(struct plane_data* plane, int count) override;
+    virtual int bufferCount(struct plane_data* plane) const override;
+    virtual int acquireBuffer(struct plane_data* plane) override;
+    virtual void releaseBuffer(struct plane_data* plane, int index) override;
+    virtual void* mapBuffer(struct plane_data* plane, int index) override;
+    virtual void flipped() override;
+    virtual PlaneBackend* flipBackend() override;
+    virtual bool scannedOut(struct plane_data* plane) const override;
+    virtual std::vector<SharedPlane> sharedPlanes() const override;
+    virtual qint64 takeUploaded(struct plane_data* plane) override;
+    virtual int reflections(struct plane_data* plane) const override;
+    virtual bool copiesContent(struct plane_data* plane) const override;
+    virtual bool hasAlpha(struct plane_data* plane) const override;
+    virtual int fd() const override;
+    virtual QSize screenSize() const override;
+    virtual void step() override;
+
+    /**
+     * @brief The hardware plane a virtual plane is shown on.
+     * @return 0 if the plane is composited into the shared plane.
+     */
+    struct plane_data* assigned(struct plane_data* plane) const;
+
+    /**
+     * @brief Commits between looking at which planes should be promoted or demoted.
+     */
+    static const int REASSIGN_INTERVAL = 30;
+
+    virtual ~VirtualPlaneBackend();
+
+protected:
+
+    struct VirtualPlane
+    {
+        struct plane_data* handle;
+        std::string name;
+        int zpos;
+        uint32_t format;
+        QImage image;
+        PlaneState state;
+        bool visible;
+        /** Bitmask of PlaneUpdate::Dirty* not pushed to the hardware yet. */
+        unsigned int dirty;
+        /** Screen rectangle as of the last composite, for damage. */
+        QRect composited;
+        /** Moving average of how many commits change the plane, from 0 to 1. */
+        double rate;
+        /** Hardware plane it is shown on, or 0. */
+        struct plane_data* hardware;
+        /** Bytes copied to hardware planes since the last takeUploaded(). */
+        qint64 uploaded;
+    };
+
+    struct HardwarePlane
+    {
+        struct plane_data* plane;
+        int zpos;
+        /** Virtual plane shown on it, or 0. */
+        struct plane_data* owner;
+        /** True if the composited planes are shown on it. */
+        bool shared;
+        /** True once the framebuffer has been cleared after losing its owner. */
+        bool cleared;
+        PlaneState state;
+        /** Bitmask of PlaneUpdate::Dirty* not committed yet. */
+        unsigned int dirty;
+    };
+
+    VirtualPlane* find(struct plane_data* plane);
+    const VirtualPlane* find(struct plane_data* plane) const;
+    HardwarePlane* findHardware(struct plane_data* plane);
+
+    void reassign();
+    bool promotedCovered() const;
+    bool upload(VirtualPlane& v, HardwarePlane& h);
+    void composite(HardwarePlane& h, bool full);
+    void clear(HardwarePlane& h);
+
+    std::unique_ptr<PlaneBackend> m_hardware;
+
+    /**
+     * @brief Virtual planes sorted by z-order, bottom first.
+     */
+    std::vector<VirtualPlane> m_planes;
+
+    /**
+     * @brief Hardware planes sorted by z-order, bottom first.
+     */
+    std::vector<HardwarePlane> m_pool;
+
+    /**
+     * @brief Updates for the hardware backend, kept around to avoid allocating every commit.
+     */
+    std::vector<PlaneUpdate> m_updates;
+    /** Index in the commit of each update that went straight through. */
+    std::vector<int> m_direct;
+
+    /**
+     * @brief Area of the shared plane left behind by planes that were promoted.
+     */
+    QRegion m_damage;
+
+    unsigned int m_commits;
+    bool m_reassign;
+};
+
+#endif // VIRTUALPLANEBACKEND_H
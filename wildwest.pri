@@ -0,0 +1,102 @@
+#-------------------------------------------------
+#
+# Sources and dependencies shared by the demo and the benchmark.
+#
+#-------------------------------------------------
+
+QT += concurrent
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+SOURCES += \
+    $$PWD/animationengine.cpp \
+    $$PWD/assetpack.cpp \
+    $$PWD/entitysystem.cpp \
+    $$PWD/evdevinput.cpp \
+    $$PWD/planemanager.cpp \
+    $$PWD/memoryledger.cpp \
+    $$PWD/softwareplanebackend.cpp \
+    $$PWD/framescheduler.cpp \
+    $$PWD/frametimeline.cpp \
+    $$PWD/pixelkernels.cpp \
+    $$PWD/planescene.cpp \
+    $$PWD/startupprofiler.cpp \
+    $$PWD/systemsampler.cpp \
+    $$PWD/trace.cpp \
+    $$PWD/virtualplanebackend.cpp \
+    $$PWD/graphicsplaneitem.cpp \
+    $$PWD/graphicsentityitem.cpp \
+    $$PWD/graphicshuditem.cpp \
+    $$PWD/graphicslayeritem.cpp \
+    $$PWD/graphicsplaneview.cpp \
+    $$PWD/graphicsspriteitem.cpp \
+    $$PWD/graphicsstreamlayeritem.cpp
+
+HEADERS  += \
+    $$PWD/animationengine.h \
+    $$PWD/assetpack.h \
+    $$PWD/entitysystem.h \
+    $$PWD/evdevinput.h \
+    $$PWD/pixelformat.h \
+    $$PWD/planemanager.h \
+    $$PWD/planebackend.h \
+    $$PWD/memoryledger.h \
+    $$PWD/softwareplanebackend.h \
+    $$PWD/framescheduler.h \
+    $$PWD/frametimeline.h \
+    $$PWD/pixelkernels.h \
+    $$PWD/planescene.h \
+    $$PWD/startupprofiler.h \
+    $$PWD/systemsampler.h \
+    $$PWD/trace.h \
+    $$PWD/virtualplanebackend.h \
+    $$PWD/graphicsplaneitem.h \
+    $$PWD/graphicsentityitem.h \
+    $$PWD/graphicshuditem.h \
+    $$PWD/graphicslayeritem.h \
+    $$PWD/graphicsplaneview.h \
+    $$PWD/graphicsspriteitem.h \
+    $$PWD/graphicsstreamlayeritem.h
+
+RESOURCES += \
+    $$PWD/media.qrc
+
+# The pixel kernels use NEON or SSE2 when the compiler targets them.  AVX2 has to be asked for.
+AVX2 {
+    QMAKE_CXXFLAGS += -mavx2
+}
+
+# Trace points, see trace.h.  NOTRACE compiles them out, and TRACE_CATEGORIES is a mask of
+# Trace::Category to compile in, such as TRACE_CATEGORIES=0xff for all of them.
+!NOTRACE {
+    DEFINES += WILDWEST_TRACE
+    !isEmpty(TRACE_CATEGORIES): DEFINES += WILDWEST_TRACE_CATEGORIES=$$TRACE_CATEGORIES
+}
+
+CONFIG += link_pkgconfig
+
+# LZ4 compressed images in the asset pack.
+LZ4 {
+    DEFINES += HAVE_LZ4
+    PKGCONFIG += liblz4
+}
+
+# SOFTWARE_ONLY builds without the KMS backend, libplanes and libdrm, for running the demo and
+# the benchmark on a PC with the software backend.  Only the kernel headers are needed.
+SOFTWARE_ONLY {
+    DEFINES += WILDWEST_SOFTWARE_ONLY
+} else {
+    SOURCES += $$PWD/kmsplanebackend.cpp
+    HEADERS += $$PWD/kmsplanebackend.h
+
+    LOCALPLANES {
+        PKGCONFIG += tslib
+        INCLUDEPATH += $(HOME)/planes/include/
+        LIBS += -L$(HOME)/planes/src/.libs -lplanes
+    } else {
+        PKGCONFIG += libplanes
+    }
+
+    PKGCONFIG += libdrm cairo libcjson lua
+}
@@ -23,25 +23,34 @@ DEFINES += QT_DEPRECATED_WARNINGS QT_NO_DEBUG_OUTPUT
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 
-SOURCES += main.cpp \
-    planemanager.cpp \
-    tools.cpp \
-    graphicsplaneitem.cpp \
-    graphicslayeritem.cpp \
-    graphicsplaneview.cpp \
-    graphicsspriteitem.cpp
+SOURCES += main.cpp
 
-HEADERS  += \
-    planemanager.h \
-    tools.h \
-    graphicsplaneitem.h \
-    graphicslayeritem.h \
-    graphicsplaneview.h \
-    graphicsspriteitem.h
+#CONFIG += LOCALPLANES
+#CONFIG += AVX2
+#CONFIG += LZ4
+#CONFIG += NOTRACE
+#CONFIG += SOFTWARE_ONLY
+
+include(wildwest.pri)
 
 DISTFILES += \
     wildwest.screen
 
+# 'make pack' builds the asset pack with the host tool in assetpack/.  Point ASSETPACK_TOOL at
+# it when it is not in the PATH, and add --lz4 to ASSETPACK_FLAGS for a compressed pack.
+isEmpty(ASSETPACK_TOOL): ASSETPACK_TOOL = wildwest-assetpack
+ASSETS = \
+    media/overlay0.png \
+    media/overlay1.png \
+    media/man.png \
+    media/primary.png \
+    media/logo.png
+pack.target = wildwest.pack
+pack.commands = $$ASSETPACK_TOOL $$ASSETPACK_FLAGS --format argb8888 --root $$PWD \
+    -o $$OUT_PWD/wildwest.pack $$join(ASSETS, " $$PWD/", "$$PWD/")
+pack.depends = $$join(ASSETS, " $$PWD/", "$$PWD/")
+QMAKE_EXTRA_TARGETS += pack
+
 target.path = /opt/wildwest
 target.files = wildwest
 extra.path = /opt/wildwest
@@ -50,21 +59,7 @@ configfile.path = /opt/ApplicationLauncher/applications/xml
 configfile.files = resources/10-wildwest.xml
 imagefile.path = /opt/ApplicationLauncher/applications/resources
 imagefile.files = resources/wildwest.png
-INSTALLS += target configfile imagefile extra
-
-CONFIG += link_pkgconfig
-
-LOCALPLANES {
-    PKGCONFIG += tslib
-    INCLUDEPATH += $(HOME)/planes/include/
-    LIBS += -L$(HOME)/planes/src/.libs -lplanes
-} else {
-    PKGCONFIG += libplanes
-}
-
-PKGCONFIG += libdrm cairo libcjson lua
-
-#CONFIG += LOCALPLANES
-
-RESOURCES += \
-    media.qrc
+packfile.path = /opt/wildwest
+packfile.files = $$OUT_PWD/wildwest.pack
+packfile.CONFIG += no_check_exist
+INSTALLS += target configfile imagefile extra packfile